@@ -0,0 +1,143 @@
+/**
+ * Shared helpers for the benchmark programs
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Vertices along the side of a generated sector */
+#define BENCH_BLOCK (16)
+
+/** Distance between generated vertices */
+#define BENCH_SPACING (4)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Summary of a set of timing samples
+ */
+typedef struct bench_stats_struct
+{
+    double mean, stddev, min, max;
+} bench_stats_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+/**
+ * Monotonic timestamp in nanoseconds
+ */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Summarize a set of samples
+ */
+static inline void bench_stats(const double *samples, uint32_t n, bench_stats_t *stats)
+{
+    double sum = 0, var = 0;
+
+    stats->min = stats->max = (n) ? samples[0] : 0;
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        sum += samples[i];
+        stats->min = (samples[i] < stats->min) ? samples[i] : stats->min;
+        stats->max = (samples[i] > stats->max) ? samples[i] : stats->max;
+    }
+    stats->mean = (n) ? sum / n : 0;
+
+    for(uint32_t i = 0; i < n; ++i) var += (samples[i] - stats->mean) * (samples[i] - stats->mean);
+    stats->stddev = (n > 1) ? sqrt(var / (n - 1)) : 0;
+}
+
+static inline void bench_write_wall(FILE *fp, uint32_t v0, uint32_t v1, int32_t neighbor)
+{
+    if(neighbor < 0) fprintf(fp, " %u %u x 0 0 0", v0, v1);
+    else             fprintf(fp, " %u %u %i 0 0 0", v0, v1, neighbor);
+}
+
+/**
+ * Write a synthetic level with roughly /vertices vertices. Levels are
+ * a square grid of vertices carved into square sectors of BENCH_BLOCK
+ * x BENCH_BLOCK cells, so every sector line carries 4 * BENCH_BLOCK
+ * walls and shares portals with its neighbors. Sector ids run row by
+ * row from the origin.
+ * @return Size of the file in bytes, or -1 on error
+ */
+static inline long bench_write_level(const char *filename, uint32_t vertices)
+{
+    FILE *fp = fopen(filename, "wt");
+    uint32_t m = (uint32_t)(sqrt((double)vertices) - 1) / BENCH_BLOCK;
+    uint32_t side, x0, y0;
+    int32_t id;
+    long size;
+
+    if(fp == NULL) return -1;
+    if(m == 0) m = 1;
+    side = (m * BENCH_BLOCK) + 1;
+
+    for(uint32_t y = 0; y < side; ++y)
+    {
+        for(uint32_t x = 0; x < side; ++x)
+        {
+            fprintf(fp, "v %u %u %u\n", (y * side) + x, x * BENCH_SPACING, y * BENCH_SPACING);
+        }
+    }
+
+    // One sector per block, walls in counterclockwise order
+    for(uint32_t by = 0; by < m; ++by)
+    {
+        for(uint32_t bx = 0; bx < m; ++bx)
+        {
+            id = (by * m) + bx;
+            x0 = bx * BENCH_BLOCK;
+            y0 = by * BENCH_BLOCK;
+            fprintf(fp, "s %i 0 20 0 0 255 %u", id, 4 * BENCH_BLOCK);
+            for(uint32_t i = 0; i < BENCH_BLOCK; ++i)
+            {
+                bench_write_wall(fp, (y0 * side) + x0 + i, (y0 * side) + x0 + i + 1,
+                                 (by > 0) ? id - (int32_t)m : -1);
+            }
+            for(uint32_t j = 0; j < BENCH_BLOCK; ++j)
+            {
+                bench_write_wall(fp, ((y0 + j) * side) + x0 + BENCH_BLOCK, ((y0 + j + 1) * side) + x0 + BENCH_BLOCK,
+                                 (bx < m - 1) ? id + 1 : -1);
+            }
+            for(uint32_t i = BENCH_BLOCK; i > 0; --i)
+            {
+                bench_write_wall(fp, ((y0 + BENCH_BLOCK) * side) + x0 + i, ((y0 + BENCH_BLOCK) * side) + x0 + i - 1,
+                                 (by < m - 1) ? id + (int32_t)m : -1);
+            }
+            for(uint32_t j = BENCH_BLOCK; j > 0; --j)
+            {
+                bench_write_wall(fp, ((y0 + j) * side) + x0, ((y0 + j - 1) * side) + x0,
+                                 (bx > 0) ? id - 1 : -1);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    fprintf(fp, "p 2 2 0\n");
+
+    size = ftell(fp);
+    fclose(fp);
+
+    return size;
+}
+
+#endif /*__BENCH_H__*/
@@ -0,0 +1,114 @@
+/**
+ * Level loading benchmark.
+ *
+ * Generates synthetic .pel levels of increasing size and times
+ * world_load() on each of them: on one thread with portals as given in
+ * the file, linked automatically, and parsed on one thread per core.
+ */
+
+// Global headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+// Project headers
+#include "bench.h"
+#include "world.h"
+#include "job.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define LEVEL_NAME "bench_load.pel"
+#define REPS  (3)
+
+/* ***********************************
+ * Main function
+ * ***********************************/
+int main(void)
+{
+    uint32_t sizes[] = {10000, 100000, 1000000};
+    uint32_t numSizes = sizeof(sizes) / sizeof(sizes[0]);
+    world_t *world = world_get_world();
+
+    printf("%10s %10s %10s %10s %10s %10s %10s %12s %12s\n",
+           "vertices", "sectors", "walls", "MB", "best ms", "mean ms", "MB/s", "autolink ms", "parallel ms");
+
+    for(uint32_t s = 0; s < numSizes; ++s)
+    {
+        uint64_t best = UINT64_MAX, total = 0, linked = UINT64_MAX, parallel = UINT64_MAX;
+        long bytes = bench_write_level(LEVEL_NAME, sizes[s]);
+        uint32_t nv = 0, ns = 0, nw = 0;
+
+        if(bytes < 0)
+        {
+            printf("Can't write %s\n", LEVEL_NAME);
+            return -1;
+        }
+
+        for(int r = 0; r < REPS; ++r)
+        {
+            uint64_t t0 = bench_now_ns(), dt;
+            if(world_load(LEVEL_NAME) != 0)
+            {
+                printf("Failed to load %s\n", LEVEL_NAME);
+                remove(LEVEL_NAME);
+                return -1;
+            }
+            dt = bench_now_ns() - t0;
+            nv = world->numVertices;
+            ns = world->numSectors;
+            nw = world->numWalls;
+            world_close();
+
+            total += dt;
+            best = (dt < best) ? dt : best;
+        }
+
+        for(int r = 0; r < REPS; ++r)
+        {
+            uint64_t t0 = bench_now_ns(), dt;
+            if(world_load_ex(LEVEL_NAME, WORLD_LOAD_AUTOLINK) != 0)
+            {
+                printf("Failed to load %s with portals linked automatically\n", LEVEL_NAME);
+                remove(LEVEL_NAME);
+                return -1;
+            }
+            dt = bench_now_ns() - t0;
+            world_close();
+
+            linked = (dt < linked) ? dt : linked;
+        }
+
+        if(job_init(0) != 0)
+        {
+            remove(LEVEL_NAME);
+            return -1;
+        }
+        for(int r = 0; r < REPS; ++r)
+        {
+            uint64_t t0 = bench_now_ns(), dt;
+            if(world_load(LEVEL_NAME) != 0)
+            {
+                printf("Failed to load %s on %u threads\n", LEVEL_NAME, job_threads());
+                job_close();
+                remove(LEVEL_NAME);
+                return -1;
+            }
+            dt = bench_now_ns() - t0;
+            world_close();
+
+            parallel = (dt < parallel) ? dt : parallel;
+        }
+        job_close();
+
+        printf("%10u %10u %10u %10.1f %10.2f %10.2f %10.1f %12.2f %12.2f\n", nv, ns, nw,
+               bytes / 1e6, best / 1e6, (total / REPS) / 1e6, (bytes / 1e6) / (best / 1e9),
+               linked / 1e6, parallel / 1e6);
+        remove(LEVEL_NAME);
+    }
+
+    return 0;
+}
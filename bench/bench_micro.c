@@ -0,0 +1,476 @@
+/**
+ * Micro-benchmarks for the geometry kernels.
+ *
+ * Every kernel runs over a table of precomputed inputs, once with
+ * random inputs and once with inputs picked to hit its slow or
+ * degenerate paths. Each case is warmed up, then timed over several
+ * samples, and reported as ns per call with the spread across samples.
+ */
+
+// Global headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Project headers
+#include "bench.h"
+#include "util.h"
+#include "world.h"
+#include "render_wall.h"
+#include "edge.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define LEVEL_NAME "bench_micro.pel"
+
+/** Inputs per table, small enough to stay in cache */
+#define INPUTS (4096)
+
+/** Calls per sample */
+#define OPS (1 << 18)
+
+#define WARMUP  (3)
+#define SAMPLES (15)
+
+/** Sectors in the generated level */
+#define NGON_SMALL (8)
+#define NGON_LARGE (256)
+#define COMB_TEETH (64)
+#define SECTOR_SIZE (100.0)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct segs_struct
+{
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+} segs_t;
+
+typedef struct inside_struct
+{
+    xy_t p;
+    sector_t *sect;
+} inside_t;
+
+typedef struct pair_struct
+{
+    r_wall_t w1, w2;
+} pair_t;
+
+typedef struct bench_case_struct
+{
+    const char *kernel, *input;
+    uint64_t (*fn)(const void *data, uint32_t ops);
+    const void *data;
+} bench_case_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static segs_t _segs_random[INPUTS], _segs_adverse[INPUTS];
+static inside_t _inside_small[INPUTS], _inside_large[INPUTS], _inside_comb[INPUTS], _inside_edges[INPUTS];
+static pair_t _pairs_random[INPUTS], _pairs_adverse[INPUTS];
+static xy_t _pair_verts[INPUTS * 8];
+static sector_t _pair_sectors[2];
+static mob_t _viewer;
+
+/** Results go here so the calls can't be optimized out */
+static volatile uint64_t _sink;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static float frand(float lo, float hi);
+static long write_level(const char *filename);
+static void gen_segments(void);
+static void gen_inside(void);
+static void gen_pairs(void);
+static void run_case(const bench_case_t *c);
+
+/* ***********************************
+ * Kernels
+ * ***********************************/
+
+static uint64_t k_lines_intersect(const void *data, uint32_t ops)
+{
+    const segs_t *s = data;
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const segs_t *c = &s[i & (INPUTS - 1)];
+        hits += lines_intersect_raw(c->x0, c->y0, c->x1, c->y1, c->u0, c->v0, c->u1, c->v1);
+    }
+
+    return hits;
+}
+
+static uint64_t k_point_on_line(const void *data, uint32_t ops)
+{
+    const segs_t *s = data;
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const segs_t *c = &s[i & (INPUTS - 1)];
+        hits += point_on_line_raw(c->u0, c->v0, c->x0, c->y0, c->x1, c->y1);
+    }
+
+    return hits;
+}
+
+static uint64_t k_project_vector(const void *data, uint32_t ops)
+{
+    const segs_t *s = data;
+    float sum = 0, x, y;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const segs_t *c = &s[i & (INPUTS - 1)];
+        project_vector(c->x1 - c->x0, c->y1 - c->y0, c->u1 - c->u0, c->v1 - c->v0, &x, &y);
+        sum += x + y;
+    }
+
+    return (uint64_t)(int64_t)sum;
+}
+
+static uint64_t k_inside_sector(const void *data, uint32_t ops)
+{
+    const inside_t *s = data;
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const inside_t *c = &s[i & (INPUTS - 1)];
+        hits += world_inside_sector((xy_t *)&c->p, c->sect);
+    }
+
+    return hits;
+}
+
+/**
+ * Batched kernels, against every edge of the 256-gon. Segments are
+ * moved over to it so they cross some of its edges.
+ */
+static uint64_t k_segment_hits(const void *data, uint32_t ops)
+{
+    const segs_t *s = data;
+    sector_t *sect = world_get_sector(1);
+    uint32_t first = sect->walls - world_get_world()->walls;
+    float ox = 2.5 * SECTOR_SIZE, oy = SECTOR_SIZE / 2;
+    uint32_t mask[EDGE_MASK_WORDS(NGON_LARGE)];
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const segs_t *c = &s[i & (INPUTS - 1)];
+        hits += edge_segment_hits(first, sect->num_walls, c->x0 + ox, c->y0 + oy,
+                                  c->x1 + ox, c->y1 + oy, mask);
+    }
+
+    return hits;
+}
+
+static uint64_t k_left_of(const void *data, uint32_t ops)
+{
+    const inside_t *s = data;
+    sector_t *sect = world_get_sector(1);
+    uint32_t first = sect->walls - world_get_world()->walls;
+    uint32_t mask[EDGE_MASK_WORDS(NGON_LARGE)];
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        const inside_t *c = &s[i & (INPUTS - 1)];
+        hits += edge_left_of(first, sect->num_walls, c->p.x, c->p.y, mask);
+    }
+
+    return hits;
+}
+
+static uint64_t k_wall_front(const void *data, uint32_t ops)
+{
+    const pair_t *s = data;
+    uint64_t hits = 0;
+
+    for(uint32_t i = 0; i < ops; ++i)
+    {
+        pair_t *c = (pair_t *)&s[i & (INPUTS - 1)];
+        hits += render_WallFront(&c->w1, &c->w2, &_viewer);
+    }
+
+    return hits;
+}
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+static float frand(float lo, float hi)
+{
+    return lo + ((hi - lo) * (float)rand() / (float)RAND_MAX);
+}
+
+/**
+ * Write a level of disconnected test sectors, side by side:
+ * 0: a regular NGON_SMALL-gon
+ * 1: a regular NGON_LARGE-gon
+ * 2: a comb, whose teeth make every wall span most y values
+ * @return Size of the file, or -1 on error
+ */
+static long write_level(const char *filename)
+{
+    FILE *fp = fopen(filename, "wt");
+    uint32_t v = 0, first;
+    uint32_t ngons[2] = {NGON_SMALL, NGON_LARGE};
+    double step = SECTOR_SIZE / (2 * COMB_TEETH);
+    long size;
+
+    if(fp == NULL) return -1;
+
+    for(uint32_t s = 0; s < 2; ++s)
+    {
+        double cx = (s * 2 * SECTOR_SIZE) + SECTOR_SIZE / 2, cy = SECTOR_SIZE / 2;
+        for(uint32_t i = 0; i < ngons[s]; ++i)
+        {
+            double a = (2 * PI * i) / ngons[s];
+            fprintf(fp, "v %u %f %f\n", v++, cx + (cos(a) * SECTOR_SIZE / 2), cy + (sin(a) * SECTOR_SIZE / 2));
+        }
+    }
+
+    // Comb along the top, counterclockwise from the bottom left
+    fprintf(fp, "v %u %f %f\n", v++, 4 * SECTOR_SIZE, 0.0);
+    fprintf(fp, "v %u %f %f\n", v++, 5 * SECTOR_SIZE, 0.0);
+    for(uint32_t k = 0; k < 2 * COMB_TEETH; ++k)
+    {
+        double h = (k & 1) ? 1.0 : SECTOR_SIZE;
+        fprintf(fp, "v %u %f %f\n", v++, (5 * SECTOR_SIZE) - (k * step), h);
+        fprintf(fp, "v %u %f %f\n", v++, (5 * SECTOR_SIZE) - ((k + 1) * step), h);
+    }
+
+    first = 0;
+    for(uint32_t s = 0; s < 3; ++s)
+    {
+        uint32_t n = (s < 2) ? ngons[s] : (v - first);
+        fprintf(fp, "s %u 0 20 0 0 255 %u", s, n);
+        for(uint32_t i = 0; i < n; ++i)
+        {
+            bench_write_wall(fp, first + i, first + ((i + 1) % n), -1);
+        }
+        fprintf(fp, "\n");
+        first += n;
+    }
+    fprintf(fp, "p %f %f 0\n", SECTOR_SIZE / 2, SECTOR_SIZE / 2);
+
+    size = ftell(fp);
+    fclose(fp);
+
+    return size;
+}
+
+/**
+ * Random segment pairs, and pairs that are parallel, collinear or
+ * only touch at their ends
+ */
+static void gen_segments(void)
+{
+    for(uint32_t i = 0; i < INPUTS; ++i)
+    {
+        segs_t *r = &_segs_random[i], *a = &_segs_adverse[i];
+        float x, y, dx, dy, t;
+
+        r->x0 = frand(-50, 50); r->y0 = frand(-50, 50);
+        r->x1 = frand(-50, 50); r->y1 = frand(-50, 50);
+        r->u0 = frand(-50, 50); r->v0 = frand(-50, 50);
+        r->u1 = frand(-50, 50); r->v1 = frand(-50, 50);
+
+        x = frand(-50, 50); y = frand(-50, 50);
+        dx = frand(-10, 10); dy = frand(-10, 10);
+        a->x0 = x;      a->y0 = y;
+        a->x1 = x + dx; a->y1 = y + dy;
+        switch(i % 4)
+        {
+            case 0:     // Parallel
+                a->u0 = x + 1;      a->v0 = y - 1;
+                a->u1 = x + 1 + dx; a->v1 = y - 1 + dy;
+                break;
+            case 1:     // Collinear and overlapping
+                t = frand(0, 1);
+                a->u0 = x + (t * dx); a->v0 = y + (t * dy);
+                a->u1 = x + 2 * dx;   a->v1 = y + 2 * dy;
+                break;
+            case 2:     // Touching at an end
+                a->u0 = a->x1;        a->v0 = a->y1;
+                a->u1 = a->x1 + dy;   a->v1 = a->y1 - dx;
+                break;
+            default:    // Axis aligned and zero length
+                a->x1 = x;    a->y1 = y + dy;
+                a->u0 = x;    a->v0 = y;
+                a->u1 = x;    a->v1 = y;
+                break;
+        }
+    }
+}
+
+/**
+ * Points in and around the test sectors, and points on their vertices
+ */
+static void gen_inside(void)
+{
+    for(uint32_t i = 0; i < INPUTS; ++i)
+    {
+        sector_t *sect;
+
+        _inside_small[i].sect = world_get_sector(0);
+        _inside_small[i].p.x = frand(0, SECTOR_SIZE);
+        _inside_small[i].p.y = frand(0, SECTOR_SIZE);
+
+        _inside_large[i].sect = world_get_sector(1);
+        _inside_large[i].p.x = frand(2 * SECTOR_SIZE, 3 * SECTOR_SIZE);
+        _inside_large[i].p.y = frand(0, SECTOR_SIZE);
+
+        _inside_comb[i].sect = world_get_sector(2);
+        _inside_comb[i].p.x = frand(4 * SECTOR_SIZE, 5 * SECTOR_SIZE);
+        _inside_comb[i].p.y = frand(1, SECTOR_SIZE);
+
+        sect = world_get_sector(i % 3);
+        _inside_edges[i].sect = sect;
+        _inside_edges[i].p = *world_get_vertex(sect->walls[rand() % sect->num_walls].v0);
+    }
+}
+
+/**
+ * Wall pairs in front of a viewer at the origin looking down +x.
+ * Random pairs are mostly separable by depth, the others overlap in
+ * depth, lie on one line, or share a vertex in the same sector.
+ */
+static void gen_pairs(void)
+{
+    memset(&_viewer, 0, sizeof(_viewer));
+
+    for(uint32_t i = 0; i < INPUTS; ++i)
+    {
+        xy_t *rv = &_pair_verts[i * 8], *v = &rv[4];
+        pair_t *r = &_pairs_random[i], *a = &_pairs_adverse[i];
+
+        for(int k = 0; k < 4; ++k)
+        {
+            rv[k].x = frand(1, 100);
+            rv[k].y = frand(-50, 50);
+            v[k] = rv[k];
+        }
+        memset(r, 0, sizeof(*r));
+        r->w1.sector = &_pair_sectors[0];  r->w2.sector = &_pair_sectors[1];
+        r->w1.v0 = &rv[0];  r->w1.v1 = &rv[1];
+        r->w2.v0 = &rv[2];  r->w2.v1 = &rv[3];
+
+        *a = *r;
+        a->w1.v0 = &v[0];  a->w1.v1 = &v[1];
+        a->w2.v0 = &v[2];  a->w2.v1 = &v[3];
+        switch(i % 3)
+        {
+            case 0:     // Overlapping depth, forces the cross products
+                v[2].x = v[0].x + 1;
+                v[3].x = v[1].x - 1;
+                break;
+            case 1:     // Collinear
+                v[2].x = v[1].x + (v[1].x - v[0].x);
+                v[2].y = v[1].y + (v[1].y - v[0].y);
+                v[3].x = v[1].x + 2 * (v[1].x - v[0].x);
+                v[3].y = v[1].y + 2 * (v[1].y - v[0].y);
+                break;
+            default:    // Joined in the same sector
+                a->w2.sector = a->w1.sector;
+                a->w2.v0 = a->w1.v1;
+                break;
+        }
+
+        // Transformed depth is distance along the view direction
+        r->w1.t0.z = r->w1.v0->x;  r->w1.t1.z = r->w1.v1->x;
+        r->w2.t0.z = r->w2.v0->x;  r->w2.t1.z = r->w2.v1->x;
+        a->w1.t0.z = a->w1.v0->x;  a->w1.t1.z = a->w1.v1->x;
+        a->w2.t0.z = a->w2.v0->x;  a->w2.t1.z = a->w2.v1->x;
+    }
+}
+
+/**
+ * Warm up and time a single case, and print its stats
+ */
+static void run_case(const bench_case_t *c)
+{
+    double samples[SAMPLES];
+    bench_stats_t stats;
+
+    for(int w = 0; w < WARMUP; ++w) _sink += c->fn(c->data, OPS);
+
+    for(int s = 0; s < SAMPLES; ++s)
+    {
+        uint64_t t0 = bench_now_ns();
+        _sink += c->fn(c->data, OPS);
+        samples[s] = (double)(bench_now_ns() - t0) / OPS;
+    }
+
+    bench_stats(samples, SAMPLES, &stats);
+    printf("%-22s %-10s %10.2f %10.2f %10.4f %10.2f %8.1f\n", c->kernel, c->input,
+           stats.mean, stats.min, stats.stddev * stats.stddev, stats.max,
+           (stats.mean > 0) ? (100 * stats.stddev / stats.mean) : 0);
+}
+
+/* ***********************************
+ * Main function
+ * ***********************************/
+int main(int argc, char *argv[])
+{
+    const bench_case_t cases[] =
+    {
+        {"lines_intersect_raw", "random",  k_lines_intersect, _segs_random},
+        {"lines_intersect_raw", "adverse", k_lines_intersect, _segs_adverse},
+        {"point_on_line_raw",   "random",  k_point_on_line,   _segs_random},
+        {"point_on_line_raw",   "adverse", k_point_on_line,   _segs_adverse},
+        {"project_vector",      "random",  k_project_vector,  _segs_random},
+        {"project_vector",      "adverse", k_project_vector,  _segs_adverse},
+        {"world_inside_sector", "8-gon",   k_inside_sector,   _inside_small},
+        {"world_inside_sector", "256-gon", k_inside_sector,   _inside_large},
+        {"world_inside_sector", "comb",    k_inside_sector,   _inside_comb},
+        {"world_inside_sector", "vertices",k_inside_sector,   _inside_edges},
+        {"edge_segment_hits",   "256-gon", k_segment_hits,    _segs_random},
+        {"edge_left_of",        "256-gon", k_left_of,         _inside_large},
+        {"render_WallFront",    "random",  k_wall_front,      _pairs_random},
+        {"render_WallFront",    "adverse", k_wall_front,      _pairs_adverse},
+    };
+    uint32_t numCases = sizeof(cases) / sizeof(cases[0]);
+
+    if(write_level(LEVEL_NAME) < 0 || world_load(LEVEL_NAME) != 0)
+    {
+        printf("Can't set up %s\n", LEVEL_NAME);
+        remove(LEVEL_NAME);
+        return -1;
+    }
+    remove(LEVEL_NAME);
+
+    srand(1);
+    gen_segments();
+    gen_inside();
+    gen_pairs();
+
+    printf("%u samples of %u calls after %u warmup runs\n", SAMPLES, OPS, WARMUP);
+    printf("%-22s %-10s %10s %10s %10s %10s %8s\n", "kernel", "input", "ns/op", "min", "variance", "max", "cv %");
+    for(uint32_t c = 0; c < numCases; ++c)
+    {
+        // Filter by kernel name
+        if(argc > 1 && strstr(cases[c].kernel, argv[1]) == NULL) continue;
+        run_case(&cases[c]);
+    }
+
+    world_close();
+
+    return 0;
+}
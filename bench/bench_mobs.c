@@ -0,0 +1,156 @@
+/**
+ * Mob tick benchmark.
+ *
+ * Spawns increasing numbers of wandering mobs into a synthetic level
+ * and times mobs_tick() over a fixed number of ticks, on increasing
+ * numbers of threads. The final state of every run is hashed, and
+ * must match the single threaded run.
+ */
+
+// Global headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+// Project headers
+#include "bench.h"
+#include "world.h"
+#include "mobs.h"
+#include "job.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define LEVEL_NAME "bench_mobs.pel"
+#define LEVEL_VERTICES (100000)
+#define TICKS (100)
+#define REPS  (3)
+#define SPEED (0.2)
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int8_t spawn_mobs(uint32_t count);
+static uint64_t hash_mobs(void);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Scatter mobs over random sectors, heading in random directions
+ * @return 0 on success
+ */
+static int8_t spawn_mobs(uint32_t count)
+{
+    world_t *world = world_get_world();
+    mobs_t *mobs = mobs_get();
+
+    srand(1);
+    for(uint32_t n = 0; n < count; ++n)
+    {
+        uint32_t s = rand() % world->numSectors;
+        box_t *b = &world->bounds[s];
+        double x = b->x0 + 1 + ((b->x1 - b->x0 - 2) * rand() / RAND_MAX);
+        double y = b->y0 + 1 + ((b->y1 - b->y0 - 2) * rand() / RAND_MAX);
+        double a = (2 * PI * rand()) / RAND_MAX;
+        int32_t i = mobs_index(mobs_spawn(MOB_TYPE_ENEMY1, x, y, s));
+
+        if(i < 0) return -1;
+        mobs->vx[i] = cos(a) * SPEED;
+        mobs->vy[i] = sin(a) * SPEED;
+    }
+
+    return 0;
+}
+
+/**
+ * Hash the state of every mob, to check runs agree bit for bit
+ */
+static uint64_t hash_mobs(void)
+{
+    mobs_t *mobs = mobs_get();
+    uint64_t h = 14695981039346656037ull;
+
+    for(uint32_t i = 0; i < mobs->count; ++i)
+    {
+        double v[3] = {mobs->x[i], mobs->y[i], mobs->z[i]};
+        const uint8_t *bytes = (const uint8_t *)v;
+        for(size_t b = 0; b < sizeof(v); ++b) h = (h ^ bytes[b]) * 1099511628211ull;
+        h = (h ^ mobs->sector[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+
+/* ***********************************
+ * Main function
+ * ***********************************/
+int main(void)
+{
+    uint32_t counts[] = {1000, 10000, 50000};
+    uint32_t numCounts = sizeof(counts) / sizeof(counts[0]);
+    uint32_t threads[] = {1, 2, 4, 8, 16};
+    uint32_t numThreads = sizeof(threads) / sizeof(threads[0]);
+    uint32_t cores;
+
+    if(bench_write_level(LEVEL_NAME, LEVEL_VERTICES) < 0 || world_load(LEVEL_NAME) != 0)
+    {
+        printf("Can't set up %s\n", LEVEL_NAME);
+        remove(LEVEL_NAME);
+        return -1;
+    }
+    remove(LEVEL_NAME);
+
+    job_init(0);
+    cores = job_threads();
+
+    printf("%10s %8s %10s %10s %12s %18s\n", "mobs", "threads", "best ms", "mean ms", "ns/mob-tick", "state hash");
+
+    for(uint32_t c = 0; c < numCounts; ++c)
+    {
+        uint64_t first = 0;
+
+        for(uint32_t n = 0; n < numThreads && (n == 0 || threads[n] <= cores); ++n)
+        {
+            uint64_t best = UINT64_MAX, total = 0, hash = 0;
+
+            job_init(threads[n]);
+
+            for(int r = 0; r < REPS; ++r)
+            {
+                uint64_t t0, dt;
+
+                mobs_clear();
+                if(spawn_mobs(counts[c]) != 0)
+                {
+                    printf("Can't spawn %u mobs\n", counts[c]);
+                    job_close();
+                    world_close();
+                    return -1;
+                }
+
+                t0 = bench_now_ns();
+                for(int t = 0; t < TICKS; ++t) mobs_tick();
+                dt = bench_now_ns() - t0;
+
+                total += dt;
+                best = (dt < best) ? dt : best;
+                hash = hash_mobs();
+            }
+
+            if(n == 0) first = hash;
+            printf("%10u %8u %10.2f %10.2f %12.1f %18llx%s\n", counts[c], job_threads(), best / 1e6,
+                   (total / REPS) / 1e6, (double)best / ((double)counts[c] * TICKS),
+                   (unsigned long long)hash, (hash == first) ? "" : " MISMATCH");
+        }
+    }
+
+    job_close();
+    world_close();
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * Offline rendering of many camera poses to image files, split
+ * across worker processes.
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "common.h"
+#include "campath.h"
+#include "render.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Max number of worker processes */
+#define BATCH_MAX_WORKERS (64)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * How each worker draws its poses
+ */
+typedef struct batch_settings_struct
+{
+    // Far clip and LOD distances, 0 to turn either off
+    double far, lod;
+    render_backend_t backend;
+    // Nonzero to draw from palettized textures
+    int palette;
+} batch_settings_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Render every keyframe of /poses to a BMP in /outdir, on /workers
+// processes (0 for one per core), each drawing with /settings
+int8_t batch_render(const campath_t *poses, const char *outdir, uint32_t workers, const batch_settings_t *settings);
+
+#endif /*__BATCH_H__*/
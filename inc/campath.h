@@ -0,0 +1,56 @@
+/**
+ * Scripted camera paths, used to fly the player's view through a
+ * level without any input.
+ */
+
+#ifndef __CAMPATH_H__
+#define __CAMPATH_H__
+
+#include "common.h"
+#include "mob.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Max number of keyframes in a path */
+#define CAMPATH_MAX_KEYS (1 << 20)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+typedef struct campath_key_struct
+{
+    double x, y;
+    double direction;
+    double yaw;
+    // Sector the camera is in, or -1 to find it from x and y
+    int32_t sector;
+} campath_key_t;
+
+/**
+ * Keyframes are spread evenly over the length of the path
+ */
+typedef struct campath_struct
+{
+    campath_key_t *keys;
+    uint32_t count;
+} campath_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+int8_t campath_load(const char *filename, campath_t *path);
+void campath_free(campath_t *path);
+
+// Get the camera at t (0 to 1) along the path
+void campath_sample(const campath_t *path, double t, campath_key_t *cam);
+
+// Move a mob to the camera at t along the path
+int8_t campath_apply(const campath_t *path, double t, mob_t *mob);
+// Move a mob to a single keyframe, taken as a pose on its own
+int8_t campath_pose(const campath_t *path, uint32_t i, mob_t *mob);
+
+#endif /*__CAMPATH_H__*/
@@ -0,0 +1,53 @@
+/**
+ * Swept circle collision against sector walls
+ */
+
+#ifndef __COLLIDE_H__
+#define __COLLIDE_H__
+
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Max walls considered for a single move. Moves that reach
+ * more, or more sectors, aren't made. */
+#define COLLIDE_MAX_WALLS (256)
+
+/** Max sectors a single move may touch */
+#define COLLIDE_MAX_SECTORS (16)
+
+/** Max number of slides along walls in a single move */
+#define COLLIDE_MAX_SLIDES (3)
+
+/** Distance kept between a body and any wall it hits */
+#define COLLIDE_SKIN (1e-3)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * A moving body. Position and sector are updated by collide_move().
+ */
+typedef struct collide_body_struct
+{
+    xyz_t pos;
+    uint32_t sector;
+    double height, kneemargin, eyemargin, radius;
+} collide_body_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Precompute wall bounds for the loaded world
+int8_t collide_build(world_t *world);
+void collide_close(void);
+
+// Move a body, sliding along anything it hits
+int collide_move(collide_body_t *body, double dx, double dy);
+
+#endif /*__COLLIDE_H__*/
@@ -57,6 +57,12 @@
 
 #define _xy(pt) pt.x, pt.y
 
+// Check if a point is inside a box_t
+#define BoxContains(b, px, py) ((px) >= (b)->x0 && (px) <= (b)->x1 && (py) >= (b)->y0 && (py) <= (b)->y1)
+
+// Check if two box_t's overlap
+#define BoxOverlap(a, b) ((a)->x0 <= (b)->x1 && (b)->x0 <= (a)->x1 && (a)->y0 <= (b)->y1 && (b)->y0 <= (a)->y1)
+
 #define PI (acos(-1))
 
 /* ***********************************
@@ -76,4 +82,11 @@ typedef struct xyz_struct
     double z;
 } xyz_t;
 
+/** Axis aligned bounding box */
+typedef struct box_struct
+{
+    float x0, y0;
+    float x1, y1;
+} box_t;
+
 #endif /*__COMMON_H__*/
\ No newline at end of file
@@ -0,0 +1,57 @@
+/**
+ * Batched tests of a point or segment against every edge of a sector
+ * at once, over a float structure of arrays copy of the wall endpoints.
+ */
+
+#ifndef __EDGE_H__
+#define __EDGE_H__
+
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Edges tested per step. The tables are padded to a multiple of this. */
+#define EDGE_LANES (8)
+
+/** Words needed for a mask covering n edges */
+#define EDGE_MASK_WORDS(n) (((n) + 31) / 32)
+
+/** Check bit i of an edge mask */
+#define EDGE_MASK_TEST(m, i) (((m)[(i) >> 5] >> ((i) & 31)) & 1)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Edge i is world->walls[i], from vertex v0 to v1
+ */
+typedef struct edge_soa_struct
+{
+    float *x0, *y0, *x1, *y1;
+    // dx / dy of each edge, 0 for horizontal ones
+    float *dxdy;
+    uint32_t count;
+} edge_soa_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Copy out the edges of the loaded world
+int8_t edge_build(world_t *world);
+void edge_close(void);
+int edge_ready(void);
+const edge_soa_t *edge_get(void);
+
+// Kernels over edges first to first + count - 1. Masks have a bit per
+// edge, starting from first, and must hold EDGE_MASK_WORDS(count) words.
+uint32_t edge_crossings(uint32_t first, uint32_t count, float px, float py);
+uint32_t edge_left_of(uint32_t first, uint32_t count, float px, float py, uint32_t *mask);
+uint32_t edge_segment_hits(uint32_t first, uint32_t count,
+                           float p0x, float p0y, float p1x, float p1y, uint32_t *mask);
+
+#endif /*__EDGE_H__*/
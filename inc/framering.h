@@ -0,0 +1,115 @@
+/**
+ * Shared memory ring of finished frames, for recorders and streamers
+ * running alongside the game. Readers map the ring and read frames
+ * in place, and need nothing but this header.
+ *
+ * LAYOUT OF THE RING
+ *
+ * [framering_header_t] [framering_slot_t * slots] {pixels of each slot}
+ *
+ * Each part starts on a FRAMERING_ALIGN boundary. Frames are numbered
+ * from 1, and frame n is drawn into slot n % slots. A slot's sequence
+ * number is 2n while it holds frame n, and odd while the next frame is
+ * being drawn into it, so a reader that sees the same even number
+ * before and after reading a slot has read a whole frame. Readers too
+ * slow to keep up lose frames rather than holding the game up.
+ */
+
+#ifndef __FRAMERING_H__
+#define __FRAMERING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+#define FRAMERING_MAGIC "PEFR"
+#define FRAMERING_VERSION (1)
+
+/** Frames kept when no count is given */
+#define FRAMERING_SLOTS (8)
+/** Most frames kept */
+#define FRAMERING_MAX_SLOTS (256)
+
+/** Boundary the parts of the ring start on */
+#define FRAMERING_ALIGN(x) (((x) + 63) & ~(size_t)63)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Shape of the frames. Pixels are 32 bits, with 8 bits per channel.
+ */
+typedef struct framering_format_struct
+{
+    uint32_t width, height;
+    // Bit each channel starts at
+    uint8_t rshift, gshift, bshift;
+} framering_format_t;
+
+typedef struct framering_header_struct
+{
+    char magic[4];
+    uint32_t version;
+    framering_format_t format;
+    // Bytes from one row of a frame to the next
+    uint32_t pitch;
+    uint32_t slots;
+    // Last frame published, or 0 before the first
+    _Atomic uint64_t head;
+    // Nonzero once the game has stopped publishing
+    _Atomic uint32_t closed;
+} framering_header_t;
+
+typedef struct framering_slot_struct
+{
+    _Atomic uint64_t seq;
+} framering_slot_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+/**
+ * Bytes taken by a ring
+ */
+static inline size_t framering_size(uint32_t slots, uint32_t pitch, uint32_t height)
+{
+    return FRAMERING_ALIGN(sizeof(framering_header_t))
+         + FRAMERING_ALIGN(slots * sizeof(framering_slot_t))
+         + (slots * FRAMERING_ALIGN((size_t)pitch * height));
+}
+
+/**
+ * Sequence number of slot /i
+ */
+static inline framering_slot_t *framering_slot(framering_header_t *ring, uint32_t i)
+{
+    return (framering_slot_t *)((uint8_t *)ring + FRAMERING_ALIGN(sizeof(framering_header_t))) + i;
+}
+
+/**
+ * Pixels of slot /i
+ */
+static inline uint32_t *framering_pixels(framering_header_t *ring, uint32_t i)
+{
+    return (uint32_t *)((uint8_t *)ring + FRAMERING_ALIGN(sizeof(framering_header_t))
+                        + FRAMERING_ALIGN(ring->slots * sizeof(framering_slot_t))
+                        + (i * FRAMERING_ALIGN((size_t)ring->pitch * ring->format.height)));
+}
+
+// Start publishing frames to the shared memory object /name,
+// keeping the last /slots (0 for FRAMERING_SLOTS)
+int8_t framering_open(const char *name, uint32_t slots, const framering_format_t *format);
+void framering_close(void);
+int framering_active(void);
+
+// Get the pixels to draw the next frame into, then publish it
+uint32_t *framering_begin(int *pitch);
+void framering_publish(void);
+
+#endif /*__FRAMERING_H__*/
@@ -33,6 +33,18 @@ typedef struct keys_struct
     uint8_t shift;
 } keys_t;
 
+/**
+ * Everything the game reads from the player in a single tick
+ */
+typedef struct input_frame_struct
+{
+    keys_t keys;
+    // Relative mouse motion since the last sample
+    int32_t mouse_x, mouse_y;
+    // Left and right stick, -1 to 1
+    float lx, ly, rx, ry;
+} input_frame_t;
+
 /* ***********************************
  * Public Functions
  * ***********************************/
@@ -45,5 +57,6 @@ void input_toggle_mouselook(void);
 keys_t *input_get(void);
 void mouse_get_input(int *x, int *y);
 void input_get_joystick(float *lx, float *ly, float *rx, float *ry);
+void input_sample(input_frame_t *frame);
 
 #endif /*__INPUT_H__*/
\ No newline at end of file
@@ -0,0 +1,42 @@
+/**
+ * Job system. A fixed pool of worker threads, each with its own
+ * work-stealing deque, for splitting loops across cores.
+ */
+
+#ifndef __JOB_H__
+#define __JOB_H__
+
+#include "common.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Max number of threads, including the calling thread */
+#define JOB_MAX_THREADS (64)
+
+/** Max jobs queued per thread in a single batch, a power of 2 */
+#define JOB_DEQUE_SIZE (1024)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Work function, run for items [begin, end) of a loop
+ */
+typedef void (*job_fn_t)(void *arg, uint32_t begin, uint32_t end);
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Start and stop the worker threads. 0 threads means one per core.
+int8_t job_init(uint32_t threads);
+void job_close(void);
+uint32_t job_threads(void);
+
+// Run fn over [0, count) in chunks of about /grain items, and wait
+void job_parallel_for(uint32_t count, uint32_t grain, job_fn_t fn, void *arg);
+
+#endif /*__JOB_H__*/
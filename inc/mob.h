@@ -31,6 +31,8 @@ typedef struct mob_config_struct
 {
     // Height, knee, eyes
     double height, kneemargin, eyemargin;
+    // Collision radius
+    double radius;
     uint32_t max_health;
     // TODO animation information (textures etc)
 } mob_conf_t;
@@ -52,19 +54,27 @@ typedef struct mob_struct
     // Health
     uint32_t health;
     // Config info
-    double height, kneemargin, eyemargin;
+    double height, kneemargin, eyemargin, radius;
     // Optional additional data for a player
     player_t *player;
 } mob_t;
 
+// Defined in collide.h
+struct collide_body_struct;
+
 /* ***********************************
  * Public Functions
  * ***********************************/
 
 // Structure init
 void mob_init(mob_t *mob, mob_type_t type);
+void mob_close(mob_t *mob);
+
+// Per-type config
+const mob_conf_t *mob_get_conf(mob_type_t type);
 
 // Update position based on computed velocity
 void mob_pos_update(mob_t *mob);
+void mob_body_step(struct collide_body_struct *body, xyz_t *velocity);
 
 #endif /* __MOB_H__ */
\ No newline at end of file
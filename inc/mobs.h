@@ -0,0 +1,75 @@
+/**
+ * Mob registry. Every mob in the world other than the player lives
+ * here, stored as a structure of arrays so the whole population can
+ * be ticked by streaming through memory.
+ *
+ * Mobs are referred to by handles, which stay valid until the mob is
+ * despawned. Packed array indices are not stable and move whenever a
+ * mob is despawned.
+ */
+
+#ifndef __MOBS_H__
+#define __MOBS_H__
+
+#include "common.h"
+#include "mob.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Bits of a handle used for the slot, the rest count reuses */
+#define MOBS_SLOT_BITS (20)
+
+/** Max number of mobs */
+#define MOBS_MAX ((1u << MOBS_SLOT_BITS) - 1)
+
+/** Never a valid handle */
+#define MOBS_HANDLE_NONE (0)
+
+/** Sector of a mob that hasn't been placed yet */
+#define MOBS_NO_SECTOR (UINT32_MAX)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+typedef uint32_t mob_handle_t;
+
+/**
+ * Packed mob data. Entry i of every array belongs to the same mob,
+ * entries 0 to count - 1 are live. Some arrays are double buffered,
+ * so don't hold on to the pointers across a tick.
+ */
+typedef struct mobs_struct
+{
+    // Hot: read and written every tick
+    double *x, *y, *z;
+    double *vx, *vy, *vz;
+    uint32_t *sector;
+    uint8_t *type;
+    // Cold
+    double *direction;
+    uint32_t *health;
+    mob_handle_t *handle;
+
+    uint32_t count, capacity;
+} mobs_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Add and remove mobs
+mob_handle_t mobs_spawn(mob_type_t type, double x, double y, uint32_t sector);
+int8_t mobs_despawn(mob_handle_t handle);
+void mobs_clear(void);
+
+// Move every mob by its velocity
+void mobs_tick(void);
+
+// Access
+mobs_t *mobs_get(void);
+int32_t mobs_index(mob_handle_t handle);
+
+#endif /*__MOBS_H__*/
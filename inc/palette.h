@@ -0,0 +1,58 @@
+/**
+ * Color quantization for palettized textures. Colors are binned into
+ * a histogram at 5 bits a channel, cut down to a palette of up to 256
+ * colors by median cut, then mapped to the palette through a table
+ * holding the nearest palette color of every bin.
+ */
+
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#include <stdint.h>
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Most colors in a palette */
+#define PALETTE_SIZE (256)
+
+/** Bits kept of each channel when binning colors */
+#define PALETTE_BITS (5)
+#define PALETTE_BINS (1 << (PALETTE_BITS * 3))
+
+/** Histogram bin of an 8 bit a channel color */
+#define PALETTE_BIN(r, g, b) ((((uint32_t)(r) >> (8 - PALETTE_BITS)) << (PALETTE_BITS * 2)) | \
+                              (((uint32_t)(g) >> (8 - PALETTE_BITS)) << PALETTE_BITS) | \
+                              ((uint32_t)(b) >> (8 - PALETTE_BITS)))
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+typedef struct palette_struct
+{
+    uint8_t r[PALETTE_SIZE], g[PALETTE_SIZE], b[PALETTE_SIZE];
+    // Colors used, the rest are black
+    uint32_t count;
+    // Nearest palette color to the middle of every bin
+    uint8_t lookup[PALETTE_BINS];
+} palette_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Make a palette for the colors counted in /hist, PALETTE_BINS
+// counts filled in with PALETTE_BIN()
+int8_t palette_build(palette_t *palette, const uint32_t *hist);
+
+/**
+ * Palette index of a color
+ */
+static inline uint8_t palette_index(const palette_t *palette, uint8_t r, uint8_t g, uint8_t b)
+{
+    return palette->lookup[PALETTE_BIN(r, g, b)];
+}
+
+#endif /*__PALETTE_H__*/
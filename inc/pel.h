@@ -0,0 +1,75 @@
+/**
+ * Streaming tokenizer for .pel world definition files
+ */
+
+#ifndef __PEL_H__
+#define __PEL_H__
+
+#include "common.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Size of the refill buffer used when reading from a file */
+#define PEL_BUF_LEN (64 * 1024)
+
+/** Longest single token (number or word) kept by the reader */
+#define PEL_TOKEN_LEN (64)
+
+/** Returned by pel_next_record() once the input is exhausted */
+#define PEL_EOF (-1)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Reader state. Works over either a FILE (refilled in PEL_BUF_LEN
+ * blocks) or a fixed memory range. Lines may be of any length; only
+ * individual tokens are bounded by PEL_TOKEN_LEN.
+ */
+typedef struct pel_reader_struct
+{
+    // Source file, or NULL when reading from memory
+    FILE *fp;
+    // Current block and read position within it
+    const char *buf;
+    size_t len, pos;
+    // Offset of the current block within the file
+    long base;
+    // Refill buffer owned by the reader (file mode only)
+    char *block;
+    // Current line number, for error reporting
+    uint32_t line;
+} pel_reader_t;
+
+// Defined in world.h
+struct sector_struct;
+struct wall_struct;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Reader setup
+int8_t pel_open_file(pel_reader_t *r, FILE *fp);
+void pel_open_mem(pel_reader_t *r, const char *buf, size_t len);
+void pel_close(pel_reader_t *r);
+long pel_tell(pel_reader_t *r);
+int8_t pel_seek(pel_reader_t *r, long offset);
+
+// Record level access
+int pel_next_record(pel_reader_t *r);
+void pel_skip_line(pel_reader_t *r);
+
+// Field level access. All return 1 on success, 0 at end of line
+int pel_read_word(pel_reader_t *r, char *word, size_t len);
+int pel_read_int(pel_reader_t *r, int32_t *val);
+int pel_read_double(pel_reader_t *r, double *val);
+
+// Composite fields of a sector record
+int pel_read_sector(pel_reader_t *r, struct sector_struct *sect);
+int pel_read_wall(pel_reader_t *r, struct wall_struct *wall);
+
+#endif /*__PEL_H__*/
@@ -21,6 +21,6 @@
  * ***********************************/
 
 // Handle input
-void player_handle_input(mob_t *player, keys_t *keys);
+void player_handle_input(mob_t *player, input_frame_t *input);
 
 #endif /*__PLAYER_H__*/
\ No newline at end of file
@@ -18,6 +18,12 @@
 #define SCR_H (480 * 1)
 #define SCR_W (640 * 1)
 
+/** render_init_ex() flag: draw to an offscreen surface, with no window or vsync */
+#define RENDER_INIT_OFFSCREEN (1 << 0)
+
+/** Most views render_draw_views() draws in a frame */
+#define RENDER_MAX_VIEWS (4)
+
 // Check for valid texture
 #define IS_TEXTURE(a) ((a > -1) && (a < NUM_TEXTURES))
 
@@ -39,6 +45,47 @@ typedef enum texture_name_enum
     NUM_TEXTURES   = 9
 } texture_name_t;
 
+/**
+ * How walls are filled in
+ */
+typedef enum render_backend_enum
+{
+    // Texel by texel into the screen buffer
+    RENDER_BACKEND_PIXELS   = 0,
+    // As textured quads, a batch of SDL_RenderGeometry() calls
+    // per frame, leaving the sampling and shading to SDL
+    RENDER_BACKEND_GEOMETRY = 1
+} render_backend_t;
+
+/**
+ * What a pixel of the last frame shows
+ */
+typedef enum render_surface_enum
+{
+    SURFACE_NONE    = 0,
+    SURFACE_FLOOR   = 1,
+    SURFACE_CEILING = 2,
+    // Solid wall, or the wall above or below a portal
+    SURFACE_WALL    = 3,
+    SURFACE_UPPER   = 4,
+    SURFACE_LOWER   = 5
+} render_surface_t;
+
+/**
+ * Answer to render_pick()
+ */
+typedef struct render_pick_struct
+{
+    // Sector drawn at the pixel, or -1 where only the sky is
+    int32_t sector;
+    // Index of the wall within the sector, or -1 for floors and ceilings
+    int32_t wall;
+    render_surface_t surface;
+    // Distance from the eye along the view direction,
+    // INFINITY where only the sky is
+    float depth;
+} render_pick_t;
+
 // Public structure to hold sprite info
 typedef struct image_struct
 {
@@ -50,14 +97,51 @@ typedef struct image_struct
     uint32_t h;
     // How many map units long is this texture (horiz/vert)
     double xscale, yscale;
+    // Average color, drawn in place of the texture far away
+    uint32_t avg;
+    // Palette index of each texel, w to a row, while
+    // textures are palettized
+    uint8_t *pix8;
 } image_t;
 
+/**
+ * A camera, and the rectangle of the screen it is drawn into
+ */
+typedef struct render_view_struct
+{
+    struct mob_struct *camera;
+    int x, y, w, h;
+} render_view_t;
+
+/**
+ * Counters for a single frame
+ */
+typedef struct render_stats_struct
+{
+    // Sectors flooded into through portals
+    uint32_t sectors;
+    // Walls looked at, walls that survived culling, and walls
+    // that had at least one unoccluded column
+    uint32_t walls_considered;
+    uint32_t walls_queued;
+    uint32_t walls_drawn;
+    // Walls skipped as every column they cover was closed
+    uint32_t walls_occluded;
+    // Front to back tests made putting the walls in order
+    uint32_t wall_tests;
+    // Columns of floor, ceiling and wall handed to the raster pass
+    uint32_t spans;
+    // SDL_RenderGeometry() calls made filling in walls
+    uint32_t draw_calls;
+} render_stats_t;
+
 /* ***********************************
  * Public Functions
  * ***********************************/
 
 // SDL High Level Control
 int8_t render_init(int fullscreen);
+int8_t render_init_ex(int fullscreen, uint32_t flags);
 int8_t render_close(void);
 
 // Load Image
@@ -67,6 +151,7 @@ void render_free_image(image_t *image);
 // High level screen controls
 int8_t render_reset_screen(void);
 int8_t render_draw_screen(void);
+int8_t render_save_frame(const char *filename);
 void render_delay(uint32_t ticks);
 
 
@@ -88,6 +173,10 @@ int8_t render_vline_textured_bitwise(
 int8_t render_point_textured(uint32_t x, uint32_t y, uint32_t z,
                              image_t *texture, 
                              uint32_t tx, uint32_t ty, uint8_t brightness);
+int8_t render_vline_solid(uint32_t x, uint32_t y0, uint32_t y1,
+                          image_t *texture, uint16_t z, uint8_t brightness);
+int8_t render_point_solid(uint32_t x, uint32_t y, uint32_t z,
+                          image_t *texture, uint8_t brightness);
 // Draw a point on the screen
 int8_t render_draw_point(uint32_t x, uint32_t y, uint32_t color);
 
@@ -96,5 +185,26 @@ void render_set_fullscreen(int fs);
 
 // Draw the game world
 int8_t render_draw_world(void);
+// Draw the game world from several cameras into one frame
+int8_t render_draw_views(const render_view_t *views, uint32_t count);
+void render_get_stats(render_stats_t *stats);
+// Far clip and LOD distances, 0 to turn either off
+void render_set_distances(double far, double lod);
+// Work out the next frame of every view from scratch
+void render_reset_views(void);
+
+// Keep depth and id buffers for the frames drawn from now on
+int8_t render_set_pick(int enable);
+// What the last frame showed at a pixel
+int8_t render_pick(uint32_t x, uint32_t y, render_pick_t *pick);
+// Depth buffer of the last frame, SCR_W floats a row, or NULL if not kept
+const float *render_get_depth(void);
+
+// Publish each frame to a shared memory ring, see framering.h
+int8_t render_set_ring(const char *name, uint32_t slots);
+// Choose how walls are filled in
+int8_t render_set_backend(render_backend_t backend);
+// Read textures a byte a texel through a shared palette
+int8_t render_set_palette(int enable);
 
 #endif /*__RENDER_H__*/
\ No newline at end of file
@@ -0,0 +1,58 @@
+/**
+ * Render queue wall entries. Private to the renderer, exposed so the
+ * benchmarks can drive the wall ordering code directly.
+ */
+
+#ifndef __RENDER_WALL_H__
+#define __RENDER_WALL_H__
+
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+/**
+ * Structure to hold info about a wall as it gets
+ * added to the render list.
+ * These structs create a linked list in order
+ * to enable fast removal of walls after they 
+ * get constructed.
+ */
+typedef struct r_wall_struct r_wall_t;
+
+struct r_wall_struct
+{
+    sector_t *sector;
+    xy_t *v0, *v1;
+
+    // Transformed coordinates (relative to player)
+    xyz_t t0, t1;
+    // Screen X positions (x0 is start, x1 is end)
+    int x0, x1;
+    // Texture start & end
+    int32_t texture, lo_texture, hi_texture;
+    int u0, u1;
+
+    int32_t neighbor;
+    // Index of the wall within its sector
+    int32_t index;
+    // Wholly past the far clip, so drawn as fog
+    uint8_t fogged;
+    // Pointers to other objects in the queue for
+    // fast removal
+    r_wall_t *prev, *next;
+};
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Check if wall is in front of another wall
+int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player);
+
+// Get the the next wall
+r_wall_t *render_GetNextWall(r_wall_t **first, mob_t *player);
+
+#endif /*__RENDER_WALL_H__*/
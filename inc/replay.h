@@ -0,0 +1,45 @@
+/**
+ * Input recording and replay. A recording is the input_frame_t of
+ * every tick of a session, so playing it back into world_tick()
+ * repeats the session exactly.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "common.h"
+#include "input.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Recording file format version */
+#define REPLAY_VERSION (1)
+
+/* ***********************************
+ * Public Typedefs
+ * ***********************************/
+
+typedef enum replay_mode_enum
+{
+    REPLAY_OFF,
+    REPLAY_RECORD,
+    REPLAY_PLAY
+} replay_mode_t;
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Start recording to or playing from a file
+int8_t replay_record(const char *filename, const char *level, uint32_t tick_ms);
+int8_t replay_play(const char *filename, const char *level, uint32_t tick_ms);
+void replay_close(void);
+replay_mode_t replay_mode(void);
+
+// Per tick input
+int8_t replay_write(input_frame_t *frame);
+int replay_read(input_frame_t *frame);
+
+#endif /*__REPLAY_H__*/
@@ -0,0 +1,28 @@
+/**
+ * Uniform grid over sector bounding boxes, for finding
+ * which sector contains an arbitrary point.
+ */
+
+#ifndef __SPATIAL_H__
+#define __SPATIAL_H__
+
+#include "common.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Upper bound on grid cells along either axis */
+#define SPATIAL_MAX_DIM (1024)
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+int8_t spatial_build(const box_t *bounds, uint32_t count);
+void spatial_close(void);
+
+// Get the sectors whose bounding boxes may contain a point
+uint32_t spatial_candidates(double x, double y, const uint32_t **ids);
+
+#endif /*__SPATIAL_H__*/
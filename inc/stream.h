@@ -0,0 +1,45 @@
+/**
+ * Region based level streaming.
+ *
+ * In streaming mode only sector headers (heights, textures, wall counts)
+ * stay resident. Sectors are grouped into regions along the portal
+ * graph, and the wall lists of regions near the player are read from
+ * the level file on a background thread. A sector whose walls are not
+ * resident has a NULL walls pointer.
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Max number of sectors grouped into one region */
+#define STREAM_REGION_SECTORS (64)
+
+/** Regions within this many portal steps of the player are loaded */
+#define STREAM_LOAD_RADIUS (2)
+
+/** Regions further than this many portal steps away are evicted */
+#define STREAM_EVICT_RADIUS (3)
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Indexing, called by world_load()
+int8_t stream_begin(void);
+int8_t stream_index_sector(uint32_t id, long offset, const wall_t *walls, uint16_t num_walls);
+int8_t stream_start(const char *filename);
+void stream_close(void);
+
+// Residency management
+int8_t stream_update(uint32_t sector, int wait);
+int stream_active(void);
+uint32_t stream_resident_walls(void);
+
+#endif /*__STREAM_H__*/
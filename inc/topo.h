@@ -0,0 +1,35 @@
+/**
+ * Load time preprocessing of the level geometry into world->topo
+ */
+
+#ifndef __TOPO_H__
+#define __TOPO_H__
+
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Public Definitions
+ * ***********************************/
+
+/** Appended to the level file name to get its cache file */
+#define TOPO_CACHE_EXT ".topo"
+
+/** Most repeated edges, and most disagreements with the level
+ * file, topo_autolink() prints */
+#define TOPO_MAX_REPORTS (10)
+
+/* ***********************************
+ * Public Functions
+ * ***********************************/
+
+// Derive the topology of the loaded world, through the cache
+// of /level if it isn't NULL
+int8_t topo_build(world_t *world, const char *level);
+void topo_free(world_topo_t *topo);
+
+// Link walls sharing an edge as portals, replacing the neighbors
+// given in the level file
+int8_t topo_autolink(world_t *world);
+
+#endif /*__TOPO_H__*/
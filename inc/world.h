@@ -14,11 +14,34 @@
  * Public Definitions
  * ***********************************/
 
-/** Max number of sectors */
-#define MAX_SECTORS (1024)
-
 #define MAX_YAW (5.0)
 
+/** world_load_ex() flag: stream sector walls in by region, see stream.h */
+#define WORLD_LOAD_STREAM (1 << 0)
+
+/** Check whether a sector's walls are in memory */
+#define SECTOR_RESIDENT(s) ((s)->walls != NULL)
+
+/** Check whether a world has the packed layout, see world_packed_t */
+#define WORLD_PACKED(w) ((w)->packed.walls != NULL)
+
+/** world_load_ex() flag: load the derived topology from a cache file
+    next to the level, or write one, see topo.h */
+#define WORLD_LOAD_TOPO_CACHE (1 << 1)
+
+/** world_load_ex() flag: work out every wall's neighbor from the walls
+    that share its vertices, see topo_autolink() */
+#define WORLD_LOAD_AUTOLINK (1 << 2)
+
+/** Check whether a world has its derived topology, see world_topo_t */
+#define WORLD_TOPO(w) ((w)->topo.length != NULL)
+
+/** world_topo_t sector flags */
+// Walls join up into closed loops
+#define SECTOR_CLOSED (1 << 0)
+// Outline is wound counterclockwise, as sectors should be
+#define SECTOR_CCW    (1 << 1)
+
 /* ***********************************
  * Public Typedefs
  * ***********************************/
@@ -42,11 +65,92 @@ typedef struct sector_struct
     int16_t texture_floor, texture_ceil;
 } sector_t;
 
+/**
+ * Packed wall, only what a portal step needs
+ */
+typedef struct pwall_struct
+{
+    uint32_t v0, v1;
+    int32_t neighbor;
+} pwall_t;
+
+typedef struct pwall_look_struct
+{
+    int16_t texture_low, texture_mid, texture_high;
+} pwall_look_t;
+
+/**
+ * Packed sector, only what a portal step needs. Its walls are
+ * packed.walls[first_wall] onward.
+ */
+typedef struct psector_struct
+{
+    float floor, ceil;
+    uint32_t first_wall;
+    uint32_t num_walls;
+} psector_t;
+
+typedef struct psector_look_struct
+{
+    int16_t texture_floor, texture_ceil;
+    uint8_t brightness;
+} psector_look_t;
+
+/**
+ * Compact copy of the level geometry, for the code that walks it every
+ * frame or tick. Vertices are float arrays, and what is only needed for
+ * drawing is split off into the look arrays, indexed the same as the
+ * walls and sectors. Only built for worlds that are fully in memory.
+ */
+typedef struct world_packed_struct
+{
+    float *vx, *vy;
+    pwall_t *walls;
+    pwall_look_t *wall_looks;
+    psector_t *sectors;
+    psector_look_t *sector_looks;
+    uint32_t numVertices;
+    uint32_t numSectors;
+    uint32_t numWalls;
+} world_packed_t;
+
+/**
+ * Facts derived from the level geometry once it is loaded, see topo.c.
+ * Per wall arrays are indexed like world->walls, and per sector arrays
+ * like world->sectors. Bounding boxes are world->bounds. Only built for
+ * worlds that are fully in memory.
+ */
+typedef struct world_topo_struct
+{
+    // Unit normal pointing into the wall's sector
+    float *nx, *ny;
+    float *length;
+    // SECTOR_* flags
+    uint8_t *flags;
+    uint32_t numSectors;
+    uint32_t numWalls;
+} world_topo_t;
+
 typedef struct world_struct
 {
     xy_t     *vertices;
     sector_t *sectors;
+    // Walls of every sector, stored contiguously in sector order
+    wall_t   *walls;
+    // Bounding box of each sector
+    box_t    *bounds;
+    uint32_t numVertices;
     uint32_t numSectors;
+    uint32_t numWalls;
+
+    // Packed layout, not built for streamed worlds
+    world_packed_t packed;
+    // Derived topology, not built for streamed worlds
+    world_topo_t topo;
+
+    // Changes whenever the level or which of its sectors are
+    // resident does, so views worked out earlier can tell
+    uint32_t revision;
 
     mob_t player;
 } world_t;
@@ -55,13 +159,16 @@ typedef struct world_struct
  * Public Functions
  * ***********************************/
 int8_t world_load(const char *filename);
+int8_t world_load_ex(const char *filename, uint32_t flags);
 void world_close(void);
 
 // All logic for a single tick
-void world_tick(keys_t *keys);
+void world_tick(input_frame_t *input);
 
 // Helper functions
-void world_player_update_sector();
+void world_player_update_sector(void);
+int8_t world_mob_relocate(mob_t *mob);
+int32_t world_find_sector(xy_t *p, int32_t hint);
 int world_inside_sector(xy_t *p, sector_t *sect);
 
 // Getters
@@ -0,0 +1,182 @@
+/**
+ * Batch rendering implementation.
+ *
+ * The renderer keeps its state in statics, so rather than threads the
+ * batch is split across forked worker processes, each with its own
+ * offscreen renderer. The world is loaded once before forking and
+ * shared by the workers until they write to it. The poses are split
+ * into contiguous runs of about the same length only to share out the
+ * work: each pose is drawn from scratch, so the images don't depend on
+ * which worker draws them.
+ *
+ * Pose i is written to [outdir]/[i].bmp, numbered with six digits.
+ */
+
+// fork() and waitpid()
+#define _POSIX_C_SOURCE 200809L
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "batch.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Project headers
+#include "common.h"
+#include "render.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Longest image file name written */
+#define BATCH_NAME_LEN (4096)
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int8_t batch_worker(const campath_t *poses, const char *outdir,
+                           uint32_t first, uint32_t last, const batch_settings_t *settings);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Render poses [first, last) of a batch. Runs in a worker process.
+ * @return 0 if every pose was written
+ */
+static int8_t batch_worker(const campath_t *poses, const char *outdir,
+                           uint32_t first, uint32_t last, const batch_settings_t *settings)
+{
+    world_t *world = world_get_world();
+    char name[BATCH_NAME_LEN];
+    int8_t rc = 0;
+
+    if(render_init_ex(0, RENDER_INIT_OFFSCREEN) != 0) return -1;
+    render_set_distances(settings->far, settings->lod);
+    if(render_set_backend(settings->backend) != 0 || render_set_palette(settings->palette) != 0)
+    {
+        render_close();
+        return -1;
+    }
+
+    for(uint32_t i = first; i < last; ++i)
+    {
+        if(campath_pose(poses, i, &world->player) != 0)
+        {
+            printf("Pose %u is outside the world\n", i);
+            rc = -1;
+            continue;
+        }
+        snprintf(name, sizeof(name), "%s/%06u.bmp", outdir, i);
+        // Each pose is drawn on its own, whichever worker draws the
+        // pose before it, so every worker count writes the same images
+        render_reset_views();
+        if(render_draw_world() != 0 || render_save_frame(name) != 0) rc = -1;
+    }
+
+    render_close();
+
+    return rc;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Render each keyframe of a camera path as a pose of its own, and
+ * write it out as an image. The world must already be loaded, and
+ * the renderer must not be started in this process.
+ * @param[in] poses The poses
+ * @param[in] outdir Directory to write the images to, made if missing
+ * @param[in] workers Worker processes to split the poses between,
+ *                    0 for one per core
+ * @param[in] settings How each worker draws, NULL for the defaults
+ * @return 0 if every pose was written
+ */
+int8_t batch_render(const campath_t *poses, const char *outdir, uint32_t workers, const batch_settings_t *settings)
+{
+    static const batch_settings_t defaults = { .backend = RENDER_BACKEND_PIXELS };
+    pid_t pids[BATCH_MAX_WORKERS];
+    uint32_t started = 0;
+    uint64_t start;
+    int8_t rc = 0;
+
+    if(poses == NULL || poses->count == 0 || outdir == NULL) return -1;
+    if(settings == NULL) settings = &defaults;
+
+    if(workers == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cores > 0) ? (uint32_t)cores : 1;
+    }
+    workers = CLAMP(workers, 1, BATCH_MAX_WORKERS);
+    workers = MIN(workers, poses->count);
+
+    if(mkdir(outdir, 0777) != 0 && errno != EEXIST)
+    {
+        printf("Can't make directory %s\n", outdir);
+        return -1;
+    }
+
+    start = SDL_GetPerformanceCounter();
+    // Anything still buffered would be written by every worker
+    fflush(stdout);
+
+    for(uint32_t w = 0; w < workers; ++w)
+    {
+        uint32_t first = (uint32_t)(((uint64_t)poses->count * w) / workers);
+        uint32_t last = (uint32_t)(((uint64_t)poses->count * (w + 1)) / workers);
+
+        pids[w] = fork();
+        if(pids[w] == 0)
+        {
+            rc = batch_worker(poses, outdir, first, last, settings);
+            fflush(stdout);
+            _exit((rc == 0) ? 0 : 1);
+        }
+        if(pids[w] < 0)
+        {
+            printf("Can't start batch worker %u\n", w);
+            rc = -1;
+            break;
+        }
+        ++started;
+    }
+
+    for(uint32_t w = 0; w < started; ++w)
+    {
+        int status;
+
+        if(waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            rc = -1;
+        }
+    }
+
+    if(rc == 0)
+    {
+        double secs = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        printf("Rendered %u poses on %u workers in %.2f s, %.1f poses per second\n",
+               poses->count, workers, secs, poses->count / secs);
+    }
+    else
+    {
+        printf("Some poses weren't rendered\n");
+    }
+
+    return rc;
+}
@@ -0,0 +1,263 @@
+/**
+ * Camera path implementation.
+ *
+ * FORMAT OF PATH FILE
+ *
+ * c [x] [y] [direction] [yaw] [sector]
+ *
+ * One keyframe per line, in the order they are flown through.
+ * Direction is in radians as for the player, and yaw may be left
+ * out. So may the sector, which is only used by campath_pose(), and
+ * is otherwise found from the position. Lines starting with anything
+ * other than c are ignored.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "campath.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Project headers
+#include "common.h"
+#include "pel.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Keyframes there is room for before the path first grows */
+#define CAMPATH_START_KEYS (256)
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static double campath_lerp_angle(double a, double b, double f);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Blend between two angles the short way around
+ */
+static double campath_lerp_angle(double a, double b, double f)
+{
+    double d = fmod(b - a, 2 * PI);
+
+    if(d > PI) d -= 2 * PI;
+    if(d < -PI) d += 2 * PI;
+
+    return a + (d * f);
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Load a camera path
+ * @param[in] filename The path file
+ * @param[out] path Filled in with the keyframes, free with campath_free()
+ * @return 0 on success
+ */
+int8_t campath_load(const char *filename, campath_t *path)
+{
+    FILE *fp;
+    pel_reader_t reader;
+    campath_key_t *key;
+    uint32_t cap = CAMPATH_START_KEYS;
+    int8_t rc = 0;
+    int type;
+
+    if(path == NULL) return -1;
+    path->keys = NULL;
+    path->count = 0;
+
+    fp = fopen(filename, "rt");
+    if(fp == NULL)
+    {
+        printf("No camera path %s\n", filename);
+        return -1;
+    }
+    if(pel_open_file(&reader, fp) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    path->keys = malloc(cap * sizeof(campath_key_t));
+    if(path->keys == NULL)
+    {
+        printf("Out of memory loading %s\n", filename);
+        rc = -1;
+    }
+
+    while(rc == 0 && (type = pel_next_record(&reader)) != PEL_EOF)
+    {
+        if(type == 'c')
+        {
+            if(path->count == CAMPATH_MAX_KEYS)
+            {
+                printf("Too many keyframes in %s\n", filename);
+                rc = -1;
+                break;
+            }
+            if(path->count == cap)
+            {
+                key = realloc(path->keys, cap * 2 * sizeof(campath_key_t));
+                if(key == NULL)
+                {
+                    printf("Out of memory loading %s\n", filename);
+                    rc = -1;
+                    break;
+                }
+                path->keys = key;
+                cap *= 2;
+            }
+            key = &path->keys[path->count];
+            // Read in: x y direction yaw sector
+            if(!pel_read_double(&reader, &key->x) || !pel_read_double(&reader, &key->y)
+               || !pel_read_double(&reader, &key->direction))
+            {
+                printf("Malformed keyframe on line %u\n", reader.line);
+                rc = -1;
+                break;
+            }
+            if(!pel_read_double(&reader, &key->yaw)) key->yaw = 0;
+            key->yaw = CLAMP(key->yaw, -MAX_YAW, MAX_YAW);
+            if(!pel_read_int(&reader, &key->sector)) key->sector = -1;
+            ++path->count;
+        }
+        pel_skip_line(&reader);
+    }
+
+    pel_close(&reader);
+    fclose(fp);
+
+    if(rc == 0 && path->count == 0)
+    {
+        printf("No keyframes in %s\n", filename);
+        rc = -1;
+    }
+    if(rc != 0) campath_free(path);
+
+    return rc;
+}
+
+/**
+ * Free the keyframes of a path
+ */
+void campath_free(campath_t *path)
+{
+    if(path == NULL) return;
+
+    free(path->keys);
+    path->keys = NULL;
+    path->count = 0;
+}
+
+/**
+ * Get the camera at some point along a path
+ * @param[in] path The path
+ * @param[in] t How far along the path, from 0 (first key) to 1 (last key)
+ * @param[out] cam The camera
+ */
+void campath_sample(const campath_t *path, double t, campath_key_t *cam)
+{
+    const campath_key_t *k0, *k1;
+    double pos, f;
+    uint32_t i;
+
+    if(path == NULL || path->count == 0 || cam == NULL) return;
+
+    if(path->count == 1)
+    {
+        *cam = path->keys[0];
+        return;
+    }
+
+    pos = CLAMP(t, 0, 1) * (path->count - 1);
+    i = MIN((uint32_t)pos, path->count - 2);
+    f = pos - i;
+    k0 = &path->keys[i];
+    k1 = &path->keys[i + 1];
+
+    cam->x = k0->x + ((k1->x - k0->x) * f);
+    cam->y = k0->y + ((k1->y - k0->y) * f);
+    cam->direction = campath_lerp_angle(k0->direction, k1->direction, f);
+    cam->yaw = k0->yaw + ((k1->yaw - k0->yaw) * f);
+    cam->sector = -1;
+}
+
+/**
+ * Move a mob to the camera at some point along a path, standing on
+ * the floor of whichever sector it ends up in
+ * @param[in] path The path
+ * @param[in] t How far along the path, from 0 to 1
+ * @param[in,out] mob The mob, usually the player
+ * @return 0 on success, -1 if that point of the path is outside the
+ *         world (the mob keeps its old sector)
+ */
+int8_t campath_apply(const campath_t *path, double t, mob_t *mob)
+{
+    world_t *world = world_get_world();
+    campath_key_t cam;
+    int8_t rc;
+
+    if(path == NULL || path->count == 0 || mob == NULL) return -1;
+
+    campath_sample(path, t, &cam);
+    mob->pos.x = cam.x;
+    mob->pos.y = cam.y;
+    mob->direction = cam.direction;
+    if(mob->player) mob->player->yaw = cam.yaw;
+
+    rc = world_mob_relocate(mob);
+    if(mob->sector < world->numSectors) mob->pos.z = world->sectors[mob->sector].floor;
+
+    return rc;
+}
+
+/**
+ * Move a mob to one keyframe of a path, standing on the floor of its
+ * sector. The sector given for the keyframe is trusted, so only
+ * keyframes without one are looked up.
+ * @param[in] path The path
+ * @param[in] i The keyframe
+ * @param[in,out] mob The mob, usually the player
+ * @return 0 on success, -1 if there is no such keyframe, or it is
+ *         outside the world
+ */
+int8_t campath_pose(const campath_t *path, uint32_t i, mob_t *mob)
+{
+    world_t *world = world_get_world();
+    const campath_key_t *key;
+    xy_t p;
+    int32_t sector;
+
+    if(path == NULL || i >= path->count || mob == NULL) return -1;
+
+    key = &path->keys[i];
+    p.x = key->x;
+    p.y = key->y;
+    sector = key->sector;
+    if(sector < 0 || (uint32_t)sector >= world->numSectors) sector = world_find_sector(&p, -1);
+    if(sector < 0) return -1;
+
+    mob->pos.x = key->x;
+    mob->pos.y = key->y;
+    mob->direction = key->direction;
+    if(mob->player) mob->player->yaw = key->yaw;
+    mob->sector = sector;
+    mob->pos.z = world->sectors[sector].floor;
+
+    return 0;
+}
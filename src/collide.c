@@ -0,0 +1,542 @@
+/**
+ * Swept circle collision against sector walls.
+ *
+ * A move is resolved in one pass:
+ *  - Broadphase: starting from the body's sector, gather every wall whose
+ *      (precomputed) bounding box overlaps the area the move could reach,
+ *      following passable portals into neighboring sectors.
+ *  - Sweep the body's circle against the blocking walls in that set to
+ *      find the first contact, move up to it and slide the rest of the
+ *      motion along the wall. Repeat for at most COLLIDE_MAX_SLIDES.
+ *  - Each piece of the path is walked through the passable portals it
+ *      crosses to keep track of the body's sector.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "collide.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+
+// Project headers
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+/**
+ * A wall picked up by the broadphase
+ */
+typedef struct c_wall_struct
+{
+    double x0, y0, x1, y1;
+    // Unit normal, either way, and length
+    double ux, uy, len;
+    // Sector the wall belongs to, and where it leads
+    uint32_t sector;
+    int32_t neighbor;
+    // Set if the body can't pass through
+    int blocking;
+} c_wall_t;
+
+/**
+ * Everything a single move might touch
+ */
+typedef struct c_set_struct
+{
+    c_wall_t walls[COLLIDE_MAX_WALLS];
+    uint32_t num_walls;
+    uint32_t sectors[COLLIDE_MAX_SECTORS];
+    uint32_t num_sectors;
+    // Set if walls or sectors in reach didn't fit
+    int overflow;
+} c_set_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+/** Bounding box of every wall in world->walls */
+static box_t *_wall_bounds = NULL;
+static uint32_t _num_bounds = 0;
+
+/** Set once a move has been stopped for reaching too much, since
+ * moves run on the job threads */
+static atomic_flag _overflowed = ATOMIC_FLAG_INIT;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static void collide_wall_box(world_t *world, wall_t *wall, box_t *box);
+static int collide_passable(sector_t *sect, int32_t neighbor, collide_body_t *body);
+static int collide_hole_fits(double floor, double ceil, double nfloor, double nceil, collide_body_t *body);
+static void collide_gather(world_t *world, c_set_t *set, collide_body_t *body, box_t *area);
+static void collide_gather_packed(world_t *world, c_set_t *set, collide_body_t *body, box_t *area);
+static void collide_add_sector(c_set_t *set, int32_t sector);
+static void collide_set_normal(c_wall_t *c);
+static int collide_sweep(double px, double py, double dx, double dy, double r,
+                         const c_wall_t *w, double *t, double *nx, double *ny);
+static int collide_crosses(double ax, double ay, double bx, double by, const c_wall_t *w, double *u);
+static uint32_t collide_track(c_set_t *set, uint32_t sector, double ax, double ay, double bx, double by);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Get a wall's bounding box, from the precomputed table when possible
+ */
+static void collide_wall_box(world_t *world, wall_t *wall, box_t *box)
+{
+    xy_t *v0, *v1;
+
+    if(_wall_bounds != NULL && wall >= world->walls && wall < world->walls + _num_bounds)
+    {
+        *box = _wall_bounds[wall - world->walls];
+        return;
+    }
+
+    // Streamed walls aren't in the table
+    v0 = &world->vertices[wall->v0];
+    v1 = &world->vertices[wall->v1];
+    box->x0 = MIN(v0->x, v1->x);  box->x1 = MAX(v0->x, v1->x);
+    box->y0 = MIN(v0->y, v1->y);  box->y1 = MAX(v0->y, v1->y);
+}
+
+/**
+ * Check if a body fits through the opening between two sectors
+ * @return 1 if it fits
+ */
+static int collide_hole_fits(double floor, double ceil, double nfloor, double nceil, collide_body_t *body)
+{
+    double hole_low  = MAX(floor, nfloor);
+    double hole_high = MIN(ceil,  nceil);
+
+    return !((hole_high < (body->pos.z + body->height + body->eyemargin))
+             || (hole_low > (body->pos.z + body->kneemargin)));
+}
+
+/**
+ * Check if a body fits through a wall of a sector
+ * @return 1 if the wall is a portal the body can pass through
+ */
+static int collide_passable(sector_t *sect, int32_t neighbor, collide_body_t *body)
+{
+    sector_t *nsect;
+
+    if(neighbor < 0) return 0;
+
+    // Portals into streamed out sectors act as walls
+    nsect = world_get_sector(neighbor);
+    if(nsect == NULL || !SECTOR_RESIDENT(nsect)) return 0;
+
+    return collide_hole_fits(sect->floor, sect->ceil, nsect->floor, nsect->ceil, body);
+}
+
+/**
+ * Queue a sector for the broadphase, unless it's already queued
+ */
+static void collide_add_sector(c_set_t *set, int32_t sector)
+{
+    uint32_t k;
+
+    for(k = 0; k < set->num_sectors && set->sectors[k] != (uint32_t)sector; ++k);
+    if(k < set->num_sectors) return;
+
+    if(set->num_sectors == COLLIDE_MAX_SECTORS) set->overflow = 1;
+    else set->sectors[set->num_sectors++] = sector;
+}
+
+/**
+ * Work out the normal and length of a gathered wall
+ */
+static void collide_set_normal(c_wall_t *c)
+{
+    double ex = c->x1 - c->x0, ey = c->y1 - c->y0;
+
+    c->len = LineMagnitude(ex, ey);
+    c->ux = (c->len < 1e-9) ? 0 : -ey / c->len;
+    c->uy = (c->len < 1e-9) ? 0 :  ex / c->len;
+}
+
+/**
+ * Broadphase. Collect the walls whose bounds overlap /area, starting in
+ * the body's sector and flooding through passable portals. Sets
+ * set->overflow if they don't all fit.
+ */
+static void collide_gather(world_t *world, c_set_t *set, collide_body_t *body, box_t *area)
+{
+    if(WORLD_PACKED(world))
+    {
+        collide_gather_packed(world, set, body, area);
+        return;
+    }
+
+    set->num_walls = 0;
+    set->sectors[0] = body->sector;
+    set->num_sectors = 1;
+    set->overflow = 0;
+
+    for(uint32_t q = 0; q < set->num_sectors; ++q)
+    {
+        sector_t *sect = world_get_sector(set->sectors[q]);
+        if(sect == NULL || !SECTOR_RESIDENT(sect)) continue;
+
+        for(uint16_t i = 0; i < sect->num_walls; ++i)
+        {
+            wall_t *wall = &sect->walls[i];
+            c_wall_t *c;
+            box_t wb;
+
+            collide_wall_box(world, wall, &wb);
+            if(!BoxOverlap(&wb, area)) continue;
+            if(set->num_walls == COLLIDE_MAX_WALLS)
+            {
+                set->overflow = 1;
+                return;
+            }
+
+            c = &set->walls[set->num_walls++];
+            c->x0 = world->vertices[wall->v0].x;  c->y0 = world->vertices[wall->v0].y;
+            c->x1 = world->vertices[wall->v1].x;  c->y1 = world->vertices[wall->v1].y;
+            c->sector   = set->sectors[q];
+            c->neighbor = wall->neighbor;
+            c->blocking = !collide_passable(sect, wall->neighbor, body);
+            collide_set_normal(c);
+
+            // Walls on the far side of the portal may be in reach too
+            if(!c->blocking) collide_add_sector(set, wall->neighbor);
+        }
+    }
+}
+
+/**
+ * Broadphase over the packed layout, the same as collide_gather()
+ */
+static void collide_gather_packed(world_t *world, c_set_t *set, collide_body_t *body, box_t *area)
+{
+    world_packed_t *pk = &world->packed;
+    world_topo_t *topo = &world->topo;
+
+    set->num_walls = 0;
+    set->sectors[0] = body->sector;
+    set->num_sectors = 1;
+    set->overflow = 0;
+
+    for(uint32_t q = 0; q < set->num_sectors; ++q)
+    {
+        psector_t *ps = &pk->sectors[set->sectors[q]];
+
+        for(uint32_t i = ps->first_wall; i < ps->first_wall + ps->num_walls; ++i)
+        {
+            pwall_t *wall = &pk->walls[i];
+            c_wall_t *c;
+
+            if(!BoxOverlap(&_wall_bounds[i], area)) continue;
+            if(set->num_walls == COLLIDE_MAX_WALLS)
+            {
+                set->overflow = 1;
+                return;
+            }
+
+            c = &set->walls[set->num_walls++];
+            c->x0 = pk->vx[wall->v0];  c->y0 = pk->vy[wall->v0];
+            c->x1 = pk->vx[wall->v1];  c->y1 = pk->vy[wall->v1];
+            c->sector   = set->sectors[q];
+            c->neighbor = wall->neighbor;
+            c->blocking = (wall->neighbor < 0)
+                          || !collide_hole_fits(ps->floor, ps->ceil, pk->sectors[wall->neighbor].floor,
+                                                pk->sectors[wall->neighbor].ceil, body);
+            if(WORLD_TOPO(world))
+            {
+                c->ux = topo->nx[i];  c->uy = topo->ny[i];
+                c->len = topo->length[i];
+            }
+            else
+            {
+                collide_set_normal(c);
+            }
+
+            if(!c->blocking) collide_add_sector(set, wall->neighbor);
+        }
+    }
+}
+
+/**
+ * Sweep a circle of radius /r from P along D against a wall
+ * @param[out] t Fraction of D travelled before contact
+ * @param[out] nx Contact normal, pointing back towards the circle
+ * @param[out] ny
+ * @return 1 if the circle hits the wall within D
+ */
+static int collide_sweep(double px, double py, double dx, double dy, double r,
+                         const c_wall_t *w, double *t, double *nx, double *ny)
+{
+    double ex = w->x1 - w->x0, ey = w->y1 - w->y0;
+    double len = w->len;
+    double ux = w->ux, uy = w->uy, dist, along, speed;
+    double best = 2.0, bx = 0, by = 0;
+
+    if(len < 1e-9) return 0;
+
+    // Turn the normal to face the circle
+    dist = ((px - w->x0) * ux) + ((py - w->y0) * uy);
+    if(dist < 0) { ux = -ux; uy = -uy; dist = -dist; }
+    along = (((px - w->x0) * ex) + ((py - w->y0) * ey)) / len;
+    speed = (dx * ux) + (dy * uy);
+
+    // Already touching the face, only stop motion into it
+    if(dist < r && along >= 0 && along <= len)
+    {
+        if(speed >= 0) return 0;
+        *t = 0; *nx = ux; *ny = uy;
+        return 1;
+    }
+
+    // Face of the wall
+    if(speed < 0)
+    {
+        double tf = (r - dist) / speed;
+        double a = along + (tf * ((dx * ex) + (dy * ey)) / len);
+        if(tf >= 0 && tf <= 1 && a >= 0 && a <= len)
+        {
+            best = tf; bx = ux; by = uy;
+        }
+    }
+
+    // End points of the wall
+    for(int e = 0; e < 2 && best > 1; ++e)
+    {
+        double qx = (e) ? w->x1 : w->x0, qy = (e) ? w->y1 : w->y0;
+        double fx = px - qx, fy = py - qy;
+        double a = (dx * dx) + (dy * dy);
+        double b = 2 * ((fx * dx) + (fy * dy));
+        double c = (fx * fx) + (fy * fy) - (r * r);
+        double disc, tc;
+
+        if(a < 1e-12 || b >= 0) continue;
+        if(c < 0)
+        {
+            // Overlapping the corner and moving into it
+            double m = LineMagnitude(fx, fy);
+            if(m < 1e-9) continue;
+            best = 0; bx = fx / m; by = fy / m;
+            continue;
+        }
+        disc = (b * b) - (4 * a * c);
+        if(disc < 0) continue;
+        tc = (-b - sqrt(disc)) / (2 * a);
+        if(tc >= 0 && tc <= 1 && tc < best)
+        {
+            best = tc;
+            bx = (fx + (tc * dx)) / r;
+            by = (fy + (tc * dy)) / r;
+        }
+    }
+
+    if(best > 1) return 0;
+
+    *t = best; *nx = bx; *ny = by;
+
+    return 1;
+}
+
+/**
+ * Check if segment A-B crosses a wall
+ * @param[out] u How far along A-B the crossing is
+ */
+static int collide_crosses(double ax, double ay, double bx, double by, const c_wall_t *w, double *u)
+{
+    double rx = bx - ax, ry = by - ay;
+    double ex = w->x1 - w->x0, ey = w->y1 - w->y0;
+    double qx = w->x0 - ax, qy = w->y0 - ay;
+    double den = vxs(rx, ry, ex, ey);
+    double v;
+
+    if(fabs(den) < 1e-12) return 0;
+
+    *u = vxs(qx, qy, ex, ey) / den;
+    v  = vxs(qx, qy, rx, ry) / den;
+
+    return (*u >= 0 && *u <= 1 && v >= 0 && v <= 1);
+}
+
+/**
+ * Follow segment A-B from /sector through any portals it crosses
+ * @return The sector holding B
+ */
+static uint32_t collide_track(c_set_t *set, uint32_t sector, double ax, double ay, double bx, double by)
+{
+    double last = -1, u;
+
+    for(uint32_t step = 0; step < COLLIDE_MAX_SECTORS; ++step)
+    {
+        int moved = 0;
+        for(uint32_t i = 0; i < set->num_walls; ++i)
+        {
+            c_wall_t *w = &set->walls[i];
+            if(w->sector != sector || w->blocking) continue;
+            // Only crossings further along the path count, otherwise
+            // we'd step straight back through the portal we came in by
+            if(collide_crosses(ax, ay, bx, by, w, &u) && u > last)
+            {
+                sector = w->neighbor;
+                last = u;
+                moved = 1;
+                break;
+            }
+        }
+        if(!moved) break;
+    }
+
+    return sector;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Precompute the bounding box of every wall
+ * @note Streamed worlds have no wall table, so bounds are found on the fly
+ * @return 0 on success
+ */
+int8_t collide_build(world_t *world)
+{
+    collide_close();
+    atomic_flag_clear(&_overflowed);
+    if(world == NULL || world->walls == NULL) return 0;
+
+    _wall_bounds = malloc(MAX(world->numWalls, 1) * sizeof(box_t));
+    if(_wall_bounds == NULL)
+    {
+        printf("Out of memory building wall bounds\n");
+        return -1;
+    }
+    _num_bounds = world->numWalls;
+
+    for(uint32_t i = 0; i < world->numWalls; ++i)
+    {
+        xy_t *v0 = &world->vertices[world->walls[i].v0];
+        xy_t *v1 = &world->vertices[world->walls[i].v1];
+        _wall_bounds[i].x0 = MIN(v0->x, v1->x);  _wall_bounds[i].x1 = MAX(v0->x, v1->x);
+        _wall_bounds[i].y0 = MIN(v0->y, v1->y);  _wall_bounds[i].y1 = MAX(v0->y, v1->y);
+    }
+
+    return 0;
+}
+
+/**
+ * Free the wall bounds table
+ */
+void collide_close(void)
+{
+    if(_wall_bounds) free(_wall_bounds);
+    _wall_bounds = NULL;
+    _num_bounds = 0;
+}
+
+/**
+ * Move a body by (dx, dy), stopping at and sliding along any
+ * walls it can't pass, and keep track of its sector. A move that
+ * reaches more walls or sectors than the broadphase holds isn't
+ * made at all, as the walls left out would never be tested.
+ * @param[in,out] body The body to move
+ * @return 1 if the body hit something, or wasn't moved
+ */
+int collide_move(collide_body_t *body, double dx, double dy)
+{
+    world_t *world = world_get_world();
+    double px, py, reach;
+    uint32_t sector;
+    box_t area;
+    c_set_t set;
+    int32_t found;
+    xy_t dest;
+    int hit = 0;
+
+    if(body == NULL || world_get_sector(body->sector) == NULL) return 0;
+
+    px = body->pos.x;
+    py = body->pos.y;
+    reach = LineMagnitude(dx, dy) + body->radius + COLLIDE_SKIN;
+    sector = body->sector;
+    area = (box_t){px - reach, py - reach, px + reach, py + reach};
+
+    // Slides never leave the circle the original move could reach
+    collide_gather(world, &set, body, &area);
+    if(set.overflow)
+    {
+        if(!atomic_flag_test_and_set(&_overflowed))
+        {
+            printf("Move at (%.2f, %.2f) reaches over %u walls or %u sectors, so it and moves like it aren't made\n",
+                   px, py, COLLIDE_MAX_WALLS, COLLIDE_MAX_SECTORS);
+        }
+        return 1;
+    }
+
+    for(int slide = 0; slide < COLLIDE_MAX_SLIDES && (dx != 0 || dy != 0); ++slide)
+    {
+        double t = 1, nx = 0, ny = 0, dot;
+
+        // Find the first wall in the way
+        for(uint32_t i = 0; i < set.num_walls; ++i)
+        {
+            double wt, wnx, wny;
+            if(!set.walls[i].blocking) continue;
+            if(collide_sweep(px, py, dx, dy, body->radius, &set.walls[i], &wt, &wnx, &wny) && wt < t)
+            {
+                t = wt; nx = wnx; ny = wny;
+            }
+        }
+
+        if(t >= 1)
+        {
+            // Nothing in the way
+            sector = collide_track(&set, sector, px, py, px + dx, py + dy);
+            px += dx;
+            py += dy;
+            break;
+        }
+
+        // Stop just short of the wall
+        hit = 1;
+        t = MAX(0, t - (COLLIDE_SKIN / LineMagnitude(dx, dy)));
+        sector = collide_track(&set, sector, px, py, px + (t * dx), py + (t * dy));
+        px += t * dx;
+        py += t * dy;
+
+        // Slide what's left of the move along the wall
+        dx *= (1 - t);
+        dy *= (1 - t);
+        dot = (dx * nx) + (dy * ny);
+        dx -= dot * nx;
+        dy -= dot * ny;
+    }
+
+    // Make sure the body ended up inside the world
+    dest.x = px;
+    dest.y = py;
+    if(!world_inside_sector(&dest, world_get_sector(sector)))
+    {
+        found = world_find_sector(&dest, sector);
+        // About to escape into space, cancel the move
+        if(found < 0) return hit;
+        sector = found;
+    }
+
+    body->pos.x = px;
+    body->pos.y = py;
+    body->sector = sector;
+
+    return hit;
+}
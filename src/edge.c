@@ -0,0 +1,327 @@
+/**
+ * Batched edge kernels.
+ *
+ * The endpoints of every wall are copied into float arrays, one per
+ * coordinate, in world->walls order. Since a sector's walls are stored
+ * together, its edges are a contiguous run of each array, and a kernel
+ * tests V_LANES of them per step with AVX or SSE (picked at compile
+ * time), or one at a time on anything else.
+ *
+ * The arrays are padded with zero length edges so the last step of a
+ * run can always load a full vector, and lanes past the end of the run
+ * are masked off.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "edge.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// Project headers
+#include "common.h"
+#include "world.h"
+#include "util.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Same as the FEQ() used by lines_intersect_raw() */
+#define PARALLEL_EPS (1e-3f)
+
+#if defined(__AVX__)
+#define V_LANES 8
+typedef __m256 vf_t;
+#define V_LOAD(p)   _mm256_loadu_ps(p)
+#define V_SET(x)    _mm256_set1_ps(x)
+#define V_ADD(a,b)  _mm256_add_ps(a, b)
+#define V_SUB(a,b)  _mm256_sub_ps(a, b)
+#define V_MUL(a,b)  _mm256_mul_ps(a, b)
+#define V_DIV(a,b)  _mm256_div_ps(a, b)
+#define V_MIN(a,b)  _mm256_min_ps(a, b)
+#define V_MAX(a,b)  _mm256_max_ps(a, b)
+#define V_AND(a,b)  _mm256_and_ps(a, b)
+#define V_ABS(a)    _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+#define V_LT(a,b)   _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V_LE(a,b)   _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define V_GT(a,b)   _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define V_GE(a,b)   _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define V_BITS(a)   ((uint32_t)_mm256_movemask_ps(a))
+#elif defined(__SSE__)
+#define V_LANES 4
+typedef __m128 vf_t;
+#define V_LOAD(p)   _mm_loadu_ps(p)
+#define V_SET(x)    _mm_set1_ps(x)
+#define V_ADD(a,b)  _mm_add_ps(a, b)
+#define V_SUB(a,b)  _mm_sub_ps(a, b)
+#define V_MUL(a,b)  _mm_mul_ps(a, b)
+#define V_DIV(a,b)  _mm_div_ps(a, b)
+#define V_MIN(a,b)  _mm_min_ps(a, b)
+#define V_MAX(a,b)  _mm_max_ps(a, b)
+#define V_AND(a,b)  _mm_and_ps(a, b)
+#define V_ABS(a)    _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define V_LT(a,b)   _mm_cmplt_ps(a, b)
+#define V_LE(a,b)   _mm_cmple_ps(a, b)
+#define V_GT(a,b)   _mm_cmpgt_ps(a, b)
+#define V_GE(a,b)   _mm_cmpge_ps(a, b)
+#define V_BITS(a)   ((uint32_t)_mm_movemask_ps(a))
+#endif
+
+#ifdef V_LANES
+// Lanes of the step starting at i that are inside a run of n edges
+#define V_TAIL(i, n) (((n) - (i) >= V_LANES) ? ((1u << V_LANES) - 1) : ((1u << ((n) - (i))) - 1))
+// Lanes set in a step's result bits. Looked up rather than left to
+// __builtin_popcount(), which is a libgcc call without -mpopcnt.
+#define V_COUNT(bits) (_lane_counts[bits])
+
+// Set bits of every number from 0 to 4^k - 1, for k = 1, 2 and 3
+#define BITS_1(n) n, n + 1, n + 1, n + 2
+#define BITS_2(n) BITS_1(n), BITS_1(n + 1), BITS_1(n + 1), BITS_1(n + 2)
+#define BITS_3(n) BITS_2(n), BITS_2(n + 1), BITS_2(n + 1), BITS_2(n + 2)
+#endif
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static edge_soa_t _edges = {NULL, NULL, NULL, NULL, NULL, 0};
+
+#if V_LANES == 8
+static const uint8_t _lane_counts[1 << V_LANES] = { BITS_3(0), BITS_3(1), BITS_3(1), BITS_3(2) };
+#elif V_LANES == 4
+static const uint8_t _lane_counts[1 << V_LANES] = { BITS_2(0) };
+#endif
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static void edge_set_bits(uint32_t *mask, uint32_t i, uint32_t bits);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Store the result bits of edges i onward. Steps never straddle a
+ * word since V_LANES divides 32.
+ */
+static void edge_set_bits(uint32_t *mask, uint32_t i, uint32_t bits)
+{
+    mask[i >> 5] |= bits << (i & 31);
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Build the edge tables for the loaded world. Does nothing for streamed
+ * worlds, whose walls aren't all in memory, and kernels must not be
+ * called unless edge_ready().
+ * @return 0 on success
+ */
+int8_t edge_build(world_t *world)
+{
+    uint32_t padded;
+    float *block;
+
+    edge_close();
+    if(world == NULL || world->walls == NULL) return 0;
+
+    padded = ((world->numWalls + (2 * EDGE_LANES) - 1) / EDGE_LANES) * EDGE_LANES;
+    block = aligned_alloc(32, 5 * padded * sizeof(float));
+    if(block == NULL)
+    {
+        printf("Out of memory building edge tables\n");
+        return -1;
+    }
+    memset(block, 0, 5 * padded * sizeof(float));
+
+    _edges.x0   = &block[0 * padded];
+    _edges.y0   = &block[1 * padded];
+    _edges.x1   = &block[2 * padded];
+    _edges.y1   = &block[3 * padded];
+    _edges.dxdy = &block[4 * padded];
+    _edges.count = world->numWalls;
+
+    for(uint32_t i = 0; i < world->numWalls; ++i)
+    {
+        xy_t *v0 = &world->vertices[world->walls[i].v0];
+        xy_t *v1 = &world->vertices[world->walls[i].v1];
+
+        _edges.x0[i] = v0->x;  _edges.y0[i] = v0->y;
+        _edges.x1[i] = v1->x;  _edges.y1[i] = v1->y;
+        _edges.dxdy[i] = (v0->y != v1->y) ? (float)((v1->x - v0->x) / (v1->y - v0->y)) : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Free the edge tables
+ */
+void edge_close(void)
+{
+    // All tables share the one block
+    free(_edges.x0);
+    memset(&_edges, 0, sizeof(_edges));
+}
+
+/**
+ * Check whether the edge tables are built
+ */
+int edge_ready(void)
+{
+    return (_edges.x0 != NULL);
+}
+
+/**
+ * Get the edge tables
+ */
+const edge_soa_t *edge_get(void)
+{
+    return &_edges;
+}
+
+/**
+ * Count the edges crossed by a ray going west from a point, as used for
+ * point in polygon tests by world_inside_sector()
+ * @param[in] first First edge
+ * @param[in] count Number of edges
+ * @param[in] px, py The point
+ * @return Number of edges crossed, odd if the point is inside
+ */
+uint32_t edge_crossings(uint32_t first, uint32_t count, float px, float py)
+{
+    const float *x0 = &_edges.x0[first], *y0 = &_edges.y0[first];
+    const float *y1 = &_edges.y1[first], *dxdy = &_edges.dxdy[first];
+    uint32_t crossed = 0;
+
+#ifdef V_LANES
+    vf_t vpx = V_SET(px), vpy = V_SET(py);
+
+    for(uint32_t i = 0; i < count; i += V_LANES)
+    {
+        vf_t a = V_LOAD(&y0[i]), b = V_LOAD(&y1[i]);
+        // Edge spans the ray's y, and meets it west of the point
+        vf_t spans = V_AND(V_GT(vpy, V_MIN(a, b)), V_LE(vpy, V_MAX(a, b)));
+        vf_t x = V_ADD(V_LOAD(&x0[i]), V_MUL(V_LOAD(&dxdy[i]), V_SUB(vpy, a)));
+
+        crossed += V_COUNT(V_BITS(V_AND(spans, V_LT(x, vpx))) & V_TAIL(i, count));
+    }
+#else
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(py > MAX(y0[i], y1[i]) || py <= MIN(y0[i], y1[i])) continue;
+        if(x0[i] + (dxdy[i] * (py - y0[i])) < px) ++crossed;
+    }
+#endif
+
+    return crossed;
+}
+
+/**
+ * Find the edges a point is strictly to the left of, looking from v0
+ * to v1. These are the walls of a sector that face a viewer at the
+ * point.
+ * @param[in] first First edge
+ * @param[in] count Number of edges
+ * @param[in] px, py The point
+ * @param[out] mask Set for each edge the point is left of
+ * @return Number of edges the point is left of
+ */
+uint32_t edge_left_of(uint32_t first, uint32_t count, float px, float py, uint32_t *mask)
+{
+    const float *x0 = &_edges.x0[first], *y0 = &_edges.y0[first];
+    const float *x1 = &_edges.x1[first], *y1 = &_edges.y1[first];
+    uint32_t found = 0;
+
+    memset(mask, 0, EDGE_MASK_WORDS(count) * sizeof(uint32_t));
+
+#ifdef V_LANES
+    vf_t vpx = V_SET(px), vpy = V_SET(py), zero = V_SET(0);
+
+    for(uint32_t i = 0; i < count; i += V_LANES)
+    {
+        vf_t ax = V_LOAD(&x0[i]), ay = V_LOAD(&y0[i]);
+        // PointSide() of the point against the edge
+        vf_t side = V_SUB(V_MUL(V_SUB(V_LOAD(&x1[i]), ax), V_SUB(vpy, ay)),
+                          V_MUL(V_SUB(V_LOAD(&y1[i]), ay), V_SUB(vpx, ax)));
+        uint32_t bits = V_BITS(V_GT(side, zero)) & V_TAIL(i, count);
+
+        edge_set_bits(mask, i, bits);
+        found += V_COUNT(bits);
+    }
+#else
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(PointSide(px, py, x0[i], y0[i], x1[i], y1[i]) <= 0) continue;
+        edge_set_bits(mask, i, 1);
+        ++found;
+    }
+#endif
+
+    return found;
+}
+
+/**
+ * Find the edges a segment intersects, with the same rules as
+ * lines_intersect_raw(): touching counts, near parallel doesn't
+ * @param[in] first First edge
+ * @param[in] count Number of edges
+ * @param[in] p0x, p0y, p1x, p1y The segment
+ * @param[out] mask Set for each edge hit, may be NULL
+ * @return Number of edges hit
+ */
+uint32_t edge_segment_hits(uint32_t first, uint32_t count,
+                           float p0x, float p0y, float p1x, float p1y, uint32_t *mask)
+{
+    const float *x0 = &_edges.x0[first], *y0 = &_edges.y0[first];
+    const float *x1 = &_edges.x1[first], *y1 = &_edges.y1[first];
+    uint32_t hits = 0;
+
+    if(mask) memset(mask, 0, EDGE_MASK_WORDS(count) * sizeof(uint32_t));
+
+#ifdef V_LANES
+    vf_t sx = V_SET(p0x - p1x), sy = V_SET(p0y - p1y);
+    vf_t vp0x = V_SET(p0x), vp0y = V_SET(p0y);
+    vf_t zero = V_SET(0), one = V_SET(1), eps = V_SET(PARALLEL_EPS);
+
+    for(uint32_t i = 0; i < count; i += V_LANES)
+    {
+        vf_t qx = V_LOAD(&x0[i]), qy = V_LOAD(&y0[i]);
+        vf_t ex = V_SUB(qx, V_LOAD(&x1[i])), ey = V_SUB(qy, V_LOAD(&y1[i]));
+        vf_t dx = V_SUB(vp0x, qx), dy = V_SUB(vp0y, qy);
+        vf_t denom = V_SUB(V_MUL(sx, ey), V_MUL(sy, ex));
+        vf_t t = V_DIV(V_SUB(V_MUL(dx, ey), V_MUL(dy, ex)), denom);
+        vf_t u = V_DIV(V_SUB(V_MUL(sy, dx), V_MUL(sx, dy)), denom);
+        vf_t hit = V_AND(V_GE(V_ABS(denom), eps),
+                   V_AND(V_AND(V_GE(t, zero), V_LE(t, one)),
+                         V_AND(V_GE(u, zero), V_LE(u, one))));
+        uint32_t bits = V_BITS(hit) & V_TAIL(i, count);
+
+        if(mask) edge_set_bits(mask, i, bits);
+        hits += V_COUNT(bits);
+    }
+#else
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(!lines_intersect_raw(p0x, p0y, p1x, p1y, x0[i], y0[i], x1[i], y1[i])) continue;
+        if(mask) edge_set_bits(mask, i, 1);
+        ++hits;
+    }
+#endif
+
+    return hits;
+}
@@ -0,0 +1,182 @@
+/**
+ * Frame ring implementation, the publishing side. The ring is a POSIX
+ * shared memory object the renderer draws each frame straight into,
+ * so publishing a frame is just bumping its sequence numbers.
+ */
+
+// shm_open(), ftruncate() and mmap()
+#define _POSIX_C_SOURCE 200809L
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "framering.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project headers
+#include "common.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Longest shared memory object name kept */
+#define FRAMERING_NAME_LEN (256)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct framering_struct
+{
+    framering_header_t *ring;
+    size_t size;
+    char name[FRAMERING_NAME_LEN];
+    // Frame being drawn, 0 when none is
+    uint64_t frame;
+} framering_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static framering_t _fring = {NULL, 0, {0}, 0};
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Make the shared memory object frames are published to, replacing
+ * any left by a game that didn't close it
+ * @param[in] name Name of the object, starting with a slash
+ * @param[in] slots Frames kept for readers, 0 for FRAMERING_SLOTS
+ * @param[in] format Size and channel layout of the frames
+ * @return 0 on success
+ */
+int8_t framering_open(const char *name, uint32_t slots, const framering_format_t *format)
+{
+    framering_header_t *ring;
+    uint32_t pitch;
+    size_t size;
+    int fd;
+
+    if(name == NULL || format == NULL || strlen(name) >= FRAMERING_NAME_LEN) return -1;
+    framering_close();
+
+    slots = (slots) ? CLAMP(slots, 2, FRAMERING_MAX_SLOTS) : FRAMERING_SLOTS;
+    pitch = format->width * sizeof(uint32_t);
+    size = framering_size(slots, pitch, format->height);
+
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0)
+    {
+        printf("Can't make frame ring %s\n", name);
+        return -1;
+    }
+    if(ftruncate(fd, size) != 0)
+    {
+        printf("Can't size frame ring %s\n", name);
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+    {
+        printf("Can't map frame ring %s\n", name);
+        shm_unlink(name);
+        return -1;
+    }
+
+    // Fresh objects are zeroed, so only the header needs filling in
+    ring->version = FRAMERING_VERSION;
+    ring->format = *format;
+    ring->pitch = pitch;
+    ring->slots = slots;
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->closed, 0);
+    // Readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->magic, FRAMERING_MAGIC, sizeof(ring->magic));
+
+    _fring.ring = ring;
+    _fring.size = size;
+    _fring.frame = 0;
+    strcpy(_fring.name, name);
+
+    return 0;
+}
+
+/**
+ * Stop publishing frames. Readers still mapping the ring keep it
+ * until they let go of it, and see it closed.
+ */
+void framering_close(void)
+{
+    if(_fring.ring == NULL) return;
+
+    atomic_store(&_fring.ring->closed, 1);
+    munmap(_fring.ring, _fring.size);
+    shm_unlink(_fring.name);
+    _fring.ring = NULL;
+    _fring.size = 0;
+    _fring.frame = 0;
+}
+
+/**
+ * Check if frames are being published
+ */
+int framering_active(void)
+{
+    return _fring.ring != NULL;
+}
+
+/**
+ * Take the slot the next frame goes in, marking it as being drawn
+ * @param[out] pitch Bytes from one row of the frame to the next
+ * @return Pixels of the frame, or NULL if no ring is open
+ */
+uint32_t *framering_begin(int *pitch)
+{
+    framering_header_t *ring = _fring.ring;
+    uint32_t slot;
+
+    if(ring == NULL) return NULL;
+
+    _fring.frame = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+    slot = _fring.frame % ring->slots;
+    atomic_store_explicit(&framering_slot(ring, slot)->seq, (_fring.frame << 1) | 1, memory_order_relaxed);
+    // Nothing drawn may be seen before the slot is marked
+    atomic_thread_fence(memory_order_release);
+
+    if(pitch) *pitch = ring->pitch;
+
+    return framering_pixels(ring, slot);
+}
+
+/**
+ * Publish the frame drawn since framering_begin()
+ */
+void framering_publish(void)
+{
+    framering_header_t *ring = _fring.ring;
+
+    if(ring == NULL || _fring.frame == 0) return;
+
+    atomic_store_explicit(&framering_slot(ring, _fring.frame % ring->slots)->seq,
+                          _fring.frame << 1, memory_order_release);
+    atomic_store_explicit(&ring->head, _fring.frame, memory_order_release);
+    _fring.frame = 0;
+}
@@ -211,4 +211,21 @@ void input_get_joystick(float *lx, float *ly, float *rx, float *ry)
         if(ry) *ry = 0;
     }
     
-}
\ No newline at end of file
+}
+
+/**
+ * Take the input for one tick. Mouse motion is consumed, so sample
+ * only once per tick.
+ */
+void input_sample(input_frame_t *frame)
+{
+    int x, y;
+
+    if(frame == NULL) return;
+
+    frame->keys = _keys;
+    mouse_get_input(&x, &y);
+    frame->mouse_x = x;
+    frame->mouse_y = y;
+    input_get_joystick(&frame->lx, &frame->ly, &frame->rx, &frame->ry);
+}
@@ -0,0 +1,333 @@
+/**
+ * Job system implementation.
+ *
+ * Each thread owns a Chase-Lev deque. A batch is split into chunks
+ * which are dealt out to the deques before the workers are woken, so
+ * during a batch owners only pop from the bottom of their own deque
+ * and idle threads steal from the top of someone else's. The calling
+ * thread takes part as thread 0.
+ *
+ * A batch is over once every chunk has run and every worker has
+ * stopped looking at the deques, after which they are reset.
+ */
+
+// sysconf() and sched_yield()
+#define _POSIX_C_SOURCE 200809L
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "job.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Project headers
+#include "common.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define DEQUE_MASK (JOB_DEQUE_SIZE - 1)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct job_struct
+{
+    uint32_t begin, end;
+} job_t;
+
+typedef struct job_deque_struct
+{
+    // Owner pops at bottom, thieves take from top
+    atomic_long top, bottom;
+    job_t jobs[JOB_DEQUE_SIZE];
+    // Keep neighboring deques off each other's cache lines
+    char pad[64];
+} job_deque_t;
+
+typedef struct job_pool_struct
+{
+    uint32_t threads;
+    pthread_t workers[JOB_MAX_THREADS];
+    job_deque_t *deques;
+
+    // Current batch
+    job_fn_t fn;
+    void *arg;
+    atomic_uint remaining;
+    atomic_uint active;
+
+    // Workers sleep here between batches
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint32_t batch;
+    int stop;
+} job_pool_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static job_pool_t _pool = {.threads = 0};
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int job_pop(job_deque_t *d, job_t *job);
+static int job_steal(job_deque_t *d, job_t *job);
+static void job_work(uint32_t self);
+static void *job_worker(void *arg);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Take the newest job from the bottom of our own deque
+ * @return 1 if a job was taken
+ */
+static int job_pop(job_deque_t *d, job_t *job)
+{
+    long b = atomic_load(&d->bottom) - 1;
+    long t;
+
+    atomic_store(&d->bottom, b);
+    t = atomic_load(&d->top);
+
+    if(t > b)
+    {
+        // Empty
+        atomic_store(&d->bottom, b + 1);
+        return 0;
+    }
+
+    *job = d->jobs[b & DEQUE_MASK];
+    if(t == b)
+    {
+        // Last job, race any thieves for it
+        int won = atomic_compare_exchange_strong(&d->top, &t, t + 1);
+        atomic_store(&d->bottom, b + 1);
+        return won;
+    }
+
+    return 1;
+}
+
+/**
+ * Take the oldest job from the top of another thread's deque
+ * @return 1 if a job was taken
+ */
+static int job_steal(job_deque_t *d, job_t *job)
+{
+    long t = atomic_load(&d->top);
+    long b = atomic_load(&d->bottom);
+
+    if(t >= b) return 0;
+
+    *job = d->jobs[t & DEQUE_MASK];
+
+    return atomic_compare_exchange_strong(&d->top, &t, t + 1);
+}
+
+/**
+ * Run jobs until the batch is done, own deque first
+ */
+static void job_work(uint32_t self)
+{
+    job_t job;
+
+    while(atomic_load(&_pool.remaining) > 0)
+    {
+        int got = job_pop(&_pool.deques[self], &job);
+
+        // Out of our own work, go looking for someone else's
+        for(uint32_t i = 1; !got && i < _pool.threads; ++i)
+        {
+            got = job_steal(&_pool.deques[(self + i) % _pool.threads], &job);
+        }
+
+        if(got)
+        {
+            _pool.fn(_pool.arg, job.begin, job.end);
+            atomic_fetch_sub(&_pool.remaining, 1);
+        }
+        else
+        {
+            // The last few jobs are running elsewhere
+            sched_yield();
+        }
+    }
+}
+
+static void *job_worker(void *arg)
+{
+    uint32_t self = (uint32_t)(uintptr_t)arg;
+    uint32_t seen = 0;
+
+    pthread_mutex_lock(&_pool.lock);
+    while(1)
+    {
+        while(!_pool.stop && _pool.batch == seen)
+        {
+            pthread_cond_wait(&_pool.wake, &_pool.lock);
+        }
+        if(_pool.stop) break;
+        seen = _pool.batch;
+        pthread_mutex_unlock(&_pool.lock);
+
+        job_work(self);
+        atomic_fetch_sub(&_pool.active, 1);
+
+        pthread_mutex_lock(&_pool.lock);
+    }
+    pthread_mutex_unlock(&_pool.lock);
+
+    return NULL;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Start the worker threads
+ * @param[in] threads Total threads to run jobs on, including the
+ *                    caller. 0 means one per core.
+ * @return 0 on success
+ */
+int8_t job_init(uint32_t threads)
+{
+    job_close();
+
+    if(threads == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? (uint32_t)cores : 1;
+    }
+    threads = CLAMP(threads, 1, JOB_MAX_THREADS);
+
+    _pool.deques = calloc(threads, sizeof(job_deque_t));
+    if(_pool.deques == NULL)
+    {
+        printf("Out of memory starting job threads\n");
+        return -1;
+    }
+
+    pthread_mutex_init(&_pool.lock, NULL);
+    pthread_cond_init(&_pool.wake, NULL);
+    _pool.batch = 0;
+    _pool.stop = 0;
+    _pool.threads = 1;
+
+    for(uint32_t i = 1; i < threads; ++i)
+    {
+        if(pthread_create(&_pool.workers[i], NULL, job_worker, (void *)(uintptr_t)i) != 0)
+        {
+            printf("Could only start %u of %u job threads\n", i, threads);
+            break;
+        }
+        _pool.threads = i + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the worker threads
+ */
+void job_close(void)
+{
+    if(_pool.threads == 0) return;
+
+    pthread_mutex_lock(&_pool.lock);
+    _pool.stop = 1;
+    pthread_cond_broadcast(&_pool.wake);
+    pthread_mutex_unlock(&_pool.lock);
+
+    for(uint32_t i = 1; i < _pool.threads; ++i)
+    {
+        pthread_join(_pool.workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&_pool.lock);
+    pthread_cond_destroy(&_pool.wake);
+    free(_pool.deques);
+    _pool.deques = NULL;
+    _pool.threads = 0;
+}
+
+/**
+ * Get the number of threads jobs run on, including the caller
+ */
+uint32_t job_threads(void)
+{
+    return (_pool.threads) ? _pool.threads : 1;
+}
+
+/**
+ * Run a function over a range of items, split across all threads,
+ * and wait for it to finish. Runs inline if the pool isn't started.
+ * @param[in] count Number of items
+ * @param[in] grain Rough number of items per job
+ * @param[in] fn Function run on each chunk
+ * @param[in] arg Passed through to fn
+ */
+void job_parallel_for(uint32_t count, uint32_t grain, job_fn_t fn, void *arg)
+{
+    uint32_t chunks, perThread;
+
+    if(count == 0 || fn == NULL) return;
+    if(_pool.threads <= 1 || count <= grain)
+    {
+        fn(arg, 0, count);
+        return;
+    }
+
+    // Never queue more than a deque holds
+    grain = MAX(grain, 1);
+    grain = MAX(grain, (count + (_pool.threads * JOB_DEQUE_SIZE) - 1) / (_pool.threads * JOB_DEQUE_SIZE));
+    chunks = (count + grain - 1) / grain;
+    perThread = (chunks + _pool.threads - 1) / _pool.threads;
+
+    // Workers are all parked, so the deques can be filled directly
+    for(uint32_t t = 0, c = 0; t < _pool.threads; ++t)
+    {
+        job_deque_t *d = &_pool.deques[t];
+        long n = 0;
+
+        for(; n < perThread && c < chunks; ++n, ++c)
+        {
+            d->jobs[n].begin = c * grain;
+            d->jobs[n].end = MIN((c + 1) * grain, count);
+        }
+        atomic_store(&d->top, 0);
+        atomic_store(&d->bottom, n);
+    }
+
+    _pool.fn = fn;
+    _pool.arg = arg;
+    atomic_store(&_pool.remaining, chunks);
+    atomic_store(&_pool.active, _pool.threads - 1);
+
+    pthread_mutex_lock(&_pool.lock);
+    ++_pool.batch;
+    pthread_cond_broadcast(&_pool.wake);
+    pthread_mutex_unlock(&_pool.lock);
+
+    job_work(0);
+
+    // Wait for the workers to stop touching the deques
+    while(atomic_load(&_pool.active) > 0) sched_yield();
+}
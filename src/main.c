@@ -8,6 +8,8 @@
 // Global headers
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
 #include <SDL.h>
 #include <math.h>
 
@@ -17,12 +19,20 @@
 #include "world.h"
 #include "input.h"
 #include "util.h"
+#include "job.h"
+#include "replay.h"
+#include "campath.h"
+#include "stream.h"
+#include "batch.h"
+#include "framering.h"
 
 /* ***********************************
  * Private Defines
  * ***********************************/
 #define MOVE_LEN (1)
 #define TICK_SPAN ((int)(1000 / 60))
+#define BENCH_FRAMES (1000)
+#define BATCH_OUT "frames"
 
 /* ***********************************
  * Static Typedef
@@ -37,10 +47,147 @@
  * Static function prototypes
  * ***********************************/
 
+static int main_compare_time(const void *a, const void *b);
+static int8_t main_parse_count(const char *option, const char *arg, uint32_t min, uint32_t max, uint32_t *val);
+static void main_split(render_view_t *views, uint32_t count);
+static int8_t main_bench(world_t *world, campath_t *path, uint32_t frames, uint32_t views);
+
 /* ***********************************
  * Static function implementation
  * ***********************************/
 
+static int main_compare_time(const void *a, const void *b)
+{
+    uint64_t ta = *(const uint64_t *)a, tb = *(const uint64_t *)b;
+
+    return (ta > tb) - (ta < tb);
+}
+
+/**
+ * Read the whole number given to a command line option, which must
+ * be from /min to /max
+ * @param[out] val The number, left alone if it isn't valid
+ * @return 0 on success, -1 after saying why the value was rejected
+ */
+static int8_t main_parse_count(const char *option, const char *arg, uint32_t min, uint32_t max, uint32_t *val)
+{
+    char *end;
+    long n = strtol(arg, &end, 10);
+
+    if(end == arg || *end != '\0' || n < (long)min || (unsigned long)n > max)
+    {
+        printf("%s takes a whole number from %u to %u, not %s\n", option, min, max, arg);
+        return -1;
+    }
+    *val = (uint32_t)n;
+
+    return 0;
+}
+
+/**
+ * Split the screen between /count views: stacked for two, and
+ * into quarters for three or four
+ */
+static void main_split(render_view_t *views, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        views[i].w = (count > 2) ? SCR_W / 2 : SCR_W;
+        views[i].h = (count > 1) ? SCR_H / 2 : SCR_H;
+        views[i].x = (count > 2) ? (i % 2) * views[i].w : 0;
+        views[i].y = ((count > 2) ? i / 2 : i) * views[i].h;
+    }
+}
+
+/**
+ * Fly the player along a camera path, drawing a fixed number of
+ * frames as fast as possible, and print how long they took
+ * @param views Cameras to split the screen between, each
+ *              further along the path than the last
+ * @return 0 on success
+ */
+static int8_t main_bench(world_t *world, campath_t *path, uint32_t frames, uint32_t views)
+{
+    uint64_t *times, start, total = 0;
+    uint64_t sectors = 0, considered = 0, queued = 0, drawn = 0, occluded = 0, tests = 0, spans = 0, calls = 0;
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+    render_stats_t stats;
+    render_view_t view[RENDER_MAX_VIEWS];
+    mob_t cameras[RENDER_MAX_VIEWS];
+    player_t eyes[RENDER_MAX_VIEWS];
+    uint32_t lost = 0;
+
+    if(frames == 0 || views == 0 || views > RENDER_MAX_VIEWS) return -1;
+
+    // The player is the first camera, so streaming follows it
+    main_split(view, views);
+    view[0].camera = &world->player;
+    for(uint32_t i = 1; i < views; ++i)
+    {
+        cameras[i] = world->player;
+        eyes[i].yaw = 0;
+        cameras[i].player = &eyes[i];
+        view[i].camera = &cameras[i];
+    }
+
+    times = malloc(frames * sizeof(uint64_t));
+    if(times == NULL)
+    {
+        printf("Out of memory starting benchmark\n");
+        return -1;
+    }
+
+    for(uint32_t f = 0; f < frames; ++f)
+    {
+        double t = (frames > 1) ? (double)f / (frames - 1) : 0;
+
+        for(uint32_t i = 0; i < views; ++i)
+        {
+            double ti = t + (double)i / views;
+            if(campath_apply(path, (ti > 1) ? ti - 1 : ti, view[i].camera) != 0) ++lost;
+        }
+        // Load around the camera up front so every run draws the same frames
+        if(stream_active()) stream_update(world->player.sector, 1);
+
+        start = SDL_GetPerformanceCounter();
+        render_draw_views(view, views);
+        times[f] = SDL_GetPerformanceCounter() - start;
+
+        render_get_stats(&stats);
+        total += times[f];
+        sectors += stats.sectors;
+        considered += stats.walls_considered;
+        queued += stats.walls_queued;
+        drawn += stats.walls_drawn;
+        occluded += stats.walls_occluded;
+        tests += stats.wall_tests;
+        spans += stats.spans;
+        calls += stats.draw_calls;
+    }
+
+    qsort(times, frames, sizeof(uint64_t), main_compare_time);
+
+    printf("Rendered %u frames: mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           frames, (total * ms) / frames, times[frames / 2] * ms,
+           times[(frames * 9) / 10] * ms, times[(frames * 99) / 100] * ms, times[frames - 1] * ms);
+    printf("Per frame: %.1f sectors, %.1f walls considered, %.1f queued, %.1f drawn, %.1f occluded, %.1f spans\n",
+           (double)sectors / frames, (double)considered / frames, (double)queued / frames,
+           (double)drawn / frames, (double)occluded / frames, (double)spans / frames);
+    printf("Ordering walls took %.1f front to back tests per frame\n", (double)tests / frames);
+    if(calls > 0)
+    {
+        printf("Walls took %.1f SDL_RenderGeometry() calls per frame\n", (double)calls / frames);
+    }
+    if(lost > 0)
+    {
+        printf("Warning: camera was outside the world for %u frames\n", lost);
+    }
+
+    free(times);
+
+    return 0;
+}
+
 /* ***********************************
  * Main function
  * ***********************************/
@@ -51,6 +198,23 @@ int main(int argc, char *argv[])
     keys_t *keys;
     char *filename;
     int fullscreen = 0;
+    uint32_t loadFlags = 0;
+    uint32_t threads = 0;
+    char *recordFile = NULL, *replayFile = NULL;
+    char *benchFile = NULL;
+    uint32_t benchFrames = BENCH_FRAMES;
+    uint32_t benchViews = 1;
+    char *batchFile = NULL, *batchOut = BATCH_OUT;
+    batch_settings_t batchSettings;
+    char *ringName = NULL;
+    uint32_t ringSlots = 0;
+    double farClip = 0, lodDist = 0;
+    render_backend_t backend = RENDER_BACKEND_PIXELS;
+    int palette = 0;
+    campath_t path;
+    input_frame_t frame;
+    uint64_t frameStart, frameTime, frameTotal = 0, frameWorst = 0;
+    uint32_t frames = 0;
     uint32_t lastTick, curTick;
 
     if(argc < 2)
@@ -63,28 +227,205 @@ int main(int argc, char *argv[])
         filename = argv[1];
     }
 
-    if(argc > 2)
+    for(int i = 2; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--stream") == 0)
+        {
+            loadFlags |= WORLD_LOAD_STREAM;
+        }
+        else if(strcmp(argv[i], "--autolink") == 0)
+        {
+            loadFlags |= WORLD_LOAD_AUTOLINK;
+        }
+        else if(strcmp(argv[i], "--topo-cache") == 0)
+        {
+            loadFlags |= WORLD_LOAD_TOPO_CACHE;
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if(main_parse_count(argv[i], argv[i + 1], 1, JOB_MAX_THREADS, &threads) != 0)
+            {
+                return -1;
+            }
+            ++i;
+        }
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replayFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+        {
+            benchFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            if(main_parse_count(argv[i], argv[i + 1], 1, UINT32_MAX / sizeof(uint64_t), &benchFrames) != 0)
+            {
+                return -1;
+            }
+            ++i;
+        }
+        else if(strcmp(argv[i], "--views") == 0 && i + 1 < argc)
+        {
+            if(main_parse_count(argv[i], argv[i + 1], 1, RENDER_MAX_VIEWS, &benchViews) != 0)
+            {
+                return -1;
+            }
+            ++i;
+        }
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batchFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            batchOut = argv[++i];
+        }
+        else if(strcmp(argv[i], "--ring") == 0 && i + 1 < argc)
+        {
+            ringName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--ring-slots") == 0 && i + 1 < argc)
+        {
+            if(main_parse_count(argv[i], argv[i + 1], 2, FRAMERING_MAX_SLOTS, &ringSlots) != 0)
+            {
+                return -1;
+            }
+            ++i;
+        }
+        else if(strcmp(argv[i], "--geometry") == 0)
+        {
+            backend = RENDER_BACKEND_GEOMETRY;
+        }
+        else if(strcmp(argv[i], "--palette") == 0)
+        {
+            palette = 1;
+        }
+        else if(strcmp(argv[i], "--far") == 0 && i + 1 < argc)
+        {
+            farClip = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--lod") == 0 && i + 1 < argc)
+        {
+            lodDist = atof(argv[++i]);
+        }
+        else
+        {
+            // Any other extra argument requests fullscreen
+            fullscreen = 1;
+        }
+    }
+
+    if(batchFile)
     {
-        fullscreen = 1;
+        // Each worker starts its own renderer, so this one doesn't
+        if(campath_load(batchFile, &path) != 0)
+        {
+            return -1;
+        }
+        if(loadFlags & WORLD_LOAD_STREAM)
+        {
+            printf("--stream is ignored with --batch\n");
+            loadFlags &= ~WORLD_LOAD_STREAM;
+        }
+        if(world_load_ex(filename, loadFlags) != 0)
+        {
+            printf("Could not load world %s\n", filename);
+            campath_free(&path);
+            return -1;
+        }
+
+        printf("Rendering %u poses of %s from %s into %s\n", path.count, filename, batchFile, batchOut);
+        batchSettings.far = farClip;
+        batchSettings.lod = lodDist;
+        batchSettings.backend = backend;
+        batchSettings.palette = palette;
+        done = batch_render(&path, batchOut, threads, &batchSettings);
+
+        campath_free(&path);
+        world_close();
+
+        return done;
+    }
+
+    if(benchFile)
+    {
+        // Draws offscreen with no input, as fast as possible
+        if(campath_load(benchFile, &path) != 0)
+        {
+            return -1;
+        }
+        if(render_init_ex(0, RENDER_INIT_OFFSCREEN) != 0 || world_load_ex(filename, loadFlags) != 0)
+        {
+            printf("Could not load world %s\n", filename);
+            campath_free(&path);
+            render_close();
+            return -1;
+        }
+
+        render_set_distances(farClip, lodDist);
+        if(render_set_backend(backend) != 0 || render_set_palette(palette) != 0
+           || (ringName && render_set_ring(ringName, ringSlots) != 0))
+        {
+            campath_free(&path);
+            world_close();
+            render_close();
+            return -1;
+        }
+        printf("Benchmarking %s along %s\n", filename, benchFile);
+        done = main_bench(world_get_world(), &path, benchFrames, benchViews);
+
+        campath_free(&path);
+        world_close();
+        render_close();
+
+        return done;
     }
 
     if(render_init(fullscreen) != 0)
     {
         return -1;
     }
+    render_set_distances(farClip, lodDist);
+    if(render_set_backend(backend) != 0 || render_set_palette(palette) != 0
+       || (ringName && render_set_ring(ringName, ringSlots) != 0))
+    {
+        render_close();
+        return -1;
+    }
 
     input_init();
 
+    if(job_init(threads) != 0)
+    {
+        input_close();
+        render_close();
+        return -1;
+    }
+
     printf("Loading level %s\n", filename);
-    if(world_load(filename) != 0)
+    if(world_load_ex(filename, loadFlags) != 0)
     {
         printf("Could not load world %s\n", filename);
+        job_close();
         input_close();
         render_close();
         return -1;
     }
 
-
+    if((replayFile && replay_play(replayFile, filename, TICK_SPAN) != 0)
+       || (recordFile && !replayFile && replay_record(recordFile, filename, TICK_SPAN) != 0))
+    {
+        world_close();
+        job_close();
+        input_close();
+        render_close();
+        return -1;
+    }
 
     world = world_get_world();
     lastTick = SDL_GetTicks();
@@ -99,6 +440,26 @@ int main(int argc, char *argv[])
             continue;
         }
 
+        if(replay_mode() == REPLAY_PLAY)
+        {
+            // Ignore live input and run one tick per frame as fast as
+            // possible, so every replay renders exactly the same frames
+            if(!replay_read(&frame))
+            {
+                done = 1;
+                continue;
+            }
+            world_tick(&frame);
+
+            frameStart = SDL_GetPerformanceCounter();
+            render_draw_world();
+            frameTime = SDL_GetPerformanceCounter() - frameStart;
+            frameTotal += frameTime;
+            frameWorst = MAX(frameWorst, frameTime);
+            ++frames;
+            continue;
+        }
+
         if(keys->e)
         {
             input_toggle_mouselook();
@@ -116,7 +477,9 @@ int main(int argc, char *argv[])
         while(curTick - lastTick > TICK_SPAN)
         {
             lastTick += TICK_SPAN;
-            world_tick(keys);
+            input_sample(&frame);
+            if(replay_mode() == REPLAY_RECORD) replay_write(&frame);
+            world_tick(&frame);
         }
 
         /** Update the screen */
@@ -124,8 +487,17 @@ int main(int argc, char *argv[])
     }
     printf("Exiting...\n");
 
+    if(replay_mode() == REPLAY_PLAY && frames > 0)
+    {
+        printf("Replayed %u frames: mean %.3f ms, worst %.3f ms\n", frames,
+               (frameTotal * 1000.0 / SDL_GetPerformanceFrequency()) / frames,
+               frameWorst * 1000.0 / SDL_GetPerformanceFrequency());
+    }
+    replay_close();
+
     input_close();
     world_close();
+    job_close();
     render_close();
 
     return 0;
@@ -11,7 +11,7 @@
 // Global headers
 
 // Project headers
-#include "util.h"
+#include "collide.h"
 #include "world.h"
 
 /* ***********************************
@@ -53,6 +53,7 @@ static const mob_conf_t mob_conf_data[MOB_TYPE_NUMBER] =
         .height     = PLAYER_HEIGHT,
         .kneemargin = PLAYER_KNEE_MARGIN,
         .eyemargin  = PLAYER_HEAD_MARGIN,
+        .radius     = PLAYER_RADIUS,
         .max_health = 100,
     },
     // Enemy 1
@@ -60,6 +61,7 @@ static const mob_conf_t mob_conf_data[MOB_TYPE_NUMBER] =
         .height     = PLAYER_HEIGHT - 2,
         .kneemargin = PLAYER_KNEE_MARGIN,
         .eyemargin  = PLAYER_HEAD_MARGIN,
+        .radius     = PLAYER_RADIUS,
         .max_health = 100,
     }
 };
@@ -91,8 +93,10 @@ void mob_init(mob_t *mob, mob_type_t type)
     mob->height     = conf->height;
     mob->kneemargin = conf->kneemargin;
     mob->eyemargin  = conf->eyemargin;
+    mob->radius     = conf->radius;
     mob->health     = conf->max_health;
     // Initialize position data
+    mob->direction  = 0;
     mob->velocity.x = 0;
     mob->velocity.y = 0;
     mob->velocity.z = 0;
@@ -100,12 +104,34 @@ void mob_init(mob_t *mob, mob_type_t type)
     mob->player = NULL;
     if(type == MOB_TYPE_PLAYER)
     {
-        mob->player = malloc(sizeof(player_t));
+        mob->player = calloc(1, sizeof(player_t));
     }
 
     return;
 }
 
+/**
+ * Frees any additional data held by a mob
+ */
+void mob_close(mob_t *mob)
+{
+    if(mob == NULL) return;
+
+    if(mob->player) free(mob->player);
+    mob->player = NULL;
+}
+
+/**
+ * Get the configuration data for a type of mob
+ * @return The config, or NULL for an unknown type
+ */
+const mob_conf_t *mob_get_conf(mob_type_t type)
+{
+    if((uint32_t)type >= MOB_TYPE_NUMBER) return NULL;
+
+    return &mob_conf_data[(uint32_t)type];
+}
+
 /**
  * Updates a mob's position based on the current velocity vector
  */
@@ -113,106 +139,58 @@ void mob_pos_update(mob_t *mob)
 {
     if(mob == NULL) return;
 
-    float px = mob->pos.x, py = mob->pos.y;
-    int done, newsector = 0;;
-    // Construct vector for movement
-    float dx = mob->velocity.x, dy = mob->velocity.y;
-    xy_t dest = {px+dx, py+dy};
-    xy_t farDest;
-    xy_t ppos = {px, py};
+    collide_body_t body = {
+        .pos        = mob->pos,
+        .sector     = mob->sector,
+        .height     = mob->height,
+        .kneemargin = mob->kneemargin,
+        .eyemargin  = mob->eyemargin,
+        .radius     = mob->radius,
+    };
+
+    mob_body_step(&body, &mob->velocity);
+
+    mob->pos    = body.pos;
+    mob->sector = body.sector;
+}
+
+/**
+ * Moves a body along a velocity vector for one tick, applying gravity
+ * and keeping it between the floor and ceiling of its sector
+ * @param[in,out] body The body to move
+ * @param[in,out] velocity The body's velocity, z is updated by gravity
+ */
+void mob_body_step(collide_body_t *body, xyz_t *velocity)
+{
     sector_t *sect;
-    int prev_sect = -1;
 
-    // Horizontal movement loop
-    if(dx != 0.0 || dy != 0.0)
+    if(body == NULL || velocity == NULL) return;
+    if(world_get_sector(body->sector) == NULL) return;
+
+    // Horizontal movement
+    if(velocity->x != 0.0 || velocity->y != 0.0)
     {
-        do
-        {
-            sect = world_get_sector(mob->sector);
-            done = 1;
-            // Collision detection
-            for(uint16_t s = 0; s < sect->num_walls; ++s)
-            {
-                // Get the neighbor of this cell
-                int32_t neighbor = sect->walls[s].neighbor;
-                sector_t *nsect = (neighbor < 0) ? NULL : world_get_sector(neighbor);
-
-                xy_t *v0 = world_get_vertex(sect->walls[s].v0);
-                xy_t *v1 = world_get_vertex(sect->walls[s].v1);
-                dest.x = px+dx; dest.y = py+dy;
-                farDest.x = dest.x + ((dx > 0) ? PLAYER_RADIUS : -PLAYER_RADIUS);
-                farDest.y = dest.y + ((dy > 0) ? PLAYER_RADIUS : -PLAYER_RADIUS);
-
-                // Check if mob is about to cross an edge
-                float hole_low  = neighbor < 0 ?  9e9 : MAX(sect->floor, nsect->floor);
-                float hole_high = neighbor < 0 ? -9e9 : MIN(sect->ceil,  nsect->ceil);
-                if((neighbor < 0) || hole_high < (mob->pos.z + mob->height + mob->eyemargin)
-                    || (hole_low > mob->pos.z + mob->kneemargin))
-                {
-                    // Compare far line
-                    if(lines_intersect(&ppos, &farDest, v0, v1)
-                       && (!world_inside_sector(&farDest, sect)))
-                    {
-                        // Mob can't fit, project their vector along the wall
-                        // TODO this isn't super efficient (that sqrt call
-                        // is particularly nasty), but it's called
-                        // rarely enough that it doesn't really matter....
-                        project_vector(dx,dy, (v1->x - v0->x), (v1->y - v0->y), &dx, &dy);
-                        //s = -1;
-                        //continue;
-                    }
-                }
-                else if(lines_intersect(&ppos, &dest, v0, v1)
-                        && (!world_inside_sector(&dest, sect)))
-                {
-                    // Player can fit - update active sector
-                    if(prev_sect == neighbor) continue;
-                    if(!world_inside_sector(&dest, nsect)) continue;
-                    prev_sect = mob->sector;
-                    mob->sector = neighbor;
-                    newsector = 1;
-                    done = 0;
-                }
-
-            }
-        } while (!done);
-
-        sect = world_get_sector(mob->sector);
-
-        if(!newsector)
-        {
-            // Check position one last time. If the mob is
-            // about to escape a sector into space, cancel the move
-            dest.x = px+dx; dest.y = py+dy;
-            if(!world_inside_sector(&dest, sect))
-            {
-                dx = 0; dy = 0;
-            }
-        }
-
-        // Now move the mob
-        mob->pos.x += dx;
-        mob->pos.y += dy;
+        collide_move(body, velocity->x, velocity->y);
     }
-    
-    sect = world_get_sector(mob->sector);
+
+    sect = world_get_sector(body->sector);
 
     // Vertical movement
-    if(mob->pos.z > sect->floor)
+    if(body->pos.z > sect->floor)
     {
         // Add gravity
-        mob->velocity.z -= 0.05;
+        velocity->z -= 0.05;
     }
-    mob->pos.z += mob->velocity.z;
+    body->pos.z += velocity->z;
 
-    if(mob->pos.z < sect->floor)
+    if(body->pos.z < sect->floor)
     {
-        mob->pos.z = sect->floor;
-        mob->velocity.z = 0;
+        body->pos.z = sect->floor;
+        velocity->z = 0;
     }
-    if(mob->pos.z + mob->height + mob->eyemargin > sect->ceil)
+    if(body->pos.z + body->height + body->eyemargin > sect->ceil)
     {
-        mob->pos.z = sect->ceil - mob->height - mob->eyemargin;
-        mob->velocity.z = 0;
+        body->pos.z = sect->ceil - body->height - body->eyemargin;
+        velocity->z = 0;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,343 @@
+/**
+ * Mob registry implementation.
+ *
+ * Live mobs are packed at the front of every array, and despawning
+ * swaps the last mob into the hole. Handles go through a slot table:
+ * a slot holds the mob's current packed index and a generation count
+ * which is bumped on despawn, so stale handles stop resolving.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "mobs.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project headers
+#include "common.h"
+#include "collide.h"
+#include "job.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define INITIAL_CAPACITY (64)
+
+/** Mobs per job when ticking */
+#define TICK_GRAIN (256)
+
+#define SLOT_MASK ((1u << MOBS_SLOT_BITS) - 1)
+#define GEN_MASK ((1u << (32 - MOBS_SLOT_BITS)) - 1)
+#define HANDLE(slot, gen) (((gen) << MOBS_SLOT_BITS) | ((slot) + 1))
+#define HANDLE_SLOT(h) (((h) & SLOT_MASK) - 1)
+#define HANDLE_GEN(h) ((h) >> MOBS_SLOT_BITS)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct mob_slot_struct
+{
+    // Packed index while in use, next free slot otherwise
+    uint32_t index;
+    uint32_t generation;
+} mob_slot_t;
+
+/**
+ * Where the gather phase of a tick writes the fields it changes
+ */
+typedef struct mobs_next_struct
+{
+    double *x, *y, *z, *vz;
+    uint32_t *sector;
+} mobs_next_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static mobs_t _mobs;
+static mobs_next_t _next;
+
+static mob_slot_t *_slots = NULL;
+static uint32_t _numSlots = 0;
+static uint32_t _freeSlot = UINT32_MAX;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int8_t mobs_grow_array(void **array, uint32_t capacity, size_t size);
+static int8_t mobs_reserve(uint32_t capacity);
+static void mobs_gather(void *arg, uint32_t begin, uint32_t end);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+static int8_t mobs_grow_array(void **array, uint32_t capacity, size_t size)
+{
+    void *grown = realloc(*array, capacity * size);
+    if(grown == NULL) return -1;
+    *array = grown;
+    return 0;
+}
+
+/**
+ * Make room for at least /capacity mobs
+ * @return 0 on success
+ */
+static int8_t mobs_reserve(uint32_t capacity)
+{
+    uint32_t cap = (_mobs.capacity) ? _mobs.capacity : INITIAL_CAPACITY;
+    int8_t rc = 0;
+
+    if(capacity <= _mobs.capacity) return 0;
+    while(cap < capacity) cap *= 2;
+    cap = MIN(cap, MOBS_MAX);
+
+    rc |= mobs_grow_array((void **)&_mobs.x,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.y,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.z,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.vx,        cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.vy,        cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.vz,        cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.sector,    cap, sizeof(uint32_t));
+    rc |= mobs_grow_array((void **)&_mobs.type,      cap, sizeof(uint8_t));
+    rc |= mobs_grow_array((void **)&_mobs.direction, cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_mobs.health,    cap, sizeof(uint32_t));
+    rc |= mobs_grow_array((void **)&_mobs.handle,    cap, sizeof(mob_handle_t));
+    rc |= mobs_grow_array((void **)&_next.x,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_next.y,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_next.z,         cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_next.vz,        cap, sizeof(double));
+    rc |= mobs_grow_array((void **)&_next.sector,    cap, sizeof(uint32_t));
+    // Every mob can hold at most one slot
+    rc |= mobs_grow_array((void **)&_slots,          cap, sizeof(mob_slot_t));
+    if(rc != 0)
+    {
+        printf("Out of memory growing mob registry\n");
+        return -1;
+    }
+    _mobs.capacity = cap;
+
+    return 0;
+}
+
+/**
+ * Gather phase of a tick for mobs [begin, end). Mobs at rest are
+ * copied across without touching their sector.
+ */
+static void mobs_gather(void *arg, uint32_t begin, uint32_t end)
+{
+    (void)arg;
+
+    for(uint32_t i = begin; i < end; ++i)
+    {
+        const mob_conf_t *conf;
+        collide_body_t body;
+        xyz_t vel;
+
+        if(_mobs.vx[i] == 0.0 && _mobs.vy[i] == 0.0 && _mobs.vz[i] == 0.0)
+        {
+            _next.x[i] = _mobs.x[i];
+            _next.y[i] = _mobs.y[i];
+            _next.z[i] = _mobs.z[i];
+            _next.vz[i] = _mobs.vz[i];
+            _next.sector[i] = _mobs.sector[i];
+            continue;
+        }
+
+        conf = mob_get_conf((mob_type_t)_mobs.type[i]);
+        body.pos.x = _mobs.x[i];
+        body.pos.y = _mobs.y[i];
+        body.pos.z = _mobs.z[i];
+        body.sector = _mobs.sector[i];
+        body.height = conf->height;
+        body.kneemargin = conf->kneemargin;
+        body.eyemargin = conf->eyemargin;
+        body.radius = conf->radius;
+        vel.x = _mobs.vx[i];
+        vel.y = _mobs.vy[i];
+        vel.z = _mobs.vz[i];
+
+        mob_body_step(&body, &vel);
+
+        _next.x[i] = body.pos.x;
+        _next.y[i] = body.pos.y;
+        _next.z[i] = body.pos.z;
+        _next.vz[i] = vel.z;
+        _next.sector[i] = body.sector;
+    }
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Add a mob to the world
+ * @param[in] type The type of mob, which sets its config
+ * @param[in] x The x coordinate
+ * @param[in] y The y coordinate
+ * @param[in] sector The sector containing (x, y), or MOBS_NO_SECTOR
+ * @return Handle for the new mob, or MOBS_HANDLE_NONE on error
+ */
+mob_handle_t mobs_spawn(mob_type_t type, double x, double y, uint32_t sector)
+{
+    const mob_conf_t *conf = mob_get_conf(type);
+    sector_t *sect = world_get_sector(sector);
+    uint32_t i = _mobs.count, slot;
+
+    if(conf == NULL || type == MOB_TYPE_PLAYER) return MOBS_HANDLE_NONE;
+    if(_mobs.count == MOBS_MAX || mobs_reserve(_mobs.count + 1) != 0) return MOBS_HANDLE_NONE;
+
+    // Reuse a free slot before adding a new one
+    if(_freeSlot != UINT32_MAX)
+    {
+        slot = _freeSlot;
+        _freeSlot = _slots[slot].index;
+    }
+    else
+    {
+        slot = _numSlots++;
+        _slots[slot].generation = 1;
+    }
+    _slots[slot].index = i;
+
+    _mobs.x[i] = x;
+    _mobs.y[i] = y;
+    _mobs.z[i] = (sect) ? sect->floor : 0;
+    _mobs.vx[i] = 0;
+    _mobs.vy[i] = 0;
+    _mobs.vz[i] = 0;
+    _mobs.sector[i] = sector;
+    _mobs.type[i] = (uint8_t)type;
+    _mobs.direction[i] = 0;
+    _mobs.health[i] = conf->max_health;
+    _mobs.handle[i] = HANDLE(slot, _slots[slot].generation);
+    ++_mobs.count;
+
+    return _mobs.handle[i];
+}
+
+/**
+ * Remove a mob from the world. Its handle stops resolving.
+ * @return 0 on success, -1 if the handle is stale
+ */
+int8_t mobs_despawn(mob_handle_t handle)
+{
+    int32_t i = mobs_index(handle);
+    uint32_t slot = HANDLE_SLOT(handle), last;
+
+    if(i < 0) return -1;
+
+    // Move the last mob into the hole
+    last = _mobs.count - 1;
+    if((uint32_t)i != last)
+    {
+        _mobs.x[i] = _mobs.x[last];
+        _mobs.y[i] = _mobs.y[last];
+        _mobs.z[i] = _mobs.z[last];
+        _mobs.vx[i] = _mobs.vx[last];
+        _mobs.vy[i] = _mobs.vy[last];
+        _mobs.vz[i] = _mobs.vz[last];
+        _mobs.sector[i] = _mobs.sector[last];
+        _mobs.type[i] = _mobs.type[last];
+        _mobs.direction[i] = _mobs.direction[last];
+        _mobs.health[i] = _mobs.health[last];
+        _mobs.handle[i] = _mobs.handle[last];
+        _slots[HANDLE_SLOT(_mobs.handle[i])].index = i;
+    }
+    --_mobs.count;
+
+    // Retire the slot, wrapping the generation around 0 which is never valid
+    _slots[slot].generation = (_slots[slot].generation + 1) & GEN_MASK;
+    if(_slots[slot].generation == 0) _slots[slot].generation = 1;
+    _slots[slot].index = _freeSlot;
+    _freeSlot = slot;
+
+    return 0;
+}
+
+/**
+ * Remove every mob and free the registry
+ */
+void mobs_clear(void)
+{
+    if(_mobs.x) free(_mobs.x);
+    if(_mobs.y) free(_mobs.y);
+    if(_mobs.z) free(_mobs.z);
+    if(_mobs.vx) free(_mobs.vx);
+    if(_mobs.vy) free(_mobs.vy);
+    if(_mobs.vz) free(_mobs.vz);
+    if(_mobs.sector) free(_mobs.sector);
+    if(_mobs.type) free(_mobs.type);
+    if(_mobs.direction) free(_mobs.direction);
+    if(_mobs.health) free(_mobs.health);
+    if(_mobs.handle) free(_mobs.handle);
+    if(_next.x) free(_next.x);
+    if(_next.y) free(_next.y);
+    if(_next.z) free(_next.z);
+    if(_next.vz) free(_next.vz);
+    if(_next.sector) free(_next.sector);
+    if(_slots) free(_slots);
+
+    memset(&_mobs, 0, sizeof(_mobs));
+    memset(&_next, 0, sizeof(_next));
+    _slots = NULL;
+    _numSlots = 0;
+    _freeSlot = UINT32_MAX;
+}
+
+/**
+ * Move every mob by its velocity, colliding with walls, and apply
+ * gravity.
+ *
+ * Runs in two phases so the result doesn't depend on how the mobs are
+ * split across threads. The gather phase reads only last tick's state
+ * and writes each mob's new state into the staging arrays; the commit
+ * phase then swaps the staging arrays in.
+ */
+void mobs_tick(void)
+{
+    double *swap;
+    uint32_t *swapSector;
+
+    job_parallel_for(_mobs.count, TICK_GRAIN, mobs_gather, NULL);
+
+    swap = _mobs.x;  _mobs.x  = _next.x;  _next.x  = swap;
+    swap = _mobs.y;  _mobs.y  = _next.y;  _next.y  = swap;
+    swap = _mobs.z;  _mobs.z  = _next.z;  _next.z  = swap;
+    swap = _mobs.vz; _mobs.vz = _next.vz; _next.vz = swap;
+    swapSector = _mobs.sector; _mobs.sector = _next.sector; _next.sector = swapSector;
+}
+
+/**
+ * Get the packed mob arrays
+ */
+mobs_t *mobs_get(void)
+{
+    return &_mobs;
+}
+
+/**
+ * Find where a mob currently sits in the packed arrays
+ * @return The packed index, or -1 if the handle is stale
+ */
+int32_t mobs_index(mob_handle_t handle)
+{
+    uint32_t slot = HANDLE_SLOT(handle);
+
+    if(handle == MOBS_HANDLE_NONE || slot >= _numSlots) return -1;
+    if(_slots[slot].generation != HANDLE_GEN(handle)) return -1;
+
+    return (int32_t)_slots[slot].index;
+}
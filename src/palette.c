@@ -0,0 +1,232 @@
+/**
+ * Median cut quantization. The colors counted start out in one box,
+ * and the box with the most pixels along the longest side is split at
+ * its median along that side until there are enough boxes, or none
+ * left to split. Each box becomes the mean of its colors.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "palette.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project headers
+#include "common.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Values a channel takes once binned */
+#define CHANNEL_VALUES (1 << PALETTE_BITS)
+
+/** Value of channel c (0 red, 1 green, 2 blue) of a bin */
+#define BIN_CHANNEL(bin, c) (((bin) >> (PALETTE_BITS * (2 - (c)))) & (CHANNEL_VALUES - 1))
+
+/** 8 bit value of the middle of a binned channel value */
+#define CHANNEL_MID(v) (((v) << (8 - PALETTE_BITS)) | (1 << (7 - PALETTE_BITS)))
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+/**
+ * Box of colors: a run of the bins in use, and their bounds
+ */
+typedef struct p_box_struct
+{
+    uint32_t first, count;
+    uint64_t pixels;
+    uint8_t lo[3], hi[3];
+} p_box_t;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static void palette_shrink(p_box_t *box, const uint16_t *bins, const uint32_t *hist);
+static void palette_split(p_box_t *box, p_box_t *rest, uint16_t *bins, uint16_t *tmp, const uint32_t *hist);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Work out the pixel count and bounds of a box from its bins
+ */
+static void palette_shrink(p_box_t *box, const uint16_t *bins, const uint32_t *hist)
+{
+    box->pixels = 0;
+    for(int c = 0; c < 3; ++c)
+    {
+        box->lo[c] = CHANNEL_VALUES - 1;
+        box->hi[c] = 0;
+    }
+
+    for(uint32_t i = box->first; i < box->first + box->count; ++i)
+    {
+        box->pixels += hist[bins[i]];
+        for(int c = 0; c < 3; ++c)
+        {
+            box->lo[c] = MIN(box->lo[c], BIN_CHANNEL(bins[i], c));
+            box->hi[c] = MAX(box->hi[c], BIN_CHANNEL(bins[i], c));
+        }
+    }
+}
+
+/**
+ * Split a box of more than one bin in two at the median pixel along
+ * its longest side, moving the upper half into /rest
+ */
+static void palette_split(p_box_t *box, p_box_t *rest, uint16_t *bins, uint16_t *tmp, const uint32_t *hist)
+{
+    uint32_t start[CHANNEL_VALUES + 1] = {0};
+    uint64_t below = 0;
+    uint32_t half;
+    int axis = 0;
+
+    for(int c = 1; c < 3; ++c)
+    {
+        if(box->hi[c] - box->lo[c] > box->hi[axis] - box->lo[axis]) axis = c;
+    }
+
+    // Counting sort of the box's bins along the axis
+    for(uint32_t i = box->first; i < box->first + box->count; ++i) ++start[BIN_CHANNEL(bins[i], axis) + 1];
+    for(int v = 0; v < CHANNEL_VALUES; ++v) start[v + 1] += start[v];
+    for(uint32_t i = box->first; i < box->first + box->count; ++i)
+    {
+        tmp[start[BIN_CHANNEL(bins[i], axis)]++] = bins[i];
+    }
+    memcpy(&bins[box->first], tmp, box->count * sizeof(uint16_t));
+
+    // Both halves keep at least one bin
+    for(half = 1; half < box->count - 1; ++half)
+    {
+        below += hist[bins[box->first + half - 1]];
+        if(below * 2 >= box->pixels) break;
+    }
+
+    rest->first = box->first + half;
+    rest->count = box->count - half;
+    box->count = half;
+    palette_shrink(box, bins, hist);
+    palette_shrink(rest, bins, hist);
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Make a palette for the colors counted in a histogram
+ * @param[out] palette Palette and lookup table
+ * @param[in] hist PALETTE_BINS pixel counts, indexed by PALETTE_BIN()
+ * @return 0 on success, -1 if out of memory
+ */
+int8_t palette_build(palette_t *palette, const uint32_t *hist)
+{
+    p_box_t boxes[PALETTE_SIZE];
+    uint16_t *bins, *tmp;
+    uint32_t numBins = 0, numBoxes = 1;
+
+    if(palette == NULL || hist == NULL) return -1;
+
+    bins = malloc(PALETTE_BINS * sizeof(uint16_t));
+    tmp = malloc(PALETTE_BINS * sizeof(uint16_t));
+    if(bins == NULL || tmp == NULL)
+    {
+        printf("Out of memory building palette\n");
+        free(bins);
+        free(tmp);
+        return -1;
+    }
+
+    memset(palette, 0, sizeof(palette_t));
+    for(uint32_t i = 0; i < PALETTE_BINS; ++i)
+    {
+        if(hist[i]) bins[numBins++] = i;
+    }
+    if(numBins == 0)
+    {
+        // Nothing to go on, so everything is black
+        palette->count = 1;
+        free(bins);
+        free(tmp);
+        return 0;
+    }
+
+    boxes[0].first = 0;
+    boxes[0].count = numBins;
+    palette_shrink(&boxes[0], bins, hist);
+
+    while(numBoxes < PALETTE_SIZE)
+    {
+        uint64_t bestScore = 0;
+        int best = -1;
+
+        for(uint32_t i = 0; i < numBoxes; ++i)
+        {
+            uint32_t side = 0;
+            uint64_t score;
+
+            if(boxes[i].count < 2) continue;
+            for(int c = 0; c < 3; ++c) side = MAX(side, (uint32_t)(boxes[i].hi[c] - boxes[i].lo[c]));
+            score = boxes[i].pixels * side;
+            if(score > bestScore)
+            {
+                bestScore = score;
+                best = i;
+            }
+        }
+        if(best < 0) break;
+
+        palette_split(&boxes[best], &boxes[numBoxes++], bins, tmp, hist);
+    }
+
+    // Each box is the mean of its colors
+    for(uint32_t i = 0; i < numBoxes; ++i)
+    {
+        uint64_t sum[3] = {0, 0, 0};
+
+        for(uint32_t j = boxes[i].first; j < boxes[i].first + boxes[i].count; ++j)
+        {
+            for(int c = 0; c < 3; ++c) sum[c] += (uint64_t)CHANNEL_MID(BIN_CHANNEL(bins[j], c)) * hist[bins[j]];
+        }
+        palette->r[i] = sum[0] / boxes[i].pixels;
+        palette->g[i] = sum[1] / boxes[i].pixels;
+        palette->b[i] = sum[2] / boxes[i].pixels;
+    }
+    palette->count = numBoxes;
+
+    // Nearest palette color to every bin, used or not
+    for(uint32_t bin = 0; bin < PALETTE_BINS; ++bin)
+    {
+        int32_t r = CHANNEL_MID(BIN_CHANNEL(bin, 0));
+        int32_t g = CHANNEL_MID(BIN_CHANNEL(bin, 1));
+        int32_t b = CHANNEL_MID(BIN_CHANNEL(bin, 2));
+        int32_t bestDist = INT32_MAX;
+
+        for(uint32_t i = 0; i < palette->count; ++i)
+        {
+            int32_t dr = r - palette->r[i], dg = g - palette->g[i], db = b - palette->b[i];
+            int32_t dist = (dr * dr) + (dg * dg) + (db * db);
+
+            if(dist < bestDist)
+            {
+                bestDist = dist;
+                palette->lookup[bin] = i;
+            }
+        }
+    }
+
+    free(bins);
+    free(tmp);
+
+    return 0;
+}
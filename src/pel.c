@@ -0,0 +1,331 @@
+/**
+ * Streaming tokenizer for .pel world definition files.
+ *
+ * The reader hands out one whitespace separated token at a time, so
+ * a record may span any number of bytes. Field readers stop at the end
+ * of the current line, which lets callers detect short records instead
+ * of silently reading into the next one.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "pel.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project headers
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+#define IS_SPACE(c) (IS_BLANK(c) || (c) == '\n')
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int pel_refill(pel_reader_t *r);
+static inline int pel_peek(pel_reader_t *r);
+static void pel_skip_blanks(pel_reader_t *r);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Pull the next block from the source file
+ * @return 1 if any bytes were read
+ */
+static int pel_refill(pel_reader_t *r)
+{
+    if(r->fp == NULL) return 0;
+
+    r->base += r->len;
+    r->len = fread(r->block, 1, PEL_BUF_LEN, r->fp);
+    r->pos = 0;
+
+    return (r->len > 0);
+}
+
+/**
+ * Look at the next character without consuming it
+ * @return The character, or PEL_EOF
+ */
+static inline int pel_peek(pel_reader_t *r)
+{
+    if(r->pos >= r->len && !pel_refill(r)) return PEL_EOF;
+
+    return (unsigned char)r->buf[r->pos];
+}
+
+/**
+ * Skip spaces and tabs, but stop at the end of the line
+ */
+static void pel_skip_blanks(pel_reader_t *r)
+{
+    int c;
+    while((c = pel_peek(r)) != PEL_EOF && IS_BLANK(c)) ++r->pos;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Set up a reader over an open file
+ * @return 0 on success
+ */
+int8_t pel_open_file(pel_reader_t *r, FILE *fp)
+{
+    if(r == NULL || fp == NULL) return -1;
+
+    r->block = malloc(PEL_BUF_LEN);
+    if(r->block == NULL) return -1;
+
+    r->fp = fp;
+    r->buf = r->block;
+    r->len = 0;
+    r->pos = 0;
+    r->base = ftell(fp);
+    r->line = 1;
+
+    return 0;
+}
+
+/**
+ * Set up a reader over a block of memory. The memory is not copied and
+ * must outlive the reader.
+ */
+void pel_open_mem(pel_reader_t *r, const char *buf, size_t len)
+{
+    if(r == NULL) return;
+
+    r->fp = NULL;
+    r->block = NULL;
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->base = 0;
+    r->line = 1;
+}
+
+/**
+ * Free reader resources
+ * @note Does not close the underlying file
+ */
+void pel_close(pel_reader_t *r)
+{
+    if(r == NULL) return;
+    if(r->block) free(r->block);
+    r->block = NULL;
+    r->buf = NULL;
+    r->len = r->pos = 0;
+}
+
+/**
+ * Get the offset of the next unread character
+ */
+long pel_tell(pel_reader_t *r)
+{
+    return r->base + (long)r->pos;
+}
+
+/**
+ * Move the reader to an offset previously returned by pel_tell()
+ * @note Line numbers are not tracked across a seek
+ * @return 0 on success
+ */
+int8_t pel_seek(pel_reader_t *r, long offset)
+{
+    if(r->fp == NULL)
+    {
+        if(offset < 0 || (size_t)offset > r->len) return -1;
+        r->pos = offset;
+        return 0;
+    }
+
+    // Stay inside the current block if we can
+    if(offset >= r->base && offset < r->base + (long)r->len)
+    {
+        r->pos = offset - r->base;
+        return 0;
+    }
+
+    if(fseek(r->fp, offset, SEEK_SET) != 0) return -1;
+    r->base = offset;
+    r->len = 0;
+    r->pos = 0;
+
+    return 0;
+}
+
+/**
+ * Advance to the start of the next non-empty line and return the
+ * first character of its first token. The rest of that token is
+ * consumed.
+ * @return The record type character, or PEL_EOF
+ */
+int pel_next_record(pel_reader_t *r)
+{
+    int c, type;
+
+    // Skip any whitespace, including blank lines
+    while((c = pel_peek(r)) != PEL_EOF && IS_SPACE(c))
+    {
+        if(c == '\n') ++r->line;
+        ++r->pos;
+    }
+    if(c == PEL_EOF) return PEL_EOF;
+
+    // Consume the record token
+    type = c;
+    while((c = pel_peek(r)) != PEL_EOF && !IS_SPACE(c)) ++r->pos;
+
+    return type;
+}
+
+/**
+ * Discard everything up to and including the next newline
+ */
+void pel_skip_line(pel_reader_t *r)
+{
+    const char *nl;
+
+    while(pel_peek(r) != PEL_EOF)
+    {
+        nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if(nl != NULL)
+        {
+            r->pos = (nl - r->buf) + 1;
+            ++r->line;
+            return;
+        }
+        r->pos = r->len;
+    }
+}
+
+/**
+ * Read the next token on the current line. Tokens longer than
+ * the output buffer are truncated, but fully consumed.
+ * @param[out] word Output buffer, always NUL terminated
+ * @param[in] len Size of the output buffer
+ * @return 1 on success, 0 at end of line
+ */
+int pel_read_word(pel_reader_t *r, char *word, size_t len)
+{
+    size_t n = 0;
+    int c;
+
+    if(r == NULL || word == NULL || len == 0) return 0;
+
+    pel_skip_blanks(r);
+    c = pel_peek(r);
+    if(c == PEL_EOF || c == '\n') return 0;
+
+    while((c = pel_peek(r)) != PEL_EOF && !IS_SPACE(c))
+    {
+        if(n < len - 1) word[n++] = c;
+        ++r->pos;
+    }
+    word[n] = '\0';
+
+    return 1;
+}
+
+/**
+ * Read an integer field
+ * @return 1 on success, 0 at end of line or if the token isn't a number
+ */
+int pel_read_int(pel_reader_t *r, int32_t *val)
+{
+    char word[PEL_TOKEN_LEN], *end;
+
+    if(!pel_read_word(r, word, sizeof(word))) return 0;
+    *val = strtol(word, &end, 0);
+
+    return (end != word && *end == '\0');
+}
+
+/**
+ * Read a floating point field
+ * @return 1 on success, 0 at end of line or if the token isn't a number
+ */
+int pel_read_double(pel_reader_t *r, double *val)
+{
+    char word[PEL_TOKEN_LEN], *end;
+
+    if(!pel_read_word(r, word, sizeof(word))) return 0;
+    *val = strtod(word, &end);
+
+    return (end != word && *end == '\0');
+}
+
+/**
+ * Read the fixed fields of a sector record:
+ * ID Floor Ceiling FloorTexture CeilTexture Brightness NumWalls
+ * @note The wall list itself is left unread and sect->walls is cleared
+ * @return 1 on success, 0 if the record is malformed
+ */
+int pel_read_sector(pel_reader_t *r, sector_t *sect)
+{
+    char word[PEL_TOKEN_LEN];
+    int32_t tfloor, tceil, bright, nwalls;
+
+    if(!pel_read_word(r, word, sizeof(word))
+       || !pel_read_double(r, &sect->floor) || !pel_read_double(r, &sect->ceil)
+       || !pel_read_int(r, &tfloor) || !pel_read_int(r, &tceil)
+       || !pel_read_int(r, &bright) || !pel_read_int(r, &nwalls)
+       || nwalls < 0 || nwalls > UINT16_MAX)
+    {
+        return 0;
+    }
+    sect->texture_floor = tfloor;
+    sect->texture_ceil  = tceil;
+    sect->brightness    = bright;
+    sect->num_walls     = nwalls;
+    sect->walls         = NULL;
+
+    return 1;
+}
+
+/**
+ * Read a single wall of a sector record:
+ * v0 v1 neighbor textureLow textureMid textureHigh
+ * @return 1 on success, 0 if the wall is malformed
+ */
+int pel_read_wall(pel_reader_t *r, wall_t *wall)
+{
+    char word[PEL_TOKEN_LEN], *end;
+    int32_t tlow, tmid, thigh;
+
+    if(!pel_read_int(r, &wall->v0) || !pel_read_int(r, &wall->v1)
+       || !pel_read_word(r, word, sizeof(word))
+       || !pel_read_int(r, &tlow) || !pel_read_int(r, &tmid) || !pel_read_int(r, &thigh))
+    {
+        return 0;
+    }
+    // Value of 'x' means no neighbor, anything else must be a sector
+    if(strcmp(word, "x") == 0)
+    {
+        wall->neighbor = -1;
+    }
+    else
+    {
+        wall->neighbor = strtol(word, &end, 0);
+        if(end == word || *end != '\0') return 0;
+    }
+    wall->texture_low  = tlow;
+    wall->texture_mid  = tmid;
+    wall->texture_high = thigh;
+
+    return 1;
+}
@@ -65,17 +65,16 @@
  * Public function implementation
  * ***********************************/
 
-void player_handle_input(mob_t *player, keys_t *keys)
+void player_handle_input(mob_t *player, input_frame_t *input)
 {
-    if(player == NULL || keys == NULL) { return; }
+    if(player == NULL || input == NULL) { return; }
     double pi = acos(-1);
-    int x, y;
-    float lx, ly, rx, ry;
+    keys_t *keys = &input->keys;
+    int x = input->mouse_x, y = input->mouse_y;
+    float lx = input->lx, ly = input->ly, rx = input->rx, ry = input->ry;
     sector_t *sect = world_get_sector(player->sector);
     xy_t vel;
 
-    input_get_joystick(&lx, &ly, &rx, &ry);
-
     /** Move the player */
     if(keys->left)  { player->direction += 0.04; }
     if(keys->right) { player->direction -= 0.04; }
@@ -182,7 +181,6 @@ void player_handle_input(mob_t *player, keys_t *keys)
     player->velocity.y = CLAMP(player->velocity.y, -MAX_SPEED, MAX_SPEED);
 
     // Get look info
-    mouse_get_input(&x, &y);
     if(fabs(rx) > 0.05 || fabs(ry) > 0.05)
     {
         player->direction +=  rx * JOY_X_SCALE;
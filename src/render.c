@@ -20,6 +20,10 @@
 // Project headers
 #include "common.h"
 #include "world.h"
+#include "render_wall.h"
+#include "edge.h"
+#include "framering.h"
+#include "palette.h"
 
 /* ***********************************
  * Private Definitions
@@ -28,6 +32,33 @@
 #define MAX_PORTALS (32)
 #define MAX_WALLS   (1024)
 
+/** Camera moves bigger than these between frames sort the walls
+ * from scratch rather than starting from the last frame's order */
+#define VIEW_REUSE_DIST  (2.0)
+#define VIEW_REUSE_ANGLE (0.5)
+/** Slots in the table of last frame's draw order */
+#define VIEW_RANK_SLOTS  (MAX_WALLS * 2)
+
+/** render_WallTest() answer for walls that touch, are parallel or cross */
+#define WALL_TIE (-1)
+
+/** Times a sector is looked into in a frame before it is
+ * looked into across the whole screen */
+#define MAX_SECTOR_VISITS (4)
+
+/** Spans the span buffer has room for before it first grows */
+#define SPAN_POOL_START (SCR_W * 8)
+/** Marks a column with no span bordering its open window */
+#define SPAN_NONE (UINT32_MAX)
+
+/** Light levels of the colormap, and how far a shade is
+ * shifted down to pick one */
+#define COLORMAP_SHIFT  (2)
+#define COLORMAP_LEVELS (0x100 >> COLORMAP_SHIFT)
+
+/** Quads each texture's wall geometry has room for before it first grows */
+#define GEOM_QUADS_START (SCR_W * 2)
+
 #define HFOV_DEFAULT (0.73f)
 #define VFOV_DEFAULT (0.2f)
 
@@ -37,12 +68,15 @@
 
 #define DIST_SHADE_MULT (1)
 
+// Fog starts this fraction of the way out to the far clip
+#define FOG_START (0.75)
+
 #define SKYBOX_NAME "resource/citybg.bmp"
 #define SKYBOX_W (_skybox.w * HFOV_DEFAULT / (PI))
 #define SKYBOX_H (_skybox.h * VFOV_DEFAULT * 2)
 
 // For use in calculating ceiling/floor
-#define YAW(y,z) (y + z*player->player->yaw)
+#define YAW(y,z) (y + z*ctx->yaw)
 
 /* ***********************************
  * Private Typedefs
@@ -50,47 +84,144 @@
 
 /**
  * Structure to hold information about individual
- * items in the render queue
+ * items in the render queue. sx1 and sx2 are the screen
+ * columns the sector can be seen in through its portals.
  */
 typedef struct r_queue_struct
 {
     int sectorN, sx1, sx2;
 } r_queue_t;
 
-typedef struct render_settings_struct
+/**
+ * How much of a sector has been looked into this frame
+ */
+typedef struct r_sector_view_struct
 {
-    double hfov_angle;
-    double hfov;
-    double vfov;
-} render_settings_t;
+    // Queue entry while it waits to be looked into
+    r_queue_t *queued;
+    // Screen columns already looked into, none if sx1 > sx2
+    int sx1, sx2;
+    uint8_t visits;
+} r_sector_view_t;
+
+/**
+ * One column of texels deferred by render_DrawWall() to the
+ * raster pass, which fills the spans a texture at a time
+ */
+typedef struct r_span_struct
+{
+    // Screen column and rows covered, inclusive
+    int16_t x, y0, y1;
+    int16_t texture;
+    // Nonzero for floors and ceilings, zero for walls
+    uint8_t flat;
+    // Walls: past the LOD distance, so filled with the
+    // average color of the texture
+    uint8_t lod;
+    uint8_t brightness;
+    // What the span is of, for the pick buffers
+    uint8_t surface;
+    int32_t sector, wall;
+    // Walls: distance from the eye along the view direction
+    float depth;
+    // Walls: depth for shading, texture column, and the
+    // unclamped rows the top and bottom of the wall land on
+    uint16_t z;
+    uint32_t idx;
+    int32_t ceil, floor;
+    // Walls: world height of the texture between ceil and floor.
+    // Flats: height of the plane relative to the eye
+    double height;
+    // View the span was emitted by
+    uint8_t view;
+} r_span_t;
 
 /**
- * Structure to hold info about a wall as it gets
- * added to the render list.
- * These structs create a linked list in order
- * to enable fast removal of walls after they 
- * get constructed.
+ * The walls drawn last frame, and the camera they were worked out for
  */
-typedef struct r_wall_struct r_wall_t;
+typedef struct r_view_struct
+{
+    int valid;
+    uint32_t revision;
+    uint32_t sector;
+    xyz_t pos;
+    double direction, yaw, height;
+    // Walls drawn, in the order they were drawn
+    r_wall_t *order[MAX_WALLS];
+    uint32_t num_order;
+    // Counters from working out which walls to draw
+    render_stats_t stats;
+} r_view_t;
 
-struct r_wall_struct
+/**
+ * Where a wall came in the draw order, keyed by sector and wall
+ */
+typedef struct r_rank_struct
 {
-    sector_t *sector;
-    xy_t *v0, *v1;
+    uint32_t key;
+    uint32_t rank;
+} r_rank_t;
 
-    // Transformed coordinates (relative to player)
-    xyz_t t0, t1;
-    // Screen X positions (x0 is start, x1 is end)
-    int x0, x1;
-    // Texture start & end
-    int32_t texture, lo_texture, hi_texture;
-    int u0, u1;
+/**
+ * One of the views drawn this frame: the rectangle of the screen it
+ * goes in, its camera, the open window of each of its columns, and
+ * the walls it drew last frame
+ */
+typedef struct r_context_struct
+{
+    int x, y, w, h;
+    mob_t *camera;
+    // Look up/down of the camera, and cos/sin of its direction
+    double yaw, pcos, psin;
+    // Projection onto the rectangle
+    double xscale, vfov;
+    int ytop[SCR_W], ybottom[SCR_W];
+    // Last span drawn above and below the open window of each
+    // column, which the next span in the column may overlap
+    uint32_t span_top[SCR_W], span_bottom[SCR_W];
+    // Columns with room left to draw in, as a bitset and a count
+    uint32_t cols_open[EDGE_MASK_WORDS(SCR_W)];
+    uint32_t num_cols_open;
+    // Queued walls. Each view has its own, so the walls it drew
+    // last frame are still there after the other views queue theirs
+    r_wall_t wall_pool[MAX_WALLS];
+    uint32_t wcount;
+    // Last frame's view, and its draw order by wall
+    r_view_t view;
+    r_rank_t view_rank[VIEW_RANK_SLOTS];
+} r_context_t;
 
-    int32_t neighbor;
-    // Pointers to other objects in the queue for
-    // fast removal
-    r_wall_t *prev, *next;
-};
+/**
+ * Wall columns of one texture for the geometry backend, as quads
+ * handed to SDL_RenderGeometry() in one go at the end of the frame
+ */
+typedef struct r_geom_struct
+{
+    SDL_Vertex *verts;
+    int *indices;
+    // Quads held and quads there is room for
+    uint32_t num_quads, cap;
+} r_geom_t;
+
+/**
+ * Id buffer entry, what render_pick() reports besides the depth
+ */
+typedef struct r_pick_id_struct
+{
+    int32_t sector, wall;
+    uint8_t surface;
+} r_pick_id_t;
+
+typedef struct render_settings_struct
+{
+    double hfov_angle;
+    double hfov;
+    double vfov;
+    // Far clip and where its fog starts, 0 for none
+    double far, fog;
+    // Distance surfaces are drawn in flat colors from, 0 for never
+    double lod;
+} render_settings_t;
 
 /* ***********************************
  * Static variables
@@ -102,6 +233,12 @@ static SDL_Window *_window;
 /** Global renderer for easy access */
 static SDL_Renderer *_renderer;
 
+/** Surface rendered to instead of the window when offscreen */
+static SDL_Surface *_target;
+
+/** Counters for the last frame drawn */
+static render_stats_t _stats;
+
 /** Global render settings */
 static render_settings_t _rsettings;
 
@@ -123,15 +260,15 @@ static const char *_texture_names[NUM_TEXTURES] =
 
 static image_t _textures[NUM_TEXTURES] =
 {
-    {NULL,NULL,0,0,0, 5, 20},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15},
-    {NULL,NULL,0,0,0, 5, 15}
+    {.xscale = 5, .yscale = 20},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15},
+    {.xscale = 5, .yscale = 15}
 };
 
 static image_t _skybox;
@@ -143,133 +280,463 @@ static uint32_t *_scr_pix;
 static int _scr_pitch;
 
 // Variables for keeping track of 
-static uint8_t  sectors_visited[MAX_SECTORS];
-static r_wall_t wall_pool[MAX_WALLS];
-
-static int *ytop = NULL;
-static int *ybottom = NULL;
+// How much of each sector has been looked into, grown to fit the world
+static r_sector_view_t *sector_views = NULL;
+static uint32_t _sector_view_cap = 0;
+// Walls of the current sector facing the player
+static uint32_t walls_facing[EDGE_MASK_WORDS(UINT16_MAX + 1)];
+
+// Views drawn by render_draw_views(), by their place in its list
+static r_context_t _contexts[RENDER_MAX_VIEWS];
+
+// Spans emitted this frame, and their order sorted by texture
+static r_span_t *_spans = NULL;
+static uint32_t *_span_order = NULL;
+static uint32_t _num_spans = 0;
+static uint32_t _span_cap = 0;
+
+// Depth and id of every pixel of the last frame, when kept
+static float *_pick_depth = NULL;
+static r_pick_id_t *_pick_id = NULL;
+
+// How walls are filled in, and their quads when SDL does it
+static render_backend_t _backend = RENDER_BACKEND_PIXELS;
+static r_geom_t _geom[NUM_TEXTURES];
+
+// Palette of palettized textures, and the screen pixel of each of its
+// colors at every light level. NULL unless textures are palettized.
+static palette_t *_palette = NULL;
+static uint32_t (*_colormap)[PALETTE_SIZE] = NULL;
 
 /* ***********************************
  * Static function prototypes
  * ***********************************/
 
 // Draw the skybox onto the static pixel buffer
-void render_draw_skybox(mob_t *player);
+void render_draw_skybox(r_context_t *ctx);
 
 // Preprocessing step for rendering
-r_wall_t *render_PreProcess(world_t *world);
+r_wall_t *render_PreProcess(world_t *world, r_context_t *ctx);
+
+// Draw a single wall
+void render_DrawWall(r_wall_t *wall, world_t *world, r_context_t *ctx);
 
-// Check if wall is in front of another wall
-int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player);
+// Draw everything one camera sees into its rectangle
+static void render_draw_view(r_context_t *ctx, const render_view_t *view, world_t *world);
 
-// Get the the next wall
-r_wall_t *render_GetNextWall(r_wall_t **first, mob_t *player);
+// Reuse or start from last frame's view
+static int render_view_same(r_context_t *ctx, world_t *world);
+static void render_view_sort(r_context_t *ctx, r_wall_t **wqueue, world_t *world);
+static void render_view_save(r_context_t *ctx, world_t *world);
 
-// Draw a single wall
-void render_DrawWall(r_wall_t *wall, world_t *world, int *ytop, int *ybottom);
+// Check if any column in [x0, x1] has room left to draw in
+static int render_cols_open(r_context_t *ctx, int x0, int x1);
+
+// Defer a column of texels to the raster pass
+static void render_span_emit(r_context_t *ctx, const r_span_t *span, uint32_t *edge);
+// Fill every deferred span, a texture at a time
+static void render_span_flush(void);
+
+// Batch a wall span up as quads, then draw the batches
+static int render_geom_span(const r_span_t *span);
+static void render_geom_submit(void);
+
+// Average color of a texture, for drawing it far away
+static void render_average_color(image_t *image);
+// Light level of a texel, fogged towards the far clip
+static inline uint8_t render_shade(uint32_t z, uint8_t brightness);
 
 // Go from screen coords to map coords
-void render_screen_to_world(int sX, int sY, double mapY, double pcos, double psin, mob_t *player, double *mapX, double *mapZ);
+void render_screen_to_world(r_context_t *ctx, int sX, int sY, double mapY, double *mapX, double *mapZ);
 
 /* ***********************************
  * Static function implementation
  * ***********************************/
 
 /**
- * Draws the skybox onto the static pixel buffer
+ * Draws the skybox onto the static pixel buffer, across the
+ * rectangle of a view
  */
-void render_draw_skybox(mob_t *player)
+void render_draw_skybox(r_context_t *ctx)
 {
     // Get starting x
-    int x0 = _skybox.w - ((player->direction * _skybox.w) / (2 * PI));
-    int y0 = (_skybox.h / 2) + ((player->player->yaw / MAX_YAW) *  (_skybox.h / 2));
+    int x0 = _skybox.w - ((ctx->camera->direction * _skybox.w) / (2 * PI));
+    int y0 = (_skybox.h / 2) + ((ctx->yaw / MAX_YAW) *  (_skybox.h / 2));
     int x1 = (x0 + SKYBOX_W);
     int y1 = y0 + SKYBOX_H;
 
-    for(int x = 0; x < SCR_W; ++x)
+    for(int x = 0; x < ctx->w; ++x)
     {
-        for(int y = 0; y < SCR_H; ++y)
+        for(int y = 0; y < ctx->h; ++y)
         {
-            int ix = PointOnLine(0, x0, SCR_W, x1, x) % _skybox.w;
-            int iy = PointOnLine(0, y0, SCR_H, y1, y);
+            int ix = PointOnLine(0, x0, ctx->w, x1, x) % _skybox.w;
+            int iy = PointOnLine(0, y0, ctx->h, y1, y);
             iy = MAX(iy, 0);
             iy = MIN(iy, _skybox.h - 1);
-            _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + x] = 
+            _scr_pix[((ctx->y + y) * _scr_pitch / sizeof(uint32_t)) + ctx->x + x] = 
                 _skybox.pix[(iy * _skybox.pitch / sizeof(uint32_t)) + ix];
         }
     }
 }
 
+/**
+ * Queue up a sector to be looked into across screen columns [sx1, sx2].
+ * A sector already waiting has its columns widened instead, and one
+ * already looked into is only queued again for columns it wasn't.
+ * @param rhead Head of the ring buffer /rqueue, moved along if the
+ *              sector is queued
+ */
+static void render_queue_sector(r_context_t *ctx, r_queue_t *rqueue, r_queue_t **rhead, int sector, int sx1, int sx2)
+{
+    r_sector_view_t *view = &sector_views[sector];
+
+    if(sx1 > sx2) return;
+    if(view->queued)
+    {
+        view->queued->sx1 = MIN(view->queued->sx1, sx1);
+        view->queued->sx2 = MAX(view->queued->sx2, sx2);
+        return;
+    }
+    if(view->visits > 0 && sx1 >= view->sx1 && sx2 <= view->sx2) return;
+
+    // Seen through enough portals, so look at all of it
+    // this time rather than coming back again
+    if(view->visits + 1 >= MAX_SECTOR_VISITS)
+    {
+        sx1 = 0;
+        sx2 = ctx->w - 1;
+    }
+
+    (*rhead)->sectorN = sector;
+    (*rhead)->sx1 = sx1;
+    (*rhead)->sx2 = sx2;
+    view->queued = *rhead;
+    if(++(*rhead) == rqueue + MAX_PORTALS) *rhead = rqueue;
+}
+
+/**
+ * Add the columns [sx1, sx2] to those a sector has been looked
+ * into across. Keeps one run of columns, so when the two don't
+ * meet it keeps the wider.
+ */
+static void render_view_add(r_sector_view_t *view, int sx1, int sx2)
+{
+    if(view->visits++ == 0 || (sx1 <= view->sx2 + 1 && sx2 >= view->sx1 - 1))
+    {
+        view->sx1 = (view->visits == 1) ? sx1 : MIN(view->sx1, sx1);
+        view->sx2 = (view->visits == 1) ? sx2 : MAX(view->sx2, sx2);
+    }
+    else if(sx2 - sx1 > view->sx2 - view->sx1)
+    {
+        view->sx1 = sx1;
+        view->sx2 = sx2;
+    }
+}
+
+/**
+ * Key of a wall in the draw order table
+ */
+static inline uint32_t render_view_key(const r_wall_t *wall, world_t *world)
+{
+    return ((uint32_t)(wall->sector - world->sectors + 1) << 16) | (uint32_t)wall->index;
+}
+
+/**
+ * Check if the camera and world are exactly as they were last frame,
+ * in which case the same walls get drawn in the same order
+ */
+static int render_view_same(r_context_t *ctx, world_t *world)
+{
+    r_view_t *view = &ctx->view;
+    mob_t *player = ctx->camera;
+
+    return view->valid && view->revision == world->revision
+        && view->sector == player->sector
+        && view->pos.x == player->pos.x && view->pos.y == player->pos.y
+        && view->pos.z == player->pos.z && view->height == player->height
+        && view->direction == player->direction && view->yaw == ctx->yaw;
+}
+
+/**
+ * Compare walls by their place in the last frame's draw order,
+ * then by where they were queued
+ */
+static int render_view_compare(const void *a, const void *b)
+{
+    const r_rank_t *ra = a, *rb = b;
+
+    if(ra->rank != rb->rank) return (ra->rank < rb->rank) ? -1 : 1;
+    return (ra->key < rb->key) ? -1 : (ra->key > rb->key);
+}
+
+/**
+ * Reorder the wall queue to match the order walls were drawn in last
+ * frame, with walls that weren't drawn after them. Front to back order
+ * barely changes between frames, so render_GetNextWall() then mostly
+ * finds the next wall at the head of the queue. Only the sort is
+ * seeded: the walls are still walked and transformed every frame, and
+ * come out in the same order as if left as queued. Left as queued
+ * after large camera moves.
+ */
+static void render_view_sort(r_context_t *ctx, r_wall_t **wqueue, world_t *world)
+{
+    static r_rank_t sorted[MAX_WALLS];
+    r_view_t *view = &ctx->view;
+    r_rank_t *rank = ctx->view_rank;
+    mob_t *player = ctx->camera;
+    double turn;
+    uint32_t n = 0, i;
+    r_wall_t *wall;
+
+    if(!view->valid || view->revision != world->revision || *wqueue == NULL) return;
+
+    turn = fabs(fmod(player->direction - view->direction, 2 * PI));
+    turn = MIN(turn, 2 * PI - turn);
+    if(turn > VIEW_REUSE_ANGLE || fabs(ctx->yaw - view->yaw) > VIEW_REUSE_ANGLE
+       || LineMagnitude(player->pos.x - view->pos.x, player->pos.y - view->pos.y) > VIEW_REUSE_DIST)
+    {
+        return;
+    }
+
+    // Rank each queued wall, using key to hold its place in the queue
+    for(wall = *wqueue; wall != NULL && n < MAX_WALLS; wall = wall->next, ++n)
+    {
+        uint32_t key = render_view_key(wall, world);
+        uint32_t slot = (key * 2654435761u) & (VIEW_RANK_SLOTS - 1);
+
+        sorted[n].rank = UINT32_MAX;
+        while(rank[slot].key != 0)
+        {
+            if(rank[slot].key == key)
+            {
+                sorted[n].rank = rank[slot].rank;
+                break;
+            }
+            slot = (slot + 1) & (VIEW_RANK_SLOTS - 1);
+        }
+        sorted[n].key = n;
+    }
+    if(wall != NULL) return;
+
+    // Sort, then relink the queue in the new order
+    {
+        r_wall_t *walls[MAX_WALLS];
+
+        for(wall = *wqueue, i = 0; wall != NULL; wall = wall->next) walls[i++] = wall;
+        qsort(sorted, n, sizeof(r_rank_t), render_view_compare);
+        for(i = 0; i < n; ++i)
+        {
+            wall = walls[sorted[i].key];
+            wall->prev = (i > 0) ? walls[sorted[i - 1].key] : NULL;
+            wall->next = (i + 1 < n) ? walls[sorted[i + 1].key] : NULL;
+        }
+        *wqueue = walls[sorted[0].key];
+    }
+}
+
+/**
+ * Remember the camera and the order walls were drawn in this frame
+ */
+static void render_view_save(r_context_t *ctx, world_t *world)
+{
+    r_view_t *view = &ctx->view;
+    r_rank_t *rank = ctx->view_rank;
+    mob_t *player = ctx->camera;
+
+    view->valid = 1;
+    view->revision = world->revision;
+    view->sector = player->sector;
+    view->pos = player->pos;
+    view->height = player->height;
+    view->direction = player->direction;
+    view->yaw = ctx->yaw;
+
+    memset(ctx->view_rank, 0, sizeof(ctx->view_rank));
+    for(uint32_t i = 0; i < view->num_order; ++i)
+    {
+        uint32_t key = render_view_key(view->order[i], world);
+        uint32_t slot = (key * 2654435761u) & (VIEW_RANK_SLOTS - 1);
+
+        while(rank[slot].key != 0 && rank[slot].key != key)
+        {
+            slot = (slot + 1) & (VIEW_RANK_SLOTS - 1);
+        }
+        // A sector looked into twice queues its walls twice, so
+        // keep the first time a wall was drawn
+        if(rank[slot].key == 0)
+        {
+            rank[slot].key = key;
+            rank[slot].rank = i;
+        }
+    }
+}
+
+/**
+ * Check the coverage bitset for open columns
+ * @return Nonzero if any column from x0 to x1 inclusive is open
+ */
+static int render_cols_open(r_context_t *ctx, int x0, int x1)
+{
+    const uint32_t *cols_open = ctx->cols_open;
+    uint32_t first, last;
+
+    x0 = MAX(x0, 0);
+    x1 = MIN(x1, ctx->w - 1);
+    if(x0 > x1) return 0;
+
+    first = x0 >> 5;
+    last = x1 >> 5;
+    if(first == last)
+    {
+        return ((cols_open[first] >> (x0 & 31)) & (UINT32_MAX >> (31 - (x1 - x0)))) != 0;
+    }
+    if(cols_open[first] >> (x0 & 31)) return 1;
+    for(uint32_t w = first + 1; w < last; ++w)
+    {
+        if(cols_open[w]) return 1;
+    }
+    return (cols_open[last] & (UINT32_MAX >> (31 - (x1 & 31)))) != 0;
+}
+
 /**
  * Rendering preprocessing step. Performs the following steps
  *  - Starting in the starting sector, add any *possibly*
  *      visible walls to a linked list of walls to be rendered
  *  - For every wall that links to another sector, add that neighbor
- *      to the rendering queue (unless it is already there!)
+ *      to the rendering queue (unless it is already there!), along
+ *      with the screen columns it can be seen through, outside
+ *      of which its walls are skipped
  */
-r_wall_t *render_PreProcess(world_t *world)
+r_wall_t *render_PreProcess(world_t *world, r_context_t *ctx)
 {
     // Current sector
     sector_t *sect;
-    static uint32_t wcount = 0;
+    const psector_t *ps = NULL;
+    const world_packed_t *pk;
+    uint32_t nwalls;
     r_wall_t *last_wall = NULL, *wall = NULL, *first_wall = NULL;;
     xy_t ppos;
     double pcos, psin;
+    const uint32_t *facing = NULL;
     // Portal flooding queue
-    uint32_t rqueue[MAX_PORTALS], *rhead=rqueue, *rtail=rqueue;
+    r_queue_t rqueue[MAX_PORTALS], *rhead=rqueue, *rtail=rqueue;
+    r_queue_t cur;
 
-    if(world == NULL) { return NULL; }
+    if(world == NULL || ctx == NULL) { return NULL; }
+    pk = &world->packed;
+    // A camera away from the player can be in a sector streamed out
+    if(!WORLD_PACKED(world) && !SECTOR_RESIDENT(&world->sectors[ctx->camera->sector])) { return NULL; }
 
     // Get player position for later use
-    ppos.x = world->player.pos.x;
-    ppos.y = world->player.pos.y;
+    ppos.x = ctx->camera->pos.x;
+    ppos.y = ctx->camera->pos.y;
 
     // Get sin/cos of player angle for later use
-    pcos = cos(world->player.direction);
-    psin = sin(world->player.direction);
+    pcos = ctx->pcos;
+    psin = ctx->psin;
+
+    // Initialize visited sectors list, with room for every sector
+    if(world->numSectors > _sector_view_cap)
+    {
+        r_sector_view_t *views = realloc(sector_views, world->numSectors * sizeof(r_sector_view_t));
 
-    // Initialize visited sectors list
-    memset(sectors_visited, 0, MAX_SECTORS * sizeof(uint8_t));
+        if(views == NULL)
+        {
+            printf("Out of memory for %u sector views\n", world->numSectors);
+            return NULL;
+        }
+        sector_views = views;
+        _sector_view_cap = world->numSectors;
+    }
+    memset(sector_views, 0, world->numSectors * sizeof(r_sector_view_t));
 
-    // Initialize render queue
-    *rhead = world->player.sector;
-    if(++rhead == rqueue + MAX_PORTALS) rhead = rqueue;
+    // Initialize render queue, with the whole screen in view
+    render_queue_sector(ctx, rqueue, &rhead, ctx->camera->sector, 0, ctx->w - 1);
     
     do
     {
-        // Get starting sector
-        sect = &world->sectors[*rtail];
-        // Mark sector as visited
-        sectors_visited[*rtail] = 1;
+        r_sector_view_t *view;
+
+        cur = *rtail;
         if(++rtail == rqueue + MAX_PORTALS) rtail = rqueue;
+        // Get starting sector, from the packed layout if there is one
+        sect = &world->sectors[cur.sectorN];
+        if(WORLD_PACKED(world)) ps = &pk->sectors[cur.sectorN];
+        nwalls = (ps) ? ps->num_walls : sect->num_walls;
+        // Mark the columns of the sector as visited
+        view = &sector_views[cur.sectorN];
+        view->queued = NULL;
+        render_view_add(view, cur.sx1, cur.sx2);
+        ++_stats.sectors;
+
+        // Do the facing test for every wall of the sector at once
+        if(edge_ready())
+        {
+            edge_left_of((ps) ? ps->first_wall : sect->walls - world->walls, nwalls, ppos.x, ppos.y, walls_facing);
+            facing = walls_facing;
+        }
 
         // For each wall in the sector
-        for(int i = 0; i < sect->num_walls; ++i)
+        for(uint32_t i = 0; i < nwalls; ++i)
         {
-            // Get the two vertices
-            xy_t *v0 = &world->vertices[sect->walls[i].v1];
-            xy_t *v1 = &world->vertices[sect->walls[i].v0];
+            // Vertex IDs, flipped, and their positions
+            uint32_t i0, i1;
+            xy_t v0, v1;
+            int32_t neighbor;
+            int16_t tex_low, tex_mid, tex_high;
             xyz_t *t0, *t1;
             double xscale0, xscale1;
             image_t *texture = NULL;
             double texture_scale = 1;
             int tw = 100;
 
+            ++_stats.walls_considered;
+
             // Check that player is on the right side of the wall
-            if(PointSide(ppos.x, ppos.y, v0->x, v0->y, v1->x, v1->y) >= 0) continue;
+            if(facing && !EDGE_MASK_TEST(facing, i)) continue;
 
-            if(sect->walls[i].texture_mid < NUM_TEXTURES)
+            if(ps)
             {
-                texture = &_textures[sect->walls[i].texture_mid];
+                const pwall_t *pw = &pk->walls[ps->first_wall + i];
+                i0 = pw->v1;  i1 = pw->v0;
+                neighbor = pw->neighbor;
+                v0.x = pk->vx[i0];  v0.y = pk->vy[i0];
+                v1.x = pk->vx[i1];  v1.y = pk->vy[i1];
+            }
+            else
+            {
+                i0 = sect->walls[i].v1;  i1 = sect->walls[i].v0;
+                neighbor = sect->walls[i].neighbor;
+                v0 = world->vertices[i0];
+                v1 = world->vertices[i1];
+            }
+
+            if(!facing && PointSide(ppos.x, ppos.y, v0.x, v0.y, v1.x, v1.y) >= 0) continue;
+
+            if(ps)
+            {
+                const pwall_look_t *look = &pk->wall_looks[ps->first_wall + i];
+                tex_low = look->texture_low;  tex_mid = look->texture_mid;  tex_high = look->texture_high;
+            }
+            else
+            {
+                tex_low = sect->walls[i].texture_low;
+                tex_mid = sect->walls[i].texture_mid;
+                tex_high = sect->walls[i].texture_high;
+            }
+
+            if(tex_mid < NUM_TEXTURES)
+            {
+                texture = &_textures[tex_mid];
                 
             }
-            else if(sect->walls[i].texture_low < NUM_TEXTURES)
+            else if(tex_low < NUM_TEXTURES)
             {
-                texture = &_textures[sect->walls[i].texture_low];
+                texture = &_textures[tex_low];
             }
-            else if(sect->walls[i].texture_high < NUM_TEXTURES)
+            else if(tex_high < NUM_TEXTURES)
             {
-                texture = &_textures[sect->walls[i].texture_high];
+                texture = &_textures[tex_high];
             }
             if(texture != NULL)
             {
@@ -280,25 +747,32 @@ r_wall_t *render_PreProcess(world_t *world)
             int x0, x1, u0, u1;
 
             // Get pointer to the next active wall object
-            wall = &wall_pool[wcount];
+            wall = &ctx->wall_pool[ctx->wcount];
 
             // Now check that the wall is within the player FOV
             // Generate points of the sector, rotated around player FOV
             t0 = &wall->t0; 
             t1 = &wall->t1;
             // Get rotated X coordinates
-            t0->x = ((v0->x - ppos.x) * psin) - ((v0->y - ppos.y) * pcos);
-            t1->x = ((v1->x - ppos.x) * psin) - ((v1->y - ppos.y) * pcos);
+            t0->x = ((v0.x - ppos.x) * psin) - ((v0.y - ppos.y) * pcos);
+            t1->x = ((v1.x - ppos.x) * psin) - ((v1.y - ppos.y) * pcos);
             // Get rotated Z coordinates
-            t0->z = ((v0->x - ppos.x) * pcos) + ((v0->y - ppos.y) * psin);
-            t1->z = ((v1->x - ppos.x) * pcos) + ((v1->y - ppos.y) * psin);
+            t0->z = ((v0.x - ppos.x) * pcos) + ((v0.y - ppos.y) * psin);
+            t1->z = ((v1.x - ppos.x) * pcos) + ((v1.y - ppos.y) * psin);
 
             // If wall is entirely behind player, it is not visible
             if(t0->z <= 0 && t1->z <= 0) continue;
 
             // Set up texture mapping variables
             u0 = 0;
-            u1 = LineMagnitude(((v1->x - v0->x) / texture_scale), ((v1->y - v0->y) / texture_scale)) * tw;
+            if(ps && WORLD_TOPO(world))
+            {
+                u1 = (world->topo.length[ps->first_wall + i] / texture_scale) * tw;
+            }
+            else
+            {
+                u1 = LineMagnitude(((v1.x - v0.x) / texture_scale), ((v1.y - v0.y) / texture_scale)) * tw;
+            }
             // The wall is partially behind the player, so we have to clip it against
             // the player's view frustrum
             if(t0->z <= 0 || t1->z <= 0)
@@ -331,33 +805,42 @@ r_wall_t *render_PreProcess(world_t *world)
             }
 
             // Transform t0 and t1 onto screen X values
-            xscale0 = (_rsettings.hfov_angle * SCR_W) / t0->z;  x0 = SCR_W/2 + (int)(t0->x * xscale0);
-            xscale1 = (_rsettings.hfov_angle * SCR_W) / t1->z;  x1 = SCR_W/2 + (int)(t1->x * xscale1);
+            xscale0 = ctx->xscale / t0->z;  x0 = ctx->w/2 + (int)(t0->x * xscale0);
+            xscale1 = ctx->xscale / t1->z;  x1 = ctx->w/2 + (int)(t1->x * xscale1);
+
+            // Skip if the projected X values are out of range, or
+            // outside the portals the sector is seen through
+            if(x0 >= x1 || x1 < 0 || x0 > (ctx->w - 1)) continue;
+            if(x1 < cur.sx1 || x0 > cur.sx2) continue;
 
-            // Skip if the projected X values are out of range
-            if(x0 >= x1 || x1 < 0 || x0 > (SCR_W - 1)) continue;
+            // Nothing past the far clip is seen, so don't look through it
+            wall->fogged = (_rsettings.far > 0 && MIN(t0->z, t1->z) > _rsettings.far);
+            if(wall->fogged) neighbor = -1;
 
             // Wall is possibly visible. Add it to the queue, and queue up it's neighboring sector
-            ++wcount;
-            wcount = (wcount < MAX_WALLS) ? wcount : 0;
+            ++_stats.walls_queued;
+            ++ctx->wcount;
+            ctx->wcount = (ctx->wcount < MAX_WALLS) ? ctx->wcount : 0;
 
             if(last_wall) last_wall->next = wall;
             wall->prev = last_wall;
             wall->next = NULL;          
             wall->sector = sect;
-            wall->v0 = v0;  wall->v1 = v1;
+            wall->v0 = &world->vertices[i0];  wall->v1 = &world->vertices[i1];
             wall->x0 = x0;  wall->x1 = x1;
-            wall->neighbor = sect->walls[i].neighbor;
+            wall->neighbor = neighbor;
+            wall->index = i;
             wall->u0 = u0;  wall->u1 = u1;
-            wall->texture = sect->walls[i].texture_mid;
-            wall->lo_texture = sect->walls[i].texture_low;
-            wall->hi_texture = sect->walls[i].texture_high;
+            wall->texture = tex_mid;
+            wall->lo_texture = tex_low;
+            wall->hi_texture = tex_high;
 
-            if(wall->neighbor > -1 && sectors_visited[wall->neighbor] == 0)
+            // Every sector of a packed world is resident
+            if(wall->neighbor > -1 && (ps || SECTOR_RESIDENT(&world->sectors[wall->neighbor])))
             {
-                // Wall has a neighbor - queue up that sector
-                *rhead = wall->neighbor;
-                if(++rhead == rqueue + MAX_PORTALS) rhead = rqueue;
+                // Wall has a neighbor - queue up that sector, seen
+                // through the columns of the portal in view
+                render_queue_sector(ctx, rqueue, &rhead, wall->neighbor, MAX(x0, cur.sx1), MIN(x1, cur.sx2));
             }
 
             if(first_wall == NULL) first_wall = wall;
@@ -372,20 +855,29 @@ r_wall_t *render_PreProcess(world_t *world)
 }
 
 /**
- * Return 1 if w1 is in front of 2, or 0 otherwise.
- * Assumes the screen X coordinates of the lines don't intersect
+ * Order two walls by sector and index, for walls the front to back
+ * test can't tell apart
  */
-int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player)
+static inline int render_WallFirst(const r_wall_t *w1, const r_wall_t *w2)
+{
+    if(w1->sector != w2->sector) return w1->sector < w2->sector;
+    return w1->index < w2->index;
+}
+
+/**
+ * Return 1 if w1 is in front of 2, 0 if it is behind, or WALL_TIE if
+ * the walls touch, are parallel or cross. Near degenerate cases the
+ * answer can come out the same both ways round.
+ */
+static int render_WallTest(r_wall_t *w1, r_wall_t *w2, mob_t *player)
 {
     double t1, t2;
     double px, py;
 
-    if(w1 == NULL || w2 == NULL || player == NULL) return 0;
-
     // If walls are in same sector + touching, they can't be blocking
     if(w1->sector == w2->sector)
     {
-        if(w1->v0 == w2->v1 || w1->v1 == w2->v0) return 1;
+        if(w1->v0 == w2->v1 || w1->v1 == w2->v0) return WALL_TIE;
     }
 
     // If wall Z values don't overlap, return closer one
@@ -408,8 +900,8 @@ int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player)
         t1 = t2;
         if(FEQ(t1, 0))
         {
-            // Parallel lines, return 1
-            return 1;
+            // Parallel lines
+            return WALL_TIE;
         }
     }
     // Wall2 Point 1 is on Wall1, so copy the valid xproduct over
@@ -436,8 +928,8 @@ int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player)
         t1 = t2;
         if(FEQ(t1, 0))
         {
-            // Parallel lines, return 1
-            return 1;
+            // Parallel lines
+            return WALL_TIE;
         }
     }
     // Wall2 Point 1 is on Wall1, so copy the valid xproduct over
@@ -454,9 +946,40 @@ int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player)
     }
 
     // Walls intersect
-    return 1;
+    return WALL_TIE;
+}
+
+
+/**
+ * Return 1 if w1 is in front of 2, or 0 otherwise.
+ * Assumes the screen X coordinates of the lines don't intersect.
+ * Walls that touch, are parallel or cross count as in front of each other.
+ */
+int render_WallFront(r_wall_t *w1, r_wall_t *w2, mob_t *player)
+{
+    if(w1 == NULL || w2 == NULL || player == NULL) return 0;
+
+    return render_WallTest(w1, w2, player) != 0;
 }
 
+/**
+ * Return 1 if w1 is drawn before w2. Always tests the pair the same
+ * way round, first by render_WallFirst(), and puts walls the test
+ * can't tell apart in that order, so exactly one of two walls is
+ * drawn before the other for one test. Then which wall is drawn next
+ * doesn't depend on the order the walls were queued in, and seeding
+ * the queue with last frame's order draws the same frame as starting
+ * from scratch.
+ */
+static int render_WallBefore(r_wall_t *w1, r_wall_t *w2, mob_t *player)
+{
+    int front;
+
+    if(render_WallFirst(w2, w1)) return !render_WallBefore(w2, w1, player);
+
+    front = render_WallTest(w1, w2, player);
+    return (front == WALL_TIE) ? 1 : front;
+}
 
 /**
  * Given a list of wall nodes, get the next one to render.
@@ -490,7 +1013,8 @@ r_wall_t *render_GetNextWall(r_wall_t **first, mob_t *player)
         }
 
         // Is next in front of this wall?
-        if(render_WallFront(next, compare, player))
+        ++_stats.wall_tests;
+        if(render_WallBefore(next, compare, player))
         {
             // Increment compare and keep going
             compare = compare->next;
@@ -504,10 +1028,16 @@ r_wall_t *render_GetNextWall(r_wall_t **first, mob_t *player)
         
     }
 
-    // IF we couldn't find any viable walls, just render front of wqueue
+    // IF we couldn't find any viable walls, the walls hide each other
+    // in a loop. Render the first of them by sector and index, so
+    // the queue order still doesn't matter.
     if(next == NULL)
     {
         next = *first;
+        for(compare = next->next; compare != NULL; compare = compare->next)
+        {
+            if(render_WallFirst(compare, next)) next = compare;
+        }
     }
 
     // Remove next from the queue
@@ -520,7 +1050,7 @@ r_wall_t *render_GetNextWall(r_wall_t **first, mob_t *player)
     return next;
 }
 
-void render_DrawWall(r_wall_t *wall, world_t *world, int *ytop, int *ybottom)
+void render_DrawWall(r_wall_t *wall, world_t *world, r_context_t *ctx)
 {
     xyz_t *t0, *t1;
     int32_t neighbor;
@@ -531,30 +1061,29 @@ void render_DrawWall(r_wall_t *wall, world_t *world, int *ytop, int *ybottom)
     int y0a, y1a, y0b, y1b, ny0a, ny1a, ny0b, ny1b;
     int beginx, endx;
     int u0, u1;
-    double pcos, psin;
+    int drawn = 0;
+    int *ytop, *ybottom;
+    r_span_t span;
 
-    if(wall == NULL || world == NULL || ytop == NULL || ybottom == NULL) return;
+    if(wall == NULL || world == NULL || ctx == NULL) return;
 
     t0 = &wall->t0; t1 = &wall->t1;
     x0 = wall->x0;  x1 = wall->x1;
     neighbor = wall->neighbor;
     sect = wall->sector;
-    player = &world->player;
+    player = ctx->camera;
+    ytop = ctx->ytop;  ybottom = ctx->ybottom;
     u0 = wall->u0, u1 = wall->u1;
     // Set up y scaling
     // NOTE protected against bounds checking when walls are added to the
     // rendering queue - all z positions <= 0 are clamped
-    yscale0 = _rsettings.vfov / t0->z;
-    yscale1 = _rsettings.vfov / t1->z;
+    yscale0 = ctx->vfov / t0->z;
+    yscale1 = ctx->vfov / t1->z;
 
     // Get floor/ceiling heights
     yceil  = sect->ceil  - (player->pos.z + player->height);
     yfloor = sect->floor - (player->pos.z + player->height);
 
-    // Get cos/sin
-    pcos = cos(player->direction);
-    psin = sin(player->direction);
-
     // If we have a neighbor, get the floor/ceiling heights
     if(neighbor >= 0)
     {
@@ -564,54 +1093,65 @@ void render_DrawWall(r_wall_t *wall, world_t *world, int *ytop, int *ybottom)
     }
 
     // Project our ceiling & floor
-    y0a = SCR_H/2 + (int)(-YAW(yceil, t0->z) * yscale0), y0b = SCR_H/2 + (int)(-YAW(yfloor, t0->z) * yscale0);
-    y1a = SCR_H/2 + (int)(-YAW(yceil, t1->z) * yscale1), y1b = SCR_H/2 + (int)(-YAW(yfloor, t1->z) * yscale1);
+    y0a = ctx->h/2 + (int)(-YAW(yceil, t0->z) * yscale0), y0b = ctx->h/2 + (int)(-YAW(yfloor, t0->z) * yscale0);
+    y1a = ctx->h/2 + (int)(-YAW(yceil, t1->z) * yscale1), y1b = ctx->h/2 + (int)(-YAW(yfloor, t1->z) * yscale1);
     // Repeat for neighboring sector
-    ny0a = SCR_H/2 + (int)(-YAW(nyceil, t0->z) * yscale0), ny0b = SCR_H/2 + (int)(-YAW(nyfloor, t0->z) * yscale0);
-    ny1a = SCR_H/2 + (int)(-YAW(nyceil, t1->z) * yscale1), ny1b = SCR_H/2 + (int)(-YAW(nyfloor, t1->z) * yscale1);
+    ny0a = ctx->h/2 + (int)(-YAW(nyceil, t0->z) * yscale0), ny0b = ctx->h/2 + (int)(-YAW(nyfloor, t0->z) * yscale0);
+    ny1a = ctx->h/2 + (int)(-YAW(nyceil, t1->z) * yscale1), ny1b = ctx->h/2 + (int)(-YAW(nyfloor, t1->z) * yscale1);
 
     // Start wall rendering
     beginx = MAX(x0, 0);
-    endx = MIN(x1, SCR_W);
+    endx = MIN(x1, ctx->w - 1);
     for(int x = beginx; x <= endx; ++x)
     {
         // Calculate persective-corrected pixel index in wall texture
         //    FROM wikipedia article on affine texture mapping
         int texture_idx = (u0*((x1-x)*t1->z) + u1*((x-x0)*t0->z)) / ((x1-x)*t1->z + (x-x0)*t0->z);
-        // Calc Z coordinate (only used for lighting)
-        int z = (t0->z*((x1-x)*t1->z) + t1->z*((x-x0)*t0->z)) / ((x1-x)*t1->z + (x-x0)*t0->z);
+        // Calc Z coordinate, for lighting and the depth buffer
+        double depth = (t0->z*((x1-x)*t1->z) + t1->z*((x-x0)*t0->z)) / ((x1-x)*t1->z + (x-x0)*t0->z);
+        int z = depth;
         if(z < 0) continue;
         // Get Y for ceiling & floor, clamped to occlusion array
         int ya = PointOnLine(x0, y0a, x1, y1a, x), cya = CLAMP(ya, ytop[x], ybottom[x]);
         int yb = PointOnLine(x0, y0b, x1, y1b, x), cyb = CLAMP(yb, ytop[x], ybottom[x]);
         // Check if occlusion array shows we're done with this x coord
         if(ybottom[x] - ytop[x] < 1) continue;
-
-        // Loop to draw ceiling and floor
-        for(int y = ytop[x]; y <= ybottom[x] && y < SCR_H; ++y)
+        drawn = 1;
+
+        // Ceiling above the wall and floor below it. Rows between
+        // a ceiling drawn below its floor count as floor
+        int yend = MIN(ybottom[x], ctx->h - 1);
+        span.x = x;
+        span.flat = 1;
+        span.brightness = sect->brightness;
+        span.sector = sect - world->sectors;
+        span.wall = -1;
+        if(IS_TEXTURE(sect->texture_ceil))
+        {
+            span.surface = SURFACE_CEILING;
+            span.y0 = ytop[x];
+            span.y1 = MIN(cya - 1, yend);
+            span.texture = sect->texture_ceil;
+            span.height = yceil;
+            render_span_emit(ctx, &span, NULL);
+        }
+        if(IS_TEXTURE(sect->texture_floor))
         {
-            // If we finish ceiling, switch to floor
-            if(y >= cya && y <= cyb) { y = cyb; continue; }
-            double height = (y < cya) ? yceil : yfloor;
-            double mapx, mapy;
-            int xi, yi;
-            int16_t ftx = (y < cya) ? sect->texture_ceil : sect->texture_floor;
-            if(!IS_TEXTURE(ftx)) continue;
-
-            image_t *ftexture = (y < cya) ? &_textures[sect->texture_ceil] : &_textures[sect->texture_floor];
-            render_screen_to_world(x, y, height, pcos, psin, player, &mapx, &mapy);
-            // yscale is for vertical scaling only,
-            // so use xscale even for the y. 
-            xi = mapx * ftexture->w / ftexture->xscale;
-            yi = mapy * ftexture->h / ftexture->xscale;
-            if(xi < 0) xi += ((-xi) / ftexture->w) * ftexture->w;
-            if(yi < 0) yi += ((-yi) / ftexture->h) * ftexture->h;
-            // Get depth for this floor/ceil piece
-            double tz = ((mapx - player->pos.x) * pcos) + ((mapy - player->pos.y) * psin);
-            // Draw the point
-            render_point_textured(x, y, (int)MAX(tz,0) * DIST_SHADE_MULT, ftexture, xi, yi, wall->sector->brightness);
+            span.surface = SURFACE_FLOOR;
+            span.y0 = MAX(cya, cyb + 1);
+            span.y1 = yend;
+            span.texture = sect->texture_floor;
+            span.height = yfloor;
+            render_span_emit(ctx, &span, NULL);
         }
 
+        // Everything else in the column is wall
+        span.flat = 0;
+        span.lod = (_rsettings.lod > 0 && depth > _rsettings.lod);
+        span.z = z;
+        span.idx = texture_idx;
+        span.wall = wall->index;
+        span.depth = depth;
         if(neighbor >= 0)
         {
             // Draw *their* floor and ceiling
@@ -621,107 +1161,536 @@ void render_DrawWall(r_wall_t *wall, world_t *world, int *ytop, int *ybottom)
             // Draw between our and their ceiling
             if(nyceil < yceil && IS_TEXTURE(wall->hi_texture) && nya > 0) 
             {
-                render_vline_textured_bitwise(x, cya, cnya, ya, nya, &_textures[wall->hi_texture],
-                                      sect->ceil - nbr->ceil, texture_idx, z, wall->sector->brightness);
+                span.y0 = cya; span.y1 = cnya;
+                span.ceil = ya; span.floor = nya;
+                span.texture = wall->hi_texture;
+                span.surface = SURFACE_UPPER;
+                span.height = sect->ceil - nbr->ceil;
+                render_span_emit(ctx, &span, &ctx->span_top[x]);
             }
             // Shrink remaining window below these ceilings
-            ytop[x] = CLAMP(MAX(cya, cnya), ytop[x], SCR_H-1);
+            ytop[x] = CLAMP(MAX(cya, cnya), ytop[x], ctx->h-1);
             // If our floor is lower than theirs, render bottom wall.
             // Between their and our wall
-            if(nyfloor > yfloor && IS_TEXTURE(wall->lo_texture) && nyb < (SCR_H - 1))
+            if(nyfloor > yfloor && IS_TEXTURE(wall->lo_texture) && nyb < (ctx->h - 1))
             {
-                render_vline_textured_bitwise(x, cnyb, cyb, nyb, yb, &_textures[wall->lo_texture], 
-                                      nbr->floor - sect->floor, texture_idx, z, wall->sector->brightness);
+                span.y0 = cnyb; span.y1 = cyb;
+                span.ceil = nyb; span.floor = yb;
+                span.texture = wall->lo_texture;
+                span.surface = SURFACE_LOWER;
+                span.height = nbr->floor - sect->floor;
+                render_span_emit(ctx, &span, &ctx->span_bottom[x]);
             }
             // Shrink the remaining window above these floors
             ybottom[x] = CLAMP(MIN(cyb, cnyb), 0, ybottom[x]);
         }
         else
         {
-            // No neighbor, draw wall
-            if(IS_TEXTURE(wall->texture))
-                render_vline_textured_bitwise(x, cya, cyb, ya, yb, &_textures[wall->texture], sect->ceil - sect->floor, texture_idx, z, wall->sector->brightness);
+            // No neighbor, draw wall. Walls past the far clip
+            // are all fog, whatever their texture
+            if(IS_TEXTURE(wall->texture) || wall->fogged)
+            {
+                span.y0 = cya; span.y1 = cyb;
+                span.ceil = ya; span.floor = yb;
+                span.texture = IS_TEXTURE(wall->texture) ? wall->texture : 0;
+                if(wall->fogged)
+                {
+                    span.lod = 1;
+                    span.brightness = 0;
+                }
+                span.surface = SURFACE_WALL;
+                span.height = sect->ceil - sect->floor;
+                render_span_emit(ctx, &span, NULL);
+            }
             ytop[x] = ybottom[x];
         }
+
+        // Nothing more can be drawn in the column
+        if(ybottom[x] - ytop[x] < 1)
+        {
+            ctx->cols_open[x >> 5] &= ~(1u << (x & 31));
+            --ctx->num_cols_open;
+        }
     }
+
+    if(drawn) ++_stats.walls_drawn;
 }
 
 /**
- * Convert a screen coordinate to a world one
+ * Take the rows [y0, y1] away from a buffered span, which is
+ * drawn before them
+ * @param i Index of the span, or SPAN_NONE
  */
-void inline render_screen_to_world(int sX, int sY, double mapY, double pcos, double psin, mob_t *player, double *mapX, double *mapZ)
+static void render_span_clip(uint32_t i, int y0, int y1)
 {
-    double tz, tx;
-    if(!mapX || !mapY) return;
-    *mapZ = mapY * _rsettings.vfov / (((SCR_H / 2) - sY) - (player->player->yaw * _rsettings.vfov));
-    *mapX = (*mapZ) * (sX - (SCR_W / 2)) / (_rsettings.hfov_angle * SCR_W);
-
-    tx = (*mapZ) * pcos + (*mapX) * psin;
-    tz = (*mapZ) * psin - (*mapX) * pcos;
-    *mapX = tx + player->pos.x;
-    *mapZ = tz + player->pos.y;
-}
+    r_span_t *old;
 
-/* ***********************************
- * Public function implementation
- * ***********************************/
+    if(i == SPAN_NONE) return;
+    old = &_spans[i];
+    if(old->y0 > y1 || old->y1 < y0) return;
+
+    if(old->y0 < y0 && old->y1 > y1)
+    {
+        // Rows left on both sides, so split off the lower ones
+        _spans[_num_spans] = *old;
+        _spans[_num_spans++].y0 = y1 + 1;
+        old->y1 = y0 - 1;
+    }
+    else if(old->y0 < y0)
+    {
+        old->y1 = y0 - 1;
+    }
+    else
+    {
+        // Empties the span if it is covered, which the flush skips
+        old->y0 = y1 + 1;
+    }
+}
 
 /**
- * Creates an SDL window
- * @return 0 on success
+ * Add a span to the buffer. The last wall drawn above or below the
+ * window of the column can share a row with the span, which is
+ * drawn later and so keeps it, as it would drawing straight away
+ * @param span Span in the coordinates of the view's rectangle
+ * @param edge Where to remember the span as bordering the
+ *             column's window, or NULL
  */
-int8_t render_init(int fullscreen)
+static void render_span_emit(r_context_t *ctx, const r_span_t *span, uint32_t *edge)
 {
-    SDL_Window *temp_window;
-    int imgFlags;
-    uint32_t wFlags;
+    r_span_t *out;
+
+    if(span->y0 > span->y1) return;
 
-    // Initialize SDL
-    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0)
+    // Room for the span and a piece split off an older one
+    if(_num_spans + 2 > _span_cap)
     {
-    	printf("Init error %s\n", SDL_GetError());
-    	return 1;
+        uint32_t cap = (_span_cap) ? _span_cap * 2 : SPAN_POOL_START;
+        r_span_t *spans = realloc(_spans, cap * sizeof(r_span_t));
+        uint32_t *order = (spans) ? realloc(_span_order, cap * sizeof(uint32_t)) : NULL;
+
+        if(spans) _spans = spans;
+        if(order) _span_order = order;
+        if(spans && order)
+        {
+            _span_cap = cap;
+        }
+        else
+        {
+            // Out of memory, so draw what we have to make room
+            render_span_flush();
+            if(_span_cap < 2) return;
+        }
     }
 
-    wFlags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE;
-    if(fullscreen) wFlags |= SDL_WINDOW_FULLSCREEN;
-    // Create window
-    temp_window = SDL_CreateWindow("TestName", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-    		SCR_W, SCR_H, wFlags);
-    if(temp_window == NULL)
+    render_span_clip(ctx->span_top[span->x], span->y0 + ctx->y, span->y1 + ctx->y);
+    render_span_clip(ctx->span_bottom[span->x], span->y0 + ctx->y, span->y1 + ctx->y);
+
+    // Moved onto the screen, so the raster pass can fill
+    // the spans of every view together
+    out = &_spans[_num_spans];
+    *out = *span;
+    out->x += ctx->x;
+    out->y0 += ctx->y;
+    out->y1 += ctx->y;
+    if(!span->flat)
     {
-    	printf("No window %s\n", SDL_GetError());
-    	return -1;
+        out->ceil += ctx->y;
+        out->floor += ctx->y;
     }
+    out->view = ctx - _contexts;
+    if(edge) *edge = _num_spans;
+    ++_num_spans;
+    ++_stats.spans;
+}
+
+/**
+ * Fill a floor or ceiling span, mapping each pixel back onto the plane
+ */
+static void render_span_flat(const r_span_t *span)
+{
+    r_context_t *ctx = &_contexts[span->view];
+    mob_t *player = ctx->camera;
+    image_t *ftexture = &_textures[span->texture];
+    // Past here, pixels are all fog or drawn in a flat color
+    double solid = (_rsettings.lod > 0) ? _rsettings.lod : _rsettings.far;
 
-    _window = temp_window;
+    if(_rsettings.far > 0) solid = MIN(solid, _rsettings.far);
 
-    // Create renderer
-    _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if(_renderer == NULL)
+    for(int y = span->y0; y <= span->y1; ++y)
     {
-        _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_SOFTWARE);
-        if(_renderer == NULL)
+        double mapx, mapy;
+        int xi, yi;
+
+        if(solid > 0)
         {
-            printf("Can't make renderer: %s\n", SDL_GetError());
-            return -1;
+            // Depth along the view direction, without the
+            // trip through map coordinates
+            double d = span->height * ctx->vfov / (((ctx->h / 2) - (y - ctx->y)) - (ctx->yaw * ctx->vfov));
+            if(d > solid)
+            {
+                render_point_solid(span->x, y, (int)d * DIST_SHADE_MULT, ftexture, span->brightness);
+                if(_pick_depth) _pick_depth[(y * SCR_W) + span->x] = d;
+                continue;
+            }
         }
-    }
 
-    SDL_RenderSetLogicalSize(_renderer, SCR_W, SCR_H);
+        render_screen_to_world(ctx, span->x - ctx->x, y - ctx->y, span->height, &mapx, &mapy);
+        // yscale is for vertical scaling only,
+        // so use xscale even for the y. 
+        xi = mapx * ftexture->w / ftexture->xscale;
+        yi = mapy * ftexture->h / ftexture->xscale;
+        if(xi < 0) xi += ((-xi) / ftexture->w) * ftexture->w;
+        if(yi < 0) yi += ((-yi) / ftexture->h) * ftexture->h;
+        // Get depth for this floor/ceil piece
+        double tz = ((mapx - player->pos.x) * ctx->pcos) + ((mapy - player->pos.y) * ctx->psin);
+        // Draw the point
+        render_point_textured(span->x, y, (int)MAX(tz,0) * DIST_SHADE_MULT, ftexture, xi, yi, span->brightness);
+        if(_pick_depth) _pick_depth[(y * SCR_W) + span->x] = MAX(tz, 0);
+    }
+}
 
-    // Set render color to white
-    SDL_SetRenderDrawColor(_renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+/**
+ * Record what a span covers in the pick buffers. Floors and ceilings
+ * set their own depth as they are filled.
+ */
+static void render_span_pick(const r_span_t *span)
+{
+    r_pick_id_t id = {span->sector, span->wall, span->surface};
 
-    _screen_buffer = SDL_CreateTexture(_renderer, SDL_GetWindowPixelFormat(_window),
-                                          SDL_TEXTUREACCESS_STREAMING,
-                                          SCR_W, SCR_H);
-    if(_screen_buffer == NULL)
+    for(int y = MAX(span->y0, 0); y <= MIN(span->y1, SCR_H - 1); ++y)
     {
-        printf("Can't make screen buffer: %s\n", SDL_GetError());
+        _pick_id[(y * SCR_W) + span->x] = id;
+        if(!span->flat) _pick_depth[(y * SCR_W) + span->x] = span->depth;
+    }
+}
+
+/**
+ * Raster pass. Counting sorts the buffered spans by texture, keeping
+ * the order they were emitted in within each texture, then fills
+ * them so each texture is read in one go rather than once per wall,
+ * or once per view. Spans never overlap, so the order doesn't change
+ * the frame.
+ */
+static void render_span_flush(void)
+{
+    uint32_t start[NUM_TEXTURES + 1] = {0};
+    uint32_t i;
+
+    if(_num_spans > 0)
+    {
+        for(i = 0; i < _num_spans; ++i) ++start[_spans[i].texture + 1];
+        for(i = 0; i < NUM_TEXTURES; ++i) start[i + 1] += start[i];
+        for(i = 0; i < _num_spans; ++i) _span_order[start[_spans[i].texture]++] = i;
+
+        for(i = 0; i < _num_spans; ++i)
+        {
+            const r_span_t *span = &_spans[_span_order[i]];
+
+            if(span->y0 > span->y1) continue;
+            if(_pick_depth) render_span_pick(span);
+            if(span->flat)
+            {
+                render_span_flat(span);
+            }
+            else if(span->lod)
+            {
+                render_vline_solid(span->x, span->y0, span->y1, &_textures[span->texture],
+                                   span->z, span->brightness);
+            }
+            else if(_backend != RENDER_BACKEND_GEOMETRY || render_geom_span(span) != 0)
+            {
+                render_vline_textured_bitwise(span->x, span->y0, span->y1, span->ceil, span->floor,
+                                              &_textures[span->texture], span->height,
+                                              span->idx, span->z, span->brightness);
+            }
+        }
+    }
+
+    // Anything emitted now is drawn after these spans anyway
+    _num_spans = 0;
+    for(i = 0; i < RENDER_MAX_VIEWS; ++i)
+    {
+        for(int x = 0; x < SCR_W; ++x)
+        {
+            _contexts[i].span_top[x] = SPAN_NONE;
+            _contexts[i].span_bottom[x] = SPAN_NONE;
+        }
+    }
+}
+
+/**
+ * Make room for /quads more quads in a texture's geometry
+ * @return 0 on success, -1 if out of memory
+ */
+static int render_geom_reserve(r_geom_t *geom, uint32_t quads)
+{
+    uint32_t cap = MAX(geom->cap, GEOM_QUADS_START);
+    SDL_Vertex *verts;
+    int *indices;
+
+    if(geom->num_quads + quads <= geom->cap) return 0;
+
+    while(cap < geom->num_quads + quads) cap *= 2;
+    verts = realloc(geom->verts, cap * 4 * sizeof(SDL_Vertex));
+    if(verts == NULL) return -1;
+    geom->verts = verts;
+    indices = realloc(geom->indices, cap * 6 * sizeof(int));
+    if(indices == NULL) return -1;
+    geom->indices = indices;
+    geom->cap = cap;
+
+    return 0;
+}
+
+/**
+ * Add a wall span to its texture's geometry: a one pixel wide quad
+ * for each time the texture repeats down the column, shaded through
+ * its vertex colors. The column is cleared in the screen buffer, which
+ * is added onto the geometry, so the wall shows through it.
+ * @return 0 on success, -1 if the span has to be drawn by the CPU
+ *         instead, as it is out of memory or the texture repeats
+ *         more than once a row
+ */
+static int render_geom_span(const r_span_t *span)
+{
+    const image_t *texture = &_textures[span->texture];
+    r_geom_t *geom = &_geom[span->texture];
+    uint8_t mod = render_shade(span->z, span->brightness);
+    SDL_Color color = {mod, mod, mod, 0xFF};
+    int y0 = MAX(span->y0, 0), y1 = MIN(span->y1, SCR_H - 1);
+    int bottom = (span->floor == span->ceil) ? span->floor + 1 : span->floor;
+    // Texel rows per screen row, counting up from the floor
+    double scale = ((span->height * texture->h) / texture->yscale) / (bottom - span->ceil);
+    // Texel rows at the top and bottom edges of the span. Rows are
+    // sampled at their centers, which land where the CPU samples them.
+    double vtop = (bottom - y0 + 0.5) * scale, vbottom = (bottom - y1 - 0.5) * scale;
+    float u = ((span->idx % texture->w) + 0.5f) / texture->w;
+    int32_t k0 = 0, k1 = 0;
+
+    if(scale > 0)
+    {
+        k0 = (int32_t)floor(vbottom / texture->h);
+        k1 = (int32_t)ceil(vtop / texture->h) - 1;
+    }
+    else
+    {
+        vtop = vbottom = 0;
+    }
+    if(k1 - k0 >= y1 - y0 + 1 || render_geom_reserve(geom, k1 - k0 + 1) != 0) return -1;
+
+    for(int32_t k = k0; k <= k1; ++k)
+    {
+        SDL_Vertex *v = &geom->verts[geom->num_quads * 4];
+        int *idx = &geom->indices[geom->num_quads * 6];
+        double vlo = MAX(vbottom, (double)k * texture->h), vhi = MIN(vtop, (double)(k + 1) * texture->h);
+        // The ends are kept exact, and the edges between repeats are
+        // worked out the same way for both quads sharing them
+        float ya = (k == k1) ? y0 : (float)(bottom + 0.5 - (vhi / scale));
+        float yb = (k == k0) ? y1 + 1 : (float)(bottom + 0.5 - (vlo / scale));
+        float ta = (vhi / texture->h) - k, tb = (vlo / texture->h) - k;
+        int n = geom->num_quads * 4;
+
+        v[0] = (SDL_Vertex){{span->x, ya}, color, {u, ta}};
+        v[1] = (SDL_Vertex){{span->x + 1, ya}, color, {u, ta}};
+        v[2] = (SDL_Vertex){{span->x + 1, yb}, color, {u, tb}};
+        v[3] = (SDL_Vertex){{span->x, yb}, color, {u, tb}};
+        idx[0] = n;  idx[1] = n + 1;  idx[2] = n + 2;
+        idx[3] = n;  idx[4] = n + 2;  idx[5] = n + 3;
+        ++geom->num_quads;
+    }
+
+    for(int y = y0; y <= y1; ++y)
+    {
+        _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + span->x] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Draw the wall geometry batched up this frame, one
+ * SDL_RenderGeometry() call per texture
+ */
+static void render_geom_submit(void)
+{
+    for(int i = 0; i < NUM_TEXTURES; ++i)
+    {
+        r_geom_t *geom = &_geom[i];
+
+        if(geom->num_quads == 0) continue;
+
+        // Shading is in the vertex colors
+        SDL_SetTextureColorMod(_textures[i].img, 0xFF, 0xFF, 0xFF);
+        SDL_SetTextureBlendMode(_textures[i].img, SDL_BLENDMODE_NONE);
+        if(SDL_RenderGeometry(_renderer, _textures[i].img, geom->verts, geom->num_quads * 4,
+                              geom->indices, geom->num_quads * 6) != 0)
+        {
+            printf("Can't draw wall geometry: %s\n", SDL_GetError());
+        }
+        ++_stats.draw_calls;
+        geom->num_quads = 0;
+    }
+}
+
+/**
+ * Get the light level of a texel: the sector's brightness, less its
+ * distance, fading out to nothing over the last stretch before the
+ * far clip
+ * @param z Distance of the texel
+ */
+static inline uint8_t render_shade(uint32_t z, uint8_t brightness)
+{
+    uint8_t mod = MIN(z, 0xE0);
+    mod = (mod > brightness) ? 0 : brightness - mod;
+
+    if(_rsettings.far > 0 && z > _rsettings.fog)
+    {
+        mod = (z >= _rsettings.far) ? 0 : mod * (_rsettings.far - z) / (_rsettings.far - _rsettings.fog);
+    }
+
+    return mod;
+}
+
+/**
+ * Convert a coordinate within a view's rectangle to a world one
+ */
+void inline render_screen_to_world(r_context_t *ctx, int sX, int sY, double mapY, double *mapX, double *mapZ)
+{
+    double tz, tx;
+    if(!mapX || !mapZ) return;
+    *mapZ = mapY * ctx->vfov / (((ctx->h / 2) - sY) - (ctx->yaw * ctx->vfov));
+    *mapX = (*mapZ) * (sX - (ctx->w / 2)) / ctx->xscale;
+
+    tx = (*mapZ) * ctx->pcos + (*mapX) * ctx->psin;
+    tz = (*mapZ) * ctx->psin - (*mapX) * ctx->pcos;
+    *mapX = tx + ctx->camera->pos.x;
+    *mapZ = tz + ctx->camera->pos.y;
+}
+
+/**
+ * Work out the average color of a texture, its stand in when
+ * drawn too far away for its texels to be told apart
+ */
+static void render_average_color(image_t *image)
+{
+    uint64_t r = 0, g = 0, b = 0, n = (uint64_t)image->w * image->h;
+
+    for(uint32_t y = 0; y < image->h; ++y)
+    {
+        for(uint32_t x = 0; x < image->w; ++x)
+        {
+            uint8_t pr, pg, pb;
+            SDL_GetRGB(image->pix[(y * image->pitch / sizeof(uint32_t)) + x], _fmt, &pr, &pg, &pb);
+            r += pr;  g += pg;  b += pb;
+        }
+    }
+
+    image->avg = (n > 0) ? SDL_MapRGBA(_fmt, r / n, g / n, b / n, 0xFF) : 0;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Creates an SDL window
+ * @return 0 on success
+ */
+int8_t render_init(int fullscreen)
+{
+    return render_init_ex(fullscreen, 0);
+}
+
+/**
+ * Creates an SDL window, or an offscreen surface to draw to
+ * @param[in] fullscreen Start the window fullscreen
+ * @param[in] flags RENDER_INIT_* flags
+ * @return 0 on success
+ */
+int8_t render_init_ex(int fullscreen, uint32_t flags)
+{
+    SDL_Window *temp_window;
+    int imgFlags;
+    uint32_t wFlags;
+    uint32_t format;
+
+    _window = NULL;
+    _target = NULL;
+
+    if(flags & RENDER_INIT_OFFSCREEN)
+    {
+        // No window, so no video subsystem or vsync either
+        if(SDL_Init(0) < 0)
+        {
+            printf("Init error %s\n", SDL_GetError());
+            return 1;
+        }
+
+        format = SDL_PIXELFORMAT_RGB888;
+        _target = SDL_CreateRGBSurfaceWithFormat(0, SCR_W, SCR_H, 32, format);
+        if(_target == NULL)
+        {
+            printf("Can't make offscreen surface: %s\n", SDL_GetError());
+            return -1;
+        }
+
+        _renderer = SDL_CreateSoftwareRenderer(_target);
+        if(_renderer == NULL)
+        {
+            printf("Can't make renderer: %s\n", SDL_GetError());
+            return -1;
+        }
+    }
+    else
+    {
+        // Initialize SDL
+        if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0)
+        {
+            printf("Init error %s\n", SDL_GetError());
+            return 1;
+        }
+
+        wFlags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE;
+        if(fullscreen) wFlags |= SDL_WINDOW_FULLSCREEN;
+        // Create window
+        temp_window = SDL_CreateWindow("TestName", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                SCR_W, SCR_H, wFlags);
+        if(temp_window == NULL)
+        {
+            printf("No window %s\n", SDL_GetError());
+            return -1;
+        }
+
+        _window = temp_window;
+        format = SDL_GetWindowPixelFormat(_window);
+
+        // Create renderer
+        _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if(_renderer == NULL)
+        {
+            _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_SOFTWARE);
+            if(_renderer == NULL)
+            {
+                printf("Can't make renderer: %s\n", SDL_GetError());
+                return -1;
+            }
+        }
+    }
+
+    SDL_RenderSetLogicalSize(_renderer, SCR_W, SCR_H);
+
+    // Set render color to white
+    SDL_SetRenderDrawColor(_renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    _screen_buffer = SDL_CreateTexture(_renderer, format,
+                                          SDL_TEXTUREACCESS_STREAMING,
+                                          SCR_W, SCR_H);
+    if(_screen_buffer == NULL)
+    {
+        printf("Can't make screen buffer: %s\n", SDL_GetError());
     }
     SDL_SetTextureBlendMode(_screen_buffer, SDL_BLENDMODE_ADD);
-    _fmt = SDL_AllocFormat(SDL_GetWindowPixelFormat(_window));
+    _fmt = SDL_AllocFormat(format);
     _scr_pix = NULL;
     _scr_pitch = 0;
 
@@ -744,6 +1713,7 @@ int8_t render_init(int fullscreen)
             return -1;
         }
         SDL_QueryTexture(_textures[i].img, NULL, NULL, &_textures[i].w, &_textures[i].h);
+        render_average_color(&_textures[i]);
     }
     // Load skybox
     _skybox.img = render_load_texture(SKYBOX_NAME, &_skybox.pix, &_skybox.pitch);
@@ -758,6 +1728,7 @@ int8_t render_init(int fullscreen)
     _rsettings.hfov_angle = HFOV_DEFAULT;
     _rsettings.hfov = HFOV_DEFAULT * SCR_W;
     _rsettings.vfov = VFOV_DEFAULT * SCR_H;
+    render_set_distances(0, 0);
 
     return 0;
 }
@@ -768,7 +1739,8 @@ int8_t render_init(int fullscreen)
  */
 int8_t render_close(void)
 {
-    SDL_DestroyWindow(_window);
+    if(_window) SDL_DestroyWindow(_window);
+    if(_target) SDL_FreeSurface(_target);
 
     for(int i = 0; i < NUM_TEXTURES; ++i)
     {
@@ -777,7 +1749,27 @@ int8_t render_close(void)
     }
     if(_skybox.img) SDL_DestroyTexture(_skybox.img);
     if(_skybox.pix) free(_skybox.pix);
+    framering_close();
+    render_reset_views();
+    for(int i = 0; i < NUM_TEXTURES; ++i)
+    {
+        free(_geom[i].verts);
+        free(_geom[i].indices);
+        memset(&_geom[i], 0, sizeof(r_geom_t));
+    }
+    free(_spans);
+    free(_span_order);
+    free(sector_views);
+    sector_views = NULL;
+    _sector_view_cap = 0;
+    render_set_pick(0);
+    render_set_palette(0);
+    _spans = NULL;
+    _span_order = NULL;
+    _num_spans = 0;
+    _span_cap = 0;
     _window = NULL;
+    _target = NULL;
     _renderer = NULL;
     SDL_Quit();
 
@@ -889,6 +1881,28 @@ int8_t render_draw_screen(void)
     return 0;
 }
 
+/**
+ * Write the last frame drawn to a BMP file. Only frames drawn
+ * offscreen can be saved, as the window's can't be read back.
+ * @param[in] filename The file to write
+ * @return 0 on success
+ */
+int8_t render_save_frame(const char *filename)
+{
+    if(_target == NULL)
+    {
+        printf("Only frames drawn offscreen can be saved\n");
+        return -1;
+    }
+    if(SDL_SaveBMP(_target, filename) != 0)
+    {
+        printf("Can't write %s: %s\n", filename, SDL_GetError());
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Delay /ticks milliseconds
  * @param[in] ticks
@@ -964,8 +1978,7 @@ int8_t render_vline_textured(uint32_t x, uint32_t y0, uint32_t y1,
     SDL_Rect src, dst;
     int h, highest = y1;
     // Set color correction
-    uint8_t mod = MIN(z, 0xE0);
-    mod = (mod > brightness) ? 0 : brightness - mod;
+    uint8_t mod = render_shade(z, brightness);
     SDL_SetTextureColorMod(texture->img, mod, mod, mod);
 
     src.w = 1;
@@ -1026,14 +2039,26 @@ int8_t render_vline_textured_bitwise(
                             uint32_t idx, uint16_t z, uint8_t brightness)
 {
     // Set color correction
-    uint8_t mod = MIN(z, 0xE0);
-    mod = (mod > brightness) ? 0 : brightness - mod;
+    uint8_t mod = render_shade(z, brightness);
     // Set the range for y indices
     int32_t u1 = (height * texture->h) / texture->yscale;
     // Clamp idx
     y0 = MAX(0, y0);
     y1 = MIN(SCR_H - 1, y1);
     idx = idx % texture->w;
+    if(texture->pix8)
+    {
+        // Shading is folded into the colormap
+        const uint32_t *cmap = _colormap[mod >> COLORMAP_SHIFT];
+        const uint8_t *column = &texture->pix8[idx];
+
+        for(uint32_t y = y0; y <= y1; ++y)
+        {
+            uint32_t u = PointOnLine(floor, 0, ceil, u1, (int32_t)y) % texture->h;
+            _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + x] = cmap[column[u * texture->w]];
+        }
+        return 1;
+    }
     for(uint32_t y = y0; y <= y1; ++y)
     {
         uint8_t r,g,b;
@@ -1056,8 +2081,7 @@ int8_t render_point_textured(uint32_t x, uint32_t y, uint32_t z,
     // Set color correction
     uint32_t pixel;
     uint8_t r, g, b;
-    uint8_t mod = MIN(z, 0xE0);
-    mod = (mod > brightness) ? 0 : brightness - mod;
+    uint8_t mod = render_shade(z, brightness);
 
     x = CLAMP(x, 0, SCR_W - 1);
     y = CLAMP(y, 0, SCR_H - 1);
@@ -1066,6 +2090,13 @@ int8_t render_point_textured(uint32_t x, uint32_t y, uint32_t z,
     tx = tx % texture->w;
     ty = ty % texture->h;
 
+    if(texture->pix8)
+    {
+        _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + x] =
+            _colormap[mod >> COLORMAP_SHIFT][texture->pix8[(ty * texture->w) + tx]];
+        return 1;
+    }
+
     // Get colors
     SDL_GetRGB(texture->pix[(ty * texture->pitch / sizeof(uint32_t)) + tx],
                 _fmt, &r, &g, &b);
@@ -1079,6 +2110,50 @@ int8_t render_point_textured(uint32_t x, uint32_t y, uint32_t z,
     return 1;
 }
 
+/**
+ * Draw a column in the average color of a texture, for surfaces
+ * too far away for their texels to matter
+ */
+int8_t render_vline_solid(uint32_t x, uint32_t y0, uint32_t y1,
+                          image_t *texture, uint16_t z, uint8_t brightness)
+{
+    uint8_t r, g, b;
+    uint8_t mod = render_shade(z, brightness);
+    uint32_t pixel;
+
+    y0 = MAX(0, y0);
+    y1 = MIN(SCR_H - 1, y1);
+
+    SDL_GetRGB(texture->avg, _fmt, &r, &g, &b);
+    pixel = SDL_MapRGBA(_fmt, r * mod / 0xFF, g * mod / 0xFF, b * mod / 0xFF, 0xFF);
+    for(uint32_t y = y0; y <= y1; ++y)
+    {
+        _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + x] = pixel;
+    }
+
+    return 1;
+}
+
+/**
+ * Draw a single point in the average color of a texture
+ */
+int8_t render_point_solid(uint32_t x, uint32_t y, uint32_t z,
+                          image_t *texture, uint8_t brightness)
+{
+    uint8_t r, g, b;
+    uint8_t mod = render_shade(z, brightness);
+
+    x = CLAMP(x, 0, SCR_W - 1);
+    y = CLAMP(y, 0, SCR_H - 1);
+
+    SDL_GetRGB(texture->avg, _fmt, &r, &g, &b);
+    r = r * mod / 0xFF;
+    g = g * mod / 0xFF;
+    b = b * mod / 0xFF;
+    _scr_pix[(y * _scr_pitch / sizeof(uint32_t)) + x] = SDL_MapRGBA(_fmt, r,g,b,0xFF);
+    return 1;
+}
+
 int8_t render_draw_point(uint32_t x, uint32_t y, uint32_t color)
 {
     uint8_t r, g, b;
@@ -1106,76 +2181,492 @@ void render_toggle_debug(void)
  */
 void render_set_fullscreen(int fs)
 {
+    if(_window == NULL) return;
     SDL_SetWindowFullscreen(_window, (fs) ? SDL_WINDOW_FULLSCREEN : 0);
 }
 
 /**
- * Draw the game world
+ * Draw the game world from the player's eyes, across the whole screen
  */
 int8_t render_draw_world(void)
+{
+    render_view_t view = {&(world_get_world()->player), 0, 0, SCR_W, SCR_H};
+
+    return render_draw_views(&view, 1);
+}
+
+/**
+ * Draw the game world from several cameras, each into its own
+ * rectangle of the screen. The views are worked out one at a time,
+ * but their spans are filled together in one raster pass, so each
+ * texture is read once a frame however many views show it.
+ * @param views Cameras and their rectangles. Views are matched to
+ *              last frame's by their place in the list
+ * @param count Number of views, up to RENDER_MAX_VIEWS
+ * @return 0 on success, -1 if a view has no camera or doesn't fit
+ *         on the screen
+ */
+int8_t render_draw_views(const render_view_t *views, uint32_t count)
 {
     // Get game world data
     world_t *world = world_get_world();
-    mob_t *player = &(world->player);
-
-    //int ytop[SCR_W], ybottom[SCR_W];
+    render_stats_t total;
     uint32_t i;
-    uint32_t bg;
-    r_wall_t *wqueue = NULL;
-    int numPix;
     void *pix;
 
-    if(ytop == NULL)
+    if(views == NULL || count == 0 || count > RENDER_MAX_VIEWS)
     {
-        ytop = malloc(SCR_W * sizeof(int));
+        printf("Can't draw %u views at once\n", count);
+        return -1;
     }
-    if(ybottom == NULL)
+    for(i = 0; i < count; ++i)
     {
-        ybottom = malloc(SCR_W * sizeof(int));
-    }
+        const render_view_t *v = &views[i];
 
-    // Start with preprocessing
-    wqueue = render_PreProcess(world);
+        if(v->camera == NULL || v->camera->sector >= world->numSectors)
+        {
+            printf("View %u has no camera in the world\n", i);
+            return -1;
+        }
+        if(v->x < 0 || v->y < 0 || v->w < 2 || v->h < 2 || v->x + v->w > SCR_W || v->y + v->h > SCR_H)
+        {
+            printf("View %u doesn't fit on the screen\n", i);
+            return -1;
+        }
+    }
 
-    // Set up occlusion arrays
-    for(int i = 0; i < SCR_W; ++i)
+    memset(&total, 0, sizeof(total));
+    _num_spans = 0;
+    if(_pick_depth)
     {
-        ytop[i] = 0;
-        ybottom[i] = SCR_H - 1;
+        r_pick_id_t none = {-1, -1, SURFACE_NONE};
+        for(int i = 0; i < SCR_W * SCR_H; ++i)
+        {
+            _pick_depth[i] = INFINITY;
+            _pick_id[i] = none;
+        }
     }
 
-    bg = SDL_MapRGBA(_fmt, 0, 0, 0, 0);
-    if(SDL_LockTexture(_screen_buffer, NULL, &pix, &_scr_pitch) != 0)
+    // Frames being published are drawn straight into the frame ring
+    if(framering_active())
+    {
+        pix = framering_begin(&_scr_pitch);
+    }
+    else if(SDL_LockTexture(_screen_buffer, NULL, &pix, &_scr_pitch) != 0)
     {
         printf("Can't stream to texture\n");
     }
     _scr_pix = (uint32_t *)pix;
-    //for(i = 0; i < (_scr_pitch / sizeof(uint32_t)) * SCR_H; ++i)
-    //{
-    //    _scr_pix[i] = bg;
-    //}
 
     // Reset the whole screen
-    render_draw_skybox(player);
     render_reset_screen();
 
-    while(wqueue != NULL)
+    for(i = 0; i < count; ++i)
+    {
+        memset(&_stats, 0, sizeof(_stats));
+        render_draw_view(&_contexts[i], &views[i], world);
+
+        total.sectors += _stats.sectors;
+        total.walls_considered += _stats.walls_considered;
+        total.walls_queued += _stats.walls_queued;
+        total.walls_drawn += _stats.walls_drawn;
+        total.walls_occluded += _stats.walls_occluded;
+        total.wall_tests += _stats.wall_tests;
+        total.spans += _stats.spans;
+    }
+    _stats = total;
+
+    // Fill in everything the walls left in the span buffer
+    render_span_flush();
+    // Walls batched as geometry go under the screen buffer
+    render_geom_submit();
+
+    // Blit screen buffer to the screen
+    if(framering_active())
+    {
+        SDL_UpdateTexture(_screen_buffer, NULL, _scr_pix, _scr_pitch);
+        framering_publish();
+    }
+    else
+    {
+        SDL_UnlockTexture(_screen_buffer);
+    }
+    _scr_pix = NULL;
+    SDL_RenderCopy(_renderer, _screen_buffer, NULL, NULL);
+
+    debugging = 0;
+    render_draw_screen();
+
+    return 0;
+}
+
+/**
+ * Work out what a camera sees and hand it to the span buffer,
+ * counting into the frame's stats
+ * @param ctx State kept for the view between frames
+ */
+static void render_draw_view(r_context_t *ctx, const render_view_t *view, world_t *world)
+{
+    mob_t *player = view->camera;
+    r_wall_t *wqueue = NULL;
+    uint32_t i;
+    int replay;
+
+    // Last frame's walls don't fit another camera or rectangle
+    if(ctx->camera != player || ctx->x != view->x || ctx->y != view->y
+       || ctx->w != view->w || ctx->h != view->h)
+    {
+        ctx->view.valid = 0;
+        ctx->view.num_order = 0;
+    }
+    ctx->camera = player;
+    ctx->x = view->x;  ctx->y = view->y;
+    ctx->w = view->w;  ctx->h = view->h;
+    ctx->yaw = (player->player) ? player->player->yaw : 0;
+    ctx->pcos = cos(player->direction);
+    ctx->psin = sin(player->direction);
+    // Scaled with the width, so narrower views see as far to the
+    // sides and shorter ones see less up and down
+    ctx->xscale = _rsettings.hfov_angle * ctx->w;
+    ctx->vfov = _rsettings.vfov * ((double)ctx->w / SCR_W);
+
+    // Start with preprocessing. When nothing has moved since the last
+    // frame the walls it drew are drawn again, in the same order
+    replay = render_view_same(ctx, world);
+    if(!replay)
+    {
+        wqueue = render_PreProcess(world, ctx);
+        render_view_sort(ctx, &wqueue, world);
+        ctx->view.valid = 0;
+        ctx->view.num_order = 0;
+    }
+
+    // Set up occlusion arrays
+    for(int x = 0; x < ctx->w; ++x)
+    {
+        ctx->ytop[x] = 0;
+        ctx->ybottom[x] = ctx->h - 1;
+        ctx->span_top[x] = SPAN_NONE;
+        ctx->span_bottom[x] = SPAN_NONE;
+    }
+    memset(ctx->cols_open, 0, sizeof(ctx->cols_open));
+    for(int x = 0; x < ctx->w; ++x) ctx->cols_open[x >> 5] |= 1u << (x & 31);
+    ctx->num_cols_open = ctx->w;
+
+    render_draw_skybox(ctx);
+
+    if(replay)
     {
-        // Get the next valid wall and draw it
+        _stats = ctx->view.stats;
+        _stats.walls_drawn = 0;
+        _stats.wall_tests = 0;
+        _stats.spans = 0;
+        for(i = 0; i < ctx->view.num_order; ++i)
+        {
+            render_DrawWall(ctx->view.order[i], world, ctx);
+        }
+    }
+
+    // Stop as soon as every column is closed
+    while(wqueue != NULL && ctx->num_cols_open > 0)
+    {
+        // Get the next valid wall and draw it, unless everything
+        // behind its columns is hidden already
         r_wall_t *next = render_GetNextWall(&wqueue, player);
 
-        render_DrawWall(next, world, ytop, ybottom);
+        if(next && !render_cols_open(ctx, next->x0, next->x1))
+        {
+            ++_stats.walls_occluded;
+            continue;
+        }
+        if(next && ctx->view.num_order < MAX_WALLS) ctx->view.order[ctx->view.num_order++] = next;
+        render_DrawWall(next, world, ctx);
         if(debugging)
         {
+            render_span_flush();
             SDL_RenderPresent(_renderer);
             SDL_Delay(500);
         }
     }
-    // Blit screen buffer to the screen
-    _scr_pix = NULL;
-    SDL_UnlockTexture(_screen_buffer);
-    SDL_RenderCopy(_renderer, _screen_buffer, NULL, NULL);
+    // Walls left once the screen filled up
+    for(r_wall_t *left = wqueue; left != NULL; left = left->next) ++_stats.walls_occluded;
+    if(!replay)
+    {
+        ctx->view.stats = _stats;
+        render_view_save(ctx, world);
+    }
+}
 
-    debugging = 0;
-    render_draw_screen();
-}
\ No newline at end of file
+/**
+ * Get the counters for the last frame drawn
+ * @param[out] stats The counters
+ */
+void render_get_stats(render_stats_t *stats)
+{
+    if(stats) *stats = _stats;
+}
+
+/**
+ * Keep a depth and id buffer alongside the frame, so what is on
+ * screen can be looked up with render_pick() instead of cast for
+ * @param enable Nonzero to keep the buffers, zero to free them
+ * @return 0 on success
+ */
+int8_t render_set_pick(int enable)
+{
+    if(!enable)
+    {
+        free(_pick_depth);
+        free(_pick_id);
+        _pick_depth = NULL;
+        _pick_id = NULL;
+        return 0;
+    }
+    if(_pick_depth) return 0;
+
+    _pick_depth = malloc(SCR_W * SCR_H * sizeof(float));
+    _pick_id = malloc(SCR_W * SCR_H * sizeof(r_pick_id_t));
+    if(_pick_depth == NULL || _pick_id == NULL)
+    {
+        printf("Out of memory for the pick buffers\n");
+        render_set_pick(0);
+        return -1;
+    }
+
+    // Nothing drawn yet
+    for(int i = 0; i < SCR_W * SCR_H; ++i)
+    {
+        _pick_depth[i] = INFINITY;
+        _pick_id[i].sector = -1;
+        _pick_id[i].wall = -1;
+        _pick_id[i].surface = SURFACE_NONE;
+    }
+
+    return 0;
+}
+
+/**
+ * Look up what the last frame drew at a pixel
+ * @param[out] pick What is there and how far away
+ * @return 0 on success, -1 if the buffers aren't kept or the
+ *         pixel is off the screen
+ */
+int8_t render_pick(uint32_t x, uint32_t y, render_pick_t *pick)
+{
+    const r_pick_id_t *id;
+
+    if(pick == NULL || _pick_depth == NULL || x >= SCR_W || y >= SCR_H) return -1;
+
+    id = &_pick_id[(y * SCR_W) + x];
+    pick->sector = id->sector;
+    pick->wall = id->wall;
+    pick->surface = id->surface;
+    pick->depth = _pick_depth[(y * SCR_W) + x];
+
+    return 0;
+}
+
+/**
+ * Get the depth buffer of the last frame
+ * @return SCR_W * SCR_H distances along the view direction, row by
+ *         row, or NULL if render_set_pick() hasn't turned them on
+ */
+const float *render_get_depth(void)
+{
+    return _pick_depth;
+}
+
+/**
+ * Publish every frame drawn from now on to a shared memory ring, for
+ * a recorder to read without going through SDL. Frames are drawn into
+ * the ring in place of the screen buffer, then copied to the screen.
+ * @param name Name of the shared memory object, starting with a
+ *             slash, or NULL to stop publishing
+ * @param slots Frames kept for readers, 0 for FRAMERING_SLOTS
+ * @return 0 on success
+ */
+int8_t render_set_ring(const char *name, uint32_t slots)
+{
+    framering_format_t format;
+
+    framering_close();
+    if(name == NULL) return 0;
+
+    if(_backend == RENDER_BACKEND_GEOMETRY)
+    {
+        printf("Frames can't be published with the geometry backend, which draws walls past the ring\n");
+        return -1;
+    }
+    if(_fmt == NULL || _fmt->BytesPerPixel != 4)
+    {
+        printf("Frames can only be published from 32 bit screen buffers\n");
+        return -1;
+    }
+    format.width = SCR_W;
+    format.height = SCR_H;
+    format.rshift = _fmt->Rshift;
+    format.gshift = _fmt->Gshift;
+    format.bshift = _fmt->Bshift;
+
+    return framering_open(name, slots, &format);
+}
+
+/**
+ * Set how far the player can see. Portals wholly past the far clip
+ * aren't looked through, and are drawn as fog along with anything
+ * else that far out, fading in over the last quarter of the way.
+ * Past the LOD distance floors, ceilings and walls are drawn in the
+ * average color of their texture instead of being textured.
+ * @param far Far clip distance, 0 to see forever
+ * @param lod LOD distance, 0 to texture everything
+ */
+void render_set_distances(double far, double lod)
+{
+    _rsettings.far = MAX(far, 0);
+    _rsettings.fog = _rsettings.far * FOG_START;
+    _rsettings.lod = MAX(lod, 0);
+    render_reset_views();
+}
+
+/**
+ * Forget the walls every view drew last frame, so the next frame
+ * of each is worked out from scratch
+ */
+void render_reset_views(void)
+{
+    for(int i = 0; i < RENDER_MAX_VIEWS; ++i) _contexts[i].view.valid = 0;
+}
+
+/**
+ * Choose how walls are filled in. The geometry backend hands them to
+ * SDL as textured quads, a draw call per texture per frame, which the
+ * GPU fills when the renderer is accelerated; the screen buffer holds
+ * everything else and is added on top. Walls the texture repeats down
+ * more than once a row are still drawn by the CPU.
+ * @return 0 on success, -1 if frames are being published, as the
+ *         frame ring only sees the screen buffer
+ */
+int8_t render_set_backend(render_backend_t backend)
+{
+    if(backend != RENDER_BACKEND_PIXELS && backend != RENDER_BACKEND_GEOMETRY)
+    {
+        printf("No such render backend %d\n", (int)backend);
+        return -1;
+    }
+    if(backend == RENDER_BACKEND_GEOMETRY && framering_active())
+    {
+        printf("Frames can't be published with the geometry backend, which draws walls past the ring\n");
+        return -1;
+    }
+    _backend = backend;
+
+    return 0;
+}
+
+/**
+ * Palettize the textures, or go back to reading them in full color.
+ * Every texture is quantized to one shared palette of up to 256
+ * colors, so walls, floors and ceilings read a byte a texel rather
+ * than four. They are shaded through a colormap holding each palette
+ * color at COLORMAP_LEVELS light levels, which folds the sector's
+ * brightness, distance and fog into the lookup of the texel.
+ * @param enable Nonzero to palettize, zero to free the palette
+ * @return 0 on success, -1 if the textures aren't loaded or it ran
+ *         out of memory
+ */
+int8_t render_set_palette(int enable)
+{
+    uint32_t *hist;
+
+    if(!enable)
+    {
+        for(int i = 0; i < NUM_TEXTURES; ++i)
+        {
+            free(_textures[i].pix8);
+            _textures[i].pix8 = NULL;
+        }
+        free(_palette);
+        free(_colormap);
+        _palette = NULL;
+        _colormap = NULL;
+        return 0;
+    }
+    if(_palette) return 0;
+
+    if(_fmt == NULL)
+    {
+        printf("Textures can only be palettized once they are loaded\n");
+        return -1;
+    }
+
+    hist = calloc(PALETTE_BINS, sizeof(uint32_t));
+    _palette = malloc(sizeof(palette_t));
+    _colormap = malloc(COLORMAP_LEVELS * sizeof(*_colormap));
+    if(hist == NULL || _palette == NULL || _colormap == NULL)
+    {
+        printf("Out of memory palettizing textures\n");
+        free(hist);
+        render_set_palette(0);
+        return -1;
+    }
+
+    // Every texture has a say in the palette, by its size
+    for(int i = 0; i < NUM_TEXTURES; ++i)
+    {
+        image_t *t = &_textures[i];
+
+        for(uint32_t y = 0; y < t->h; ++y)
+        {
+            for(uint32_t x = 0; x < t->w; ++x)
+            {
+                uint8_t r, g, b;
+                SDL_GetRGB(t->pix[(y * t->pitch / sizeof(uint32_t)) + x], _fmt, &r, &g, &b);
+                ++hist[PALETTE_BIN(r, g, b)];
+            }
+        }
+    }
+    if(palette_build(_palette, hist) != 0)
+    {
+        free(hist);
+        render_set_palette(0);
+        return -1;
+    }
+    free(hist);
+
+    for(int i = 0; i < NUM_TEXTURES; ++i)
+    {
+        image_t *t = &_textures[i];
+
+        t->pix8 = malloc(t->w * t->h);
+        if(t->pix8 == NULL)
+        {
+            printf("Out of memory palettizing textures\n");
+            render_set_palette(0);
+            return -1;
+        }
+        for(uint32_t y = 0; y < t->h; ++y)
+        {
+            for(uint32_t x = 0; x < t->w; ++x)
+            {
+                uint8_t r, g, b;
+                SDL_GetRGB(t->pix[(y * t->pitch / sizeof(uint32_t)) + x], _fmt, &r, &g, &b);
+                t->pix8[(y * t->w) + x] = palette_index(_palette, r, g, b);
+            }
+        }
+    }
+
+    // Light level l stands for the shades that shift down to it,
+    // from black at 0 up to full brightness
+    for(uint32_t l = 0; l < COLORMAP_LEVELS; ++l)
+    {
+        uint32_t mod = (l * 0xFF) / (COLORMAP_LEVELS - 1);
+
+        for(uint32_t i = 0; i < PALETTE_SIZE; ++i)
+        {
+            _colormap[l][i] = SDL_MapRGBA(_fmt, _palette->r[i] * mod / 0xFF, _palette->g[i] * mod / 0xFF,
+                                          _palette->b[i] * mod / 0xFF, 0xFF);
+        }
+    }
+
+    return 0;
+}
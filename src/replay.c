@@ -0,0 +1,293 @@
+/**
+ * Input recording and replay implementation.
+ *
+ * FORMAT OF RECORDING FILE (all values little endian)
+ *
+ * HEADER:
+ * "PELR" [u16 version] [u16 tick length in ms] [u16 length] {level file name}
+ *
+ * TICKS, one per world_tick():
+ * [u16 key bits] [i16 mouse x] [i16 mouse y] [i16 lx] [i16 ly] [i16 rx] [i16 ry]
+ *
+ * Stick axes are stored as raw controller values.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "replay.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Project headers
+#include "common.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define REPLAY_MAGIC "PELR"
+#define REPLAY_TICK_LEN (14)
+#define STICK_MAX (32767)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct replay_struct
+{
+    FILE *fp;
+    replay_mode_t mode;
+    uint32_t ticks;
+} replay_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static replay_t _replay = {NULL, REPLAY_OFF, 0};
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static void replay_put16(uint8_t *buf, uint16_t v);
+static uint16_t replay_get16(const uint8_t *buf);
+static int16_t replay_axis(float v);
+static uint16_t replay_pack_keys(const keys_t *keys);
+static void replay_unpack_keys(uint16_t bits, keys_t *keys);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+static void replay_put16(uint8_t *buf, uint16_t v)
+{
+    buf[0] = v & 0xFF;
+    buf[1] = v >> 8;
+}
+
+static uint16_t replay_get16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static int16_t replay_axis(float v)
+{
+    return (int16_t)CLAMP(lroundf(v * STICK_MAX), -STICK_MAX - 1, STICK_MAX);
+}
+
+static uint16_t replay_pack_keys(const keys_t *keys)
+{
+    return (keys->w     << 0)  | (keys->a    << 1)  | (keys->s     << 2)  | (keys->d    << 3)
+         | (keys->e     << 4)  | (keys->f    << 5)  | (keys->c     << 6)  | (keys->right << 7)
+         | (keys->left  << 8)  | (keys->down << 9)  | (keys->up    << 10) | (keys->space << 11)
+         | (keys->q     << 12) | (keys->shift << 13);
+}
+
+static void replay_unpack_keys(uint16_t bits, keys_t *keys)
+{
+    keys->w     = (bits >> 0) & 1;
+    keys->a     = (bits >> 1) & 1;
+    keys->s     = (bits >> 2) & 1;
+    keys->d     = (bits >> 3) & 1;
+    keys->e     = (bits >> 4) & 1;
+    keys->f     = (bits >> 5) & 1;
+    keys->c     = (bits >> 6) & 1;
+    keys->right = (bits >> 7) & 1;
+    keys->left  = (bits >> 8) & 1;
+    keys->down  = (bits >> 9) & 1;
+    keys->up    = (bits >> 10) & 1;
+    keys->space = (bits >> 11) & 1;
+    keys->q     = (bits >> 12) & 1;
+    keys->shift = (bits >> 13) & 1;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Start recording input
+ * @param[in] filename File to record to
+ * @param[in] level Level being played, stored to check against on replay
+ * @param[in] tick_ms Length of a tick
+ * @return 0 on success
+ */
+int8_t replay_record(const char *filename, const char *level, uint32_t tick_ms)
+{
+    uint8_t header[10];
+    size_t len = strlen(level);
+
+    replay_close();
+
+    _replay.fp = fopen(filename, "wb");
+    if(_replay.fp == NULL)
+    {
+        printf("Can't open %s for recording\n", filename);
+        return -1;
+    }
+
+    len = MIN(len, UINT16_MAX);
+    memcpy(header, REPLAY_MAGIC, 4);
+    replay_put16(&header[4], REPLAY_VERSION);
+    replay_put16(&header[6], (uint16_t)tick_ms);
+    replay_put16(&header[8], (uint16_t)len);
+    if(fwrite(header, sizeof(header), 1, _replay.fp) != 1 || fwrite(level, 1, len, _replay.fp) != len)
+    {
+        printf("Can't write recording header to %s\n", filename);
+        replay_close();
+        return -1;
+    }
+
+    _replay.mode = REPLAY_RECORD;
+    _replay.ticks = 0;
+
+    return 0;
+}
+
+/**
+ * Start playing back a recording
+ * @param[in] filename The recording
+ * @param[in] level Level being played, warns if it isn't the recorded one
+ * @param[in] tick_ms Length of a tick, must match the recording
+ * @return 0 on success
+ */
+int8_t replay_play(const char *filename, const char *level, uint32_t tick_ms)
+{
+    uint8_t header[10];
+    char name[256];
+    uint16_t len;
+
+    replay_close();
+
+    _replay.fp = fopen(filename, "rb");
+    if(_replay.fp == NULL)
+    {
+        printf("Can't open recording %s\n", filename);
+        return -1;
+    }
+
+    if(fread(header, sizeof(header), 1, _replay.fp) != 1 || memcmp(header, REPLAY_MAGIC, 4) != 0)
+    {
+        printf("%s is not a recording\n", filename);
+        replay_close();
+        return -1;
+    }
+    if(replay_get16(&header[4]) != REPLAY_VERSION || replay_get16(&header[6]) != tick_ms)
+    {
+        printf("%s was recorded by a different version\n", filename);
+        replay_close();
+        return -1;
+    }
+
+    len = replay_get16(&header[8]);
+    if(fread(name, 1, MIN(len, sizeof(name) - 1), _replay.fp) != MIN(len, sizeof(name) - 1)
+       || fseek(_replay.fp, sizeof(header) + len, SEEK_SET) != 0)
+    {
+        printf("%s is truncated\n", filename);
+        replay_close();
+        return -1;
+    }
+    name[MIN(len, sizeof(name) - 1)] = '\0';
+    if(strcmp(name, level) != 0)
+    {
+        printf("Warning: %s was recorded on %s\n", filename, name);
+    }
+
+    _replay.mode = REPLAY_PLAY;
+    _replay.ticks = 0;
+
+    return 0;
+}
+
+/**
+ * Stop recording or playing
+ */
+void replay_close(void)
+{
+    if(_replay.fp)
+    {
+        if(_replay.mode == REPLAY_RECORD) printf("Recorded %u ticks\n", _replay.ticks);
+        fclose(_replay.fp);
+    }
+    _replay.fp = NULL;
+    _replay.mode = REPLAY_OFF;
+}
+
+/**
+ * Get whether input is being recorded or replayed
+ */
+replay_mode_t replay_mode(void)
+{
+    return _replay.mode;
+}
+
+/**
+ * Record the input of a tick. The frame is rounded to what a replay
+ * reads back, so the recorded session and its replay stay identical.
+ * @param[in,out] frame The input of this tick
+ * @return 0 on success
+ */
+int8_t replay_write(input_frame_t *frame)
+{
+    uint8_t buf[REPLAY_TICK_LEN];
+    int16_t axes[4];
+
+    if(_replay.mode != REPLAY_RECORD || frame == NULL) return -1;
+
+    frame->mouse_x = CLAMP(frame->mouse_x, INT16_MIN, INT16_MAX);
+    frame->mouse_y = CLAMP(frame->mouse_y, INT16_MIN, INT16_MAX);
+    axes[0] = replay_axis(frame->lx);
+    axes[1] = replay_axis(frame->ly);
+    axes[2] = replay_axis(frame->rx);
+    axes[3] = replay_axis(frame->ry);
+    frame->lx = axes[0] / (float)STICK_MAX;
+    frame->ly = axes[1] / (float)STICK_MAX;
+    frame->rx = axes[2] / (float)STICK_MAX;
+    frame->ry = axes[3] / (float)STICK_MAX;
+
+    replay_put16(&buf[0], replay_pack_keys(&frame->keys));
+    replay_put16(&buf[2], (uint16_t)(int16_t)frame->mouse_x);
+    replay_put16(&buf[4], (uint16_t)(int16_t)frame->mouse_y);
+    for(int a = 0; a < 4; ++a) replay_put16(&buf[6 + (2 * a)], (uint16_t)axes[a]);
+
+    if(fwrite(buf, sizeof(buf), 1, _replay.fp) != 1)
+    {
+        printf("Can't write recording, stopping\n");
+        replay_close();
+        return -1;
+    }
+    ++_replay.ticks;
+
+    return 0;
+}
+
+/**
+ * Read the input of the next recorded tick
+ * @param[out] frame The input of this tick
+ * @return 1 if a tick was read, 0 at the end of the recording
+ */
+int replay_read(input_frame_t *frame)
+{
+    uint8_t buf[REPLAY_TICK_LEN];
+
+    if(_replay.mode != REPLAY_PLAY || frame == NULL) return 0;
+    if(fread(buf, sizeof(buf), 1, _replay.fp) != 1) return 0;
+
+    replay_unpack_keys(replay_get16(&buf[0]), &frame->keys);
+    frame->mouse_x = (int16_t)replay_get16(&buf[2]);
+    frame->mouse_y = (int16_t)replay_get16(&buf[4]);
+    frame->lx = (int16_t)replay_get16(&buf[6])  / (float)STICK_MAX;
+    frame->ly = (int16_t)replay_get16(&buf[8])  / (float)STICK_MAX;
+    frame->rx = (int16_t)replay_get16(&buf[10]) / (float)STICK_MAX;
+    frame->ry = (int16_t)replay_get16(&buf[12]) / (float)STICK_MAX;
+    ++_replay.ticks;
+
+    return 1;
+}
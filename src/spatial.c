@@ -0,0 +1,170 @@
+/**
+ * Uniform grid over sector bounding boxes.
+ *
+ * The grid covers the bounding box of the whole world, with cells sized
+ * so there is roughly one sector per cell. Every sector is listed in each
+ * cell its bounding box touches, so a point lookup is a single cell
+ * fetch followed by a handful of box tests.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "spatial.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Project headers
+#include "common.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+// Get the (clamped) cell coordinate for a world coordinate
+#define CELL_X(x) ((uint32_t)CLAMP((int32_t)(((x) - _grid.x0) / _grid.cell), 0, (int32_t)_grid.w - 1))
+#define CELL_Y(y) ((uint32_t)CLAMP((int32_t)(((y) - _grid.y0) / _grid.cell), 0, (int32_t)_grid.h - 1))
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct spatial_grid_struct
+{
+    // Extent of the grid and size of a single (square) cell
+    float x0, y0, x1, y1, cell;
+    uint32_t w, h;
+    // Cell c lists the sectors items[first[c]] to items[first[c+1] - 1]
+    uint32_t *first;
+    uint32_t *items;
+} spatial_grid_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static spatial_grid_t _grid;
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Build the grid
+ * @param[in] bounds Bounding box of every sector
+ * @param[in] count Number of sectors
+ * @return 0 on success
+ */
+int8_t spatial_build(const box_t *bounds, uint32_t count)
+{
+    float width, height;
+    uint32_t cells;
+
+    spatial_close();
+    if(bounds == NULL || count == 0) return 0;
+
+    // Find the world extent
+    _grid.x0 = bounds[0].x0; _grid.y0 = bounds[0].y0;
+    _grid.x1 = bounds[0].x1; _grid.y1 = bounds[0].y1;
+    for(uint32_t s = 1; s < count; ++s)
+    {
+        _grid.x0 = MIN(_grid.x0, bounds[s].x0);
+        _grid.y0 = MIN(_grid.y0, bounds[s].y0);
+        _grid.x1 = MAX(_grid.x1, bounds[s].x1);
+        _grid.y1 = MAX(_grid.y1, bounds[s].y1);
+    }
+    width  = MAX(_grid.x1 - _grid.x0, 1e-3f);
+    height = MAX(_grid.y1 - _grid.y0, 1e-3f);
+
+    // Aim for about one sector per cell
+    _grid.cell = sqrtf((width * height) / count);
+    _grid.w = CLAMP((uint32_t)ceilf(width  / _grid.cell), 1, SPATIAL_MAX_DIM);
+    _grid.h = CLAMP((uint32_t)ceilf(height / _grid.cell), 1, SPATIAL_MAX_DIM);
+    _grid.cell = MAX(width / _grid.w, height / _grid.h);
+    cells = _grid.w * _grid.h;
+
+    _grid.first = calloc(cells + 1, sizeof(uint32_t));
+    if(_grid.first == NULL)
+    {
+        printf("Out of memory building sector grid\n");
+        return -1;
+    }
+
+    // Count entries per cell, then turn the counts into start offsets
+    for(uint32_t s = 0; s < count; ++s)
+    {
+        for(uint32_t cy = CELL_Y(bounds[s].y0); cy <= CELL_Y(bounds[s].y1); ++cy)
+        {
+            for(uint32_t cx = CELL_X(bounds[s].x0); cx <= CELL_X(bounds[s].x1); ++cx)
+            {
+                ++_grid.first[(cy * _grid.w) + cx];
+            }
+        }
+    }
+    for(uint32_t c = 0, sum = 0; c <= cells; ++c)
+    {
+        uint32_t n = (c < cells) ? _grid.first[c] : 0;
+        _grid.first[c] = sum;
+        sum += n;
+    }
+
+    _grid.items = malloc(MAX(_grid.first[cells], 1) * sizeof(uint32_t));
+    if(_grid.items == NULL)
+    {
+        printf("Out of memory building sector grid\n");
+        spatial_close();
+        return -1;
+    }
+
+    // Fill in, which leaves each start pointing at the next cell's start
+    for(uint32_t s = 0; s < count; ++s)
+    {
+        for(uint32_t cy = CELL_Y(bounds[s].y0); cy <= CELL_Y(bounds[s].y1); ++cy)
+        {
+            for(uint32_t cx = CELL_X(bounds[s].x0); cx <= CELL_X(bounds[s].x1); ++cx)
+            {
+                _grid.items[_grid.first[(cy * _grid.w) + cx]++] = s;
+            }
+        }
+    }
+    for(uint32_t c = cells; c > 0; --c) _grid.first[c] = _grid.first[c - 1];
+    _grid.first[0] = 0;
+
+    return 0;
+}
+
+/**
+ * Free the grid
+ */
+void spatial_close(void)
+{
+    if(_grid.first) free(_grid.first);
+    if(_grid.items) free(_grid.items);
+    memset(&_grid, 0, sizeof(_grid));
+}
+
+/**
+ * Get the sectors whose bounding boxes overlap the grid cell holding a point.
+ * Callers still need to test the boxes and polygons themselves.
+ * @param[in] x The x coordinate
+ * @param[in] y The y coordinate
+ * @param[out] ids Set to the list of candidate sector IDs
+ * @return Number of candidates
+ */
+uint32_t spatial_candidates(double x, double y, const uint32_t **ids)
+{
+    uint32_t c;
+
+    if(_grid.first == NULL || ids == NULL) return 0;
+    if(x < _grid.x0 || x > _grid.x1 || y < _grid.y0 || y > _grid.y1) return 0;
+
+    c = (CELL_Y(y) * _grid.w) + CELL_X(x);
+    *ids = &_grid.items[_grid.first[c]];
+
+    return _grid.first[c + 1] - _grid.first[c];
+}
@@ -0,0 +1,655 @@
+/**
+ * Region based level streaming implementation.
+ *
+ * While the level is indexed, world_load() hands every sector's file
+ * offset and portals to this module. stream_start() then groups the
+ * sectors into regions with a breadth first walk of the portal graph
+ * and starts a loader thread. The loader thread only ever parses into
+ * freshly allocated memory; installing and evicting wall lists happens
+ * on the main thread inside stream_update(), so nothing else needs to
+ * lock the world.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "stream.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project headers
+#include "common.h"
+#include "pel.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define REGION_NONE (UINT32_MAX)
+
+#define INITIAL_CAPACITY (64)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef enum region_state_enum
+{
+    REGION_UNLOADED,
+    REGION_QUEUED,
+    // Walls have been read and are waiting to be installed
+    REGION_READY,
+    REGION_RESIDENT,
+    REGION_FAILED
+} region_state_t;
+
+typedef struct region_struct
+{
+    // Slice of _stream.members holding this region's sector IDs
+    uint32_t first, count;
+    // Slice of _stream.links holding neighboring region IDs
+    uint32_t first_link, num_links;
+    // Total walls across all member sectors
+    uint32_t num_walls;
+    // Wall storage while loaded
+    wall_t *walls;
+    region_state_t state;
+    // Breadth first search bookkeeping
+    uint32_t stamp, dist;
+} region_t;
+
+typedef struct stream_struct
+{
+    int active;
+    char *filename;
+
+    // Per sector file offset of the wall list, and owning region
+    long *offsets;
+    uint32_t *region_of;
+    uint32_t offsetCap;
+
+    // Portals gathered while indexing, as (sector, neighbor) pairs
+    uint32_t *portals;
+    uint32_t numPortals, portalCap;
+
+    // Region graph
+    region_t *regions;
+    uint32_t numRegions;
+    uint32_t *members;
+    uint32_t *links;
+    uint32_t numLinks;
+
+    // Residency
+    uint32_t cur_region, stamp, resident_walls;
+    uint32_t *bfs;
+
+    // Loader thread and the queues it shares with the main thread.
+    // Both queues hold at most numRegions entries.
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int running;
+    uint32_t *todo, todo_head, todo_tail;
+    uint32_t *ready, ready_head, ready_tail;
+} stream_t;
+
+/* ***********************************
+ * Private variables
+ * ***********************************/
+
+static stream_t _stream;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int8_t stream_grow(void **arr, uint32_t *cap, uint32_t need, size_t size);
+static int8_t stream_partition(void);
+static void *stream_loader(void *arg);
+static wall_t *stream_read_region(pel_reader_t *r, region_t *region);
+static void stream_install(void);
+static void stream_evict(region_t *region);
+static void stream_refresh(uint32_t origin);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Make sure an array can hold at least /need elements
+ * @return 0 on success
+ */
+static int8_t stream_grow(void **arr, uint32_t *cap, uint32_t need, size_t size)
+{
+    uint32_t ncap;
+    void *tmp;
+
+    if(need <= *cap) return 0;
+
+    ncap = (*cap) ? *cap : INITIAL_CAPACITY;
+    while(ncap < need) ncap *= 2;
+
+    tmp = realloc(*arr, (size_t)ncap * size);
+    if(tmp == NULL)
+    {
+        printf("Out of memory indexing world\n");
+        return -1;
+    }
+    *arr = tmp;
+    *cap = ncap;
+
+    return 0;
+}
+
+/**
+ * Group sectors into regions of up to STREAM_REGION_SECTORS sectors by
+ * flooding through portals, then build the region adjacency lists.
+ * @return 0 on success
+ */
+static int8_t stream_partition(void)
+{
+    world_t *world = world_get_world();
+    uint32_t n = world->numSectors;
+    uint32_t *adj_first, *adj, *mark, linkCap = 0, regionCap = 0;
+    uint32_t head, tail;
+
+    adj_first = calloc(n + 1, sizeof(uint32_t));
+    adj       = malloc(2 * (size_t)MAX(_stream.numPortals, 1) * sizeof(uint32_t));
+    mark      = malloc(MAX(n, 1) * sizeof(uint32_t));
+    _stream.region_of = malloc(MAX(n, 1) * sizeof(uint32_t));
+    _stream.members   = malloc(MAX(n, 1) * sizeof(uint32_t));
+    if(!adj_first || !adj || !mark || !_stream.region_of || !_stream.members)
+    {
+        free(adj_first); free(adj); free(mark);
+        printf("Out of memory partitioning world\n");
+        return -1;
+    }
+
+    // Build an undirected sector adjacency list from the portals
+    for(uint32_t p = 0; p < _stream.numPortals; ++p)
+    {
+        ++adj_first[_stream.portals[2*p]];
+        ++adj_first[_stream.portals[2*p + 1]];
+    }
+    for(uint32_t s = 0, sum = 0; s <= n; ++s)
+    {
+        uint32_t deg = (s < n) ? adj_first[s] : 0;
+        adj_first[s] = sum;
+        sum += deg;
+    }
+    for(uint32_t p = 0; p < _stream.numPortals; ++p)
+    {
+        uint32_t a = _stream.portals[2*p], b = _stream.portals[2*p + 1];
+        adj[adj_first[a]++] = b;
+        adj[adj_first[b]++] = a;
+    }
+    // Filling shifted every start up by one slot, so shift back
+    for(uint32_t s = n; s > 0; --s) adj_first[s] = adj_first[s - 1];
+    adj_first[0] = 0;
+
+    // Flood regions. The member list doubles as the BFS queue.
+    for(uint32_t s = 0; s < n; ++s) _stream.region_of[s] = REGION_NONE;
+    tail = 0;
+    for(uint32_t s = 0; s < n; ++s)
+    {
+        region_t *region;
+        if(_stream.region_of[s] != REGION_NONE) continue;
+
+        if(stream_grow((void **)&_stream.regions, &regionCap, _stream.numRegions + 1, sizeof(region_t)) != 0)
+        {
+            free(adj_first); free(adj); free(mark);
+            return -1;
+        }
+        region = &_stream.regions[_stream.numRegions];
+        memset(region, 0, sizeof(region_t));
+        region->first = tail;
+
+        _stream.region_of[s] = _stream.numRegions;
+        _stream.members[tail++] = s;
+        for(head = region->first; head < tail && (tail - region->first) < STREAM_REGION_SECTORS; ++head)
+        {
+            uint32_t u = _stream.members[head];
+            for(uint32_t a = adj_first[u]; a < adj_first[u + 1]; ++a)
+            {
+                uint32_t v = adj[a];
+                if(_stream.region_of[v] != REGION_NONE) continue;
+                if((tail - region->first) >= STREAM_REGION_SECTORS) break;
+                _stream.region_of[v] = _stream.numRegions;
+                _stream.members[tail++] = v;
+            }
+        }
+        region->count = tail - region->first;
+        for(uint32_t m = 0; m < region->count; ++m)
+        {
+            region->num_walls += world->sectors[_stream.members[region->first + m]].num_walls;
+        }
+        ++_stream.numRegions;
+    }
+
+    // Region adjacency, without duplicates
+    for(uint32_t r = 0; r < _stream.numRegions; ++r) mark[r] = REGION_NONE;
+    for(uint32_t r = 0; r < _stream.numRegions; ++r)
+    {
+        region_t *region = &_stream.regions[r];
+        region->first_link = _stream.numLinks;
+        mark[r] = r;
+        for(uint32_t m = 0; m < region->count; ++m)
+        {
+            uint32_t u = _stream.members[region->first + m];
+            for(uint32_t a = adj_first[u]; a < adj_first[u + 1]; ++a)
+            {
+                uint32_t other = _stream.region_of[adj[a]];
+                if(mark[other] == r) continue;
+                mark[other] = r;
+                if(stream_grow((void **)&_stream.links, &linkCap, _stream.numLinks + 1, sizeof(uint32_t)) != 0)
+                {
+                    free(adj_first); free(adj); free(mark);
+                    return -1;
+                }
+                _stream.links[_stream.numLinks++] = other;
+            }
+        }
+        region->num_links = _stream.numLinks - region->first_link;
+    }
+
+    free(adj_first);
+    free(adj);
+    free(mark);
+
+    return 0;
+}
+
+/**
+ * Read the wall lists of every sector in a region into one block
+ * @return The block, or NULL on error
+ */
+static wall_t *stream_read_region(pel_reader_t *r, region_t *region)
+{
+    world_t *world = world_get_world();
+    wall_t *walls = malloc(MAX(region->num_walls, 1) * sizeof(wall_t));
+    wall_t *wall = walls;
+
+    if(walls == NULL) return NULL;
+
+    for(uint32_t m = 0; m < region->count; ++m)
+    {
+        uint32_t s = _stream.members[region->first + m];
+        if(pel_seek(r, _stream.offsets[s]) != 0)
+        {
+            free(walls);
+            return NULL;
+        }
+        for(uint16_t i = 0; i < world->sectors[s].num_walls; ++i)
+        {
+            if(!pel_read_wall(r, wall++))
+            {
+                free(walls);
+                return NULL;
+            }
+        }
+    }
+
+    return walls;
+}
+
+/**
+ * Background loader. Pulls region IDs off the todo queue and parses
+ * their walls, then hands them back through the ready queue.
+ */
+static void *stream_loader(void *arg)
+{
+    FILE *fp = fopen(_stream.filename, "rt");
+    pel_reader_t reader;
+    int ok = (fp != NULL) && (pel_open_file(&reader, fp) == 0);
+    uint32_t cap = _stream.numRegions + 1;
+    wall_t *walls;
+    uint32_t id;
+
+    (void)arg;
+
+    pthread_mutex_lock(&_stream.lock);
+    while(_stream.running)
+    {
+        if(_stream.todo_head == _stream.todo_tail)
+        {
+            pthread_cond_wait(&_stream.wake, &_stream.lock);
+            continue;
+        }
+        id = _stream.todo[_stream.todo_tail];
+        _stream.todo_tail = (_stream.todo_tail + 1) % cap;
+        pthread_mutex_unlock(&_stream.lock);
+
+        // Parse outside the lock so the main thread never waits on IO
+        walls = (ok) ? stream_read_region(&reader, &_stream.regions[id]) : NULL;
+
+        pthread_mutex_lock(&_stream.lock);
+        _stream.regions[id].walls = walls;
+        _stream.regions[id].state = (walls != NULL) ? REGION_READY : REGION_FAILED;
+        _stream.ready[_stream.ready_head] = id;
+        _stream.ready_head = (_stream.ready_head + 1) % cap;
+        pthread_cond_broadcast(&_stream.done);
+    }
+    pthread_mutex_unlock(&_stream.lock);
+
+    if(ok) pel_close(&reader);
+    if(fp) fclose(fp);
+
+    return NULL;
+}
+
+/**
+ * Point the sectors of every freshly loaded region at their walls
+ * @note Called with the lock held
+ */
+static void stream_install(void)
+{
+    world_t *world = world_get_world();
+    uint32_t cap = _stream.numRegions + 1;
+
+    while(_stream.ready_tail != _stream.ready_head)
+    {
+        region_t *region = &_stream.regions[_stream.ready[_stream.ready_tail]];
+        wall_t *walls = region->walls;
+        _stream.ready_tail = (_stream.ready_tail + 1) % cap;
+
+        if(region->state == REGION_FAILED)
+        {
+            printf("Could not stream region %u\n", (uint32_t)(region - _stream.regions));
+            continue;
+        }
+
+        for(uint32_t m = 0; m < region->count; ++m)
+        {
+            sector_t *sect = &world->sectors[_stream.members[region->first + m]];
+            sect->walls = walls;
+            walls += sect->num_walls;
+        }
+        region->state = REGION_RESIDENT;
+        _stream.resident_walls += region->num_walls;
+        ++world->revision;
+
+        // The player may have moved on while this was loading
+        if(region->stamp != _stream.stamp) stream_evict(region);
+    }
+}
+
+/**
+ * Drop a resident region's walls
+ */
+static void stream_evict(region_t *region)
+{
+    world_t *world = world_get_world();
+
+    for(uint32_t m = 0; m < region->count; ++m)
+    {
+        world->sectors[_stream.members[region->first + m]].walls = NULL;
+    }
+    free(region->walls);
+    region->walls = NULL;
+    region->state = REGION_UNLOADED;
+    _stream.resident_walls -= region->num_walls;
+    ++world->revision;
+}
+
+/**
+ * Walk the region graph out from /origin. Queue anything within the
+ * load radius (nearest first) and evict anything beyond the eviction
+ * radius.
+ * @note Called with the lock held
+ */
+static void stream_refresh(uint32_t origin)
+{
+    uint32_t head = 0, tail = 0, cap = _stream.numRegions + 1;
+    int queued = 0;
+
+    ++_stream.stamp;
+    _stream.regions[origin].stamp = _stream.stamp;
+    _stream.regions[origin].dist = 0;
+    _stream.bfs[tail++] = origin;
+
+    while(head < tail)
+    {
+        region_t *region = &_stream.regions[_stream.bfs[head++]];
+
+        if(region->dist <= STREAM_LOAD_RADIUS && region->state == REGION_UNLOADED)
+        {
+            region->state = REGION_QUEUED;
+            _stream.todo[_stream.todo_head] = region - _stream.regions;
+            _stream.todo_head = (_stream.todo_head + 1) % cap;
+            queued = 1;
+        }
+        if(region->dist == STREAM_EVICT_RADIUS) continue;
+
+        for(uint32_t l = 0; l < region->num_links; ++l)
+        {
+            region_t *next = &_stream.regions[_stream.links[region->first_link + l]];
+            if(next->stamp == _stream.stamp) continue;
+            next->stamp = _stream.stamp;
+            next->dist = region->dist + 1;
+            _stream.bfs[tail++] = next - _stream.regions;
+        }
+    }
+
+    if(queued) pthread_cond_signal(&_stream.wake);
+
+    // Anything the walk didn't reach is out of range
+    for(uint32_t r = 0; r < _stream.numRegions; ++r)
+    {
+        region_t *region = &_stream.regions[r];
+        if(region->state == REGION_RESIDENT && region->stamp != _stream.stamp)
+        {
+            stream_evict(region);
+        }
+    }
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Reset the index before loading a level in streaming mode
+ * @return 0 on success
+ */
+int8_t stream_begin(void)
+{
+    stream_close();
+    memset(&_stream, 0, sizeof(_stream));
+
+    return 0;
+}
+
+/**
+ * Record where a sector's wall list lives and which sectors it
+ * links to. The walls themselves are not kept.
+ * @param[in] id The sector ID
+ * @param[in] offset File offset of the sector's first wall
+ * @param[in] walls The parsed walls of the sector
+ * @param[in] num_walls Number of walls
+ * @return 0 on success
+ */
+int8_t stream_index_sector(uint32_t id, long offset, const wall_t *walls, uint16_t num_walls)
+{
+    world_t *world = world_get_world();
+
+    if(stream_grow((void **)&_stream.offsets, &_stream.offsetCap, id + 1, sizeof(long)) != 0)
+    {
+        return -1;
+    }
+    _stream.offsets[id] = offset;
+
+    for(uint16_t i = 0; i < num_walls; ++i)
+    {
+        // Vertices are resident, so they must already be known
+        if(walls[i].v0 < 0 || (uint32_t)walls[i].v0 >= world->numVertices
+           || walls[i].v1 < 0 || (uint32_t)walls[i].v1 >= world->numVertices)
+        {
+            printf("Sector %u wall %u references a missing vertex "
+                   "(vertices must come before sectors when streaming)\n", id, i);
+            return -1;
+        }
+        if(walls[i].neighbor < 0) continue;
+
+        if(stream_grow((void **)&_stream.portals, &_stream.portalCap, 2 * (_stream.numPortals + 1), sizeof(uint32_t)) != 0)
+        {
+            return -1;
+        }
+        _stream.portals[2 * _stream.numPortals]     = id;
+        _stream.portals[2 * _stream.numPortals + 1] = walls[i].neighbor;
+        ++_stream.numPortals;
+    }
+
+    return 0;
+}
+
+/**
+ * Partition the indexed level into regions and start the loader thread.
+ * No walls are resident until the first stream_update().
+ * @param[in] filename The level file, reopened by the loader thread
+ * @return 0 on success
+ */
+int8_t stream_start(const char *filename)
+{
+    world_t *world = world_get_world();
+    uint32_t cap;
+
+    for(uint32_t p = 0; p < _stream.numPortals; ++p)
+    {
+        if(_stream.portals[2*p + 1] >= world->numSectors)
+        {
+            printf("Sector %u has a portal to missing sector %u\n",
+                   _stream.portals[2*p], _stream.portals[2*p + 1]);
+            return -1;
+        }
+    }
+
+    if(stream_partition() != 0) return -1;
+    free(_stream.portals);
+    _stream.portals = NULL;
+    _stream.numPortals = _stream.portalCap = 0;
+
+    cap = _stream.numRegions + 1;
+    _stream.filename = malloc(strlen(filename) + 1);
+    _stream.todo  = malloc(cap * sizeof(uint32_t));
+    _stream.ready = malloc(cap * sizeof(uint32_t));
+    _stream.bfs   = malloc(cap * sizeof(uint32_t));
+    if(!_stream.filename || !_stream.todo || !_stream.ready || !_stream.bfs)
+    {
+        printf("Out of memory starting level stream\n");
+        return -1;
+    }
+    strcpy(_stream.filename, filename);
+
+    pthread_mutex_init(&_stream.lock, NULL);
+    pthread_cond_init(&_stream.wake, NULL);
+    pthread_cond_init(&_stream.done, NULL);
+    _stream.running = 1;
+    if(pthread_create(&_stream.thread, NULL, stream_loader, NULL) != 0)
+    {
+        printf("Can't start level stream thread\n");
+        _stream.running = 0;
+        return -1;
+    }
+
+    _stream.cur_region = REGION_NONE;
+    _stream.active = 1;
+
+    printf("Streaming %u sectors in %u regions\n", world->numSectors, _stream.numRegions);
+
+    return 0;
+}
+
+/**
+ * Stop the loader thread and free all streaming state
+ */
+void stream_close(void)
+{
+    if(_stream.running)
+    {
+        pthread_mutex_lock(&_stream.lock);
+        _stream.running = 0;
+        pthread_cond_broadcast(&_stream.wake);
+        pthread_mutex_unlock(&_stream.lock);
+        pthread_join(_stream.thread, NULL);
+
+        pthread_mutex_destroy(&_stream.lock);
+        pthread_cond_destroy(&_stream.wake);
+        pthread_cond_destroy(&_stream.done);
+    }
+
+    for(uint32_t r = 0; r < _stream.numRegions; ++r)
+    {
+        if(_stream.regions[r].walls) free(_stream.regions[r].walls);
+    }
+
+    free(_stream.filename);
+    free(_stream.offsets);
+    free(_stream.region_of);
+    free(_stream.portals);
+    free(_stream.regions);
+    free(_stream.members);
+    free(_stream.links);
+    free(_stream.bfs);
+    free(_stream.todo);
+    free(_stream.ready);
+    memset(&_stream, 0, sizeof(_stream));
+}
+
+/**
+ * Install finished regions and, when the player has moved into a new
+ * region, queue and evict regions around it.
+ * @param[in] sector The sector the player is in
+ * @param[in] wait If set, block until the player's own region is resident
+ * @return 0 on success
+ */
+int8_t stream_update(uint32_t sector, int wait)
+{
+    world_t *world = world_get_world();
+    region_t *region;
+    int8_t rc = 0;
+
+    if(!_stream.active || sector >= world->numSectors) return -1;
+
+    region = &_stream.regions[_stream.region_of[sector]];
+
+    pthread_mutex_lock(&_stream.lock);
+    stream_install();
+
+    if(_stream.region_of[sector] != _stream.cur_region)
+    {
+        _stream.cur_region = _stream.region_of[sector];
+        stream_refresh(_stream.cur_region);
+    }
+
+    while(wait && region->state != REGION_RESIDENT && region->state != REGION_FAILED)
+    {
+        pthread_cond_wait(&_stream.done, &_stream.lock);
+        stream_install();
+    }
+    if(region->state == REGION_FAILED) rc = -1;
+    pthread_mutex_unlock(&_stream.lock);
+
+    return rc;
+}
+
+/**
+ * Returns nonzero if the current level is being streamed
+ */
+int stream_active(void)
+{
+    return _stream.active;
+}
+
+/**
+ * Number of walls currently resident
+ */
+uint32_t stream_resident_walls(void)
+{
+    return _stream.resident_walls;
+}
@@ -0,0 +1,506 @@
+/**
+ * Level topology preprocessing.
+ *
+ * Works out the facts about the level geometry that never change once
+ * it is loaded, so the hot paths can look them up instead:
+ *  - The unit normal and length of every wall
+ *  - Whether the walls of every sector join up into closed loops, and
+ *      whether it is wound counterclockwise
+ *
+ * Portals can also be linked automatically, rather than trusting the
+ * neighbor given for each wall in the level file. Every wall goes into a
+ * hash table under its (v0, v1) pair, and a wall whose reversed edge is
+ * in the table belongs to a portal into that wall's sector.
+ *
+ * FORMAT OF CACHE FILE (native byte order)
+ *
+ * HEADER:
+ * "PELT" [u16 version] [u16 0] [u32 sectors] [u32 walls] [u64 geometry hash]
+ *
+ * Followed by each array of world_topo_t in turn. A cache is only used
+ * if its counts and hash match the loaded level, so caches of edited
+ * levels, or written on a machine of the other byte order, are rebuilt.
+ */
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+// My header
+#include "topo.h"
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Project headers
+#include "common.h"
+#include "world.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+#define TOPO_MAGIC "PELT"
+#define TOPO_VERSION (2)
+#define TOPO_PATH_LEN (512)
+
+/** Key of an empty slot in the edge table, vertex IDs are never negative */
+#define EDGE_EMPTY (UINT64_MAX)
+
+/* ***********************************
+ * Private Typedefs
+ * ***********************************/
+
+typedef struct topo_header_struct
+{
+    char magic[4];
+    uint16_t version, pad;
+    uint32_t numSectors, numWalls;
+    uint64_t hash;
+} topo_header_t;
+
+/** Slot of the edge table used by topo_autolink() */
+typedef struct topo_slot_struct
+{
+    uint64_t key;
+    uint32_t wall, sector;
+} topo_slot_t;
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static uint64_t topo_hash_bytes(uint64_t hash, const void *data, size_t len);
+static uint64_t topo_hash(const world_t *world);
+static int8_t topo_alloc(world_topo_t *topo, uint32_t numSectors, uint32_t numWalls);
+static int topo_compare_int(const void *a, const void *b);
+static void topo_sector(world_t *world, uint32_t s, int32_t *starts, int32_t *ends);
+static int8_t topo_read_cache(world_topo_t *topo, const char *path, const topo_header_t *expect);
+static void topo_write_cache(const world_topo_t *topo, const char *path, const topo_header_t *header);
+static void topo_report(const world_t *world);
+static uint64_t topo_edge_key(int32_t v0, int32_t v1);
+static topo_slot_t *topo_probe(topo_slot_t *table, uint32_t mask, uint64_t key);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * FNV-1a over a block of memory
+ */
+static uint64_t topo_hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for(size_t i = 0; i < len; ++i)
+    {
+        hash = (hash ^ p[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+/**
+ * Hash everything the topology is derived from
+ */
+static uint64_t topo_hash(const world_t *world)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    hash = topo_hash_bytes(hash, world->vertices, world->numVertices * sizeof(xy_t));
+    for(uint32_t i = 0; i < world->numWalls; ++i)
+    {
+        const wall_t *wall = &world->walls[i];
+        hash = topo_hash_bytes(hash, &wall->v0, sizeof(wall->v0));
+        hash = topo_hash_bytes(hash, &wall->v1, sizeof(wall->v1));
+        hash = topo_hash_bytes(hash, &wall->neighbor, sizeof(wall->neighbor));
+    }
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        hash = topo_hash_bytes(hash, &world->sectors[s].num_walls, sizeof(uint16_t));
+    }
+
+    return hash;
+}
+
+/**
+ * Allocate every array of the topology
+ * @return 0 on success
+ */
+static int8_t topo_alloc(world_topo_t *topo, uint32_t numSectors, uint32_t numWalls)
+{
+    uint32_t nw = MAX(numWalls, 1), ns = MAX(numSectors, 1);
+
+    topo->nx = malloc(nw * sizeof(float));
+    topo->ny = malloc(nw * sizeof(float));
+    topo->length = malloc(nw * sizeof(float));
+    topo->flags = malloc(ns * sizeof(uint8_t));
+    if(!topo->nx || !topo->ny || !topo->length || !topo->flags)
+    {
+        printf("Out of memory building level topology\n");
+        topo_free(topo);
+        return -1;
+    }
+    topo->numSectors = numSectors;
+    topo->numWalls = numWalls;
+
+    return 0;
+}
+
+static int topo_compare_int(const void *a, const void *b)
+{
+    int32_t va = *(const int32_t *)a, vb = *(const int32_t *)b;
+
+    return (va > vb) - (va < vb);
+}
+
+/**
+ * Find the normals and lengths of a sector's walls, and check its shape
+ * @param[in] starts, ends Scratch space for the sector's walls
+ */
+static void topo_sector(world_t *world, uint32_t s, int32_t *starts, int32_t *ends)
+{
+    world_topo_t *topo = &world->topo;
+    sector_t *sect = &world->sectors[s];
+    uint32_t first = sect->walls - world->walls, n = sect->num_walls;
+    double area = 0;
+    uint8_t flags = 0;
+
+    // Shoelace sum for the area. Walls of holes are wound the
+    // other way, so they take themselves out.
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        xy_t *v0 = &world->vertices[sect->walls[i].v0], *v1 = &world->vertices[sect->walls[i].v1];
+
+        area += vxs(v0->x, v0->y, v1->x, v1->y);
+        starts[i] = sect->walls[i].v0;
+        ends[i] = sect->walls[i].v1;
+    }
+    area /= 2;
+    if(area > 0) flags |= SECTOR_CCW;
+
+    // Normals point left of each wall, which is inside when wound
+    // counterclockwise
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        xy_t *v0 = &world->vertices[sect->walls[i].v0], *v1 = &world->vertices[sect->walls[i].v1];
+        double ex = v1->x - v0->x, ey = v1->y - v0->y;
+        double len = LineMagnitude(ex, ey);
+        double sign = (area < 0) ? -1 : 1;
+
+        topo->length[first + i] = len;
+        topo->nx[first + i] = (len > 0) ? (-ey / len) * sign : 0;
+        topo->ny[first + i] = (len > 0) ? ( ex / len) * sign : 0;
+    }
+
+    // Loops are closed if every vertex starts as many walls as it ends
+    qsort(starts, n, sizeof(int32_t), topo_compare_int);
+    qsort(ends, n, sizeof(int32_t), topo_compare_int);
+    flags |= SECTOR_CLOSED;
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        if(starts[i] != ends[i]) flags &= ~SECTOR_CLOSED;
+    }
+
+    topo->flags[s] = flags;
+}
+
+/**
+ * Read the topology from a cache file, if it matches
+ * @return 0 on success
+ */
+static int8_t topo_read_cache(world_topo_t *topo, const char *path, const topo_header_t *expect)
+{
+    FILE *fp = fopen(path, "rb");
+    topo_header_t header;
+    uint32_t nw = expect->numWalls, ns = expect->numSectors;
+    int8_t rc = -1;
+
+    if(fp == NULL) return -1;
+
+    if(fread(&header, sizeof(header), 1, fp) == 1 && memcmp(&header, expect, sizeof(header)) == 0
+       && topo_alloc(topo, ns, nw) == 0)
+    {
+        if(fread(topo->nx, sizeof(float), nw, fp) == nw
+           && fread(topo->ny, sizeof(float), nw, fp) == nw
+           && fread(topo->length, sizeof(float), nw, fp) == nw
+           && fread(topo->flags, sizeof(uint8_t), ns, fp) == ns)
+        {
+            rc = 0;
+        }
+        else
+        {
+            topo_free(topo);
+        }
+    }
+
+    fclose(fp);
+
+    return rc;
+}
+
+/**
+ * Write the topology to a cache file. Failing to is not an error.
+ */
+static void topo_write_cache(const world_topo_t *topo, const char *path, const topo_header_t *header)
+{
+    FILE *fp = fopen(path, "wb");
+    uint32_t nw = topo->numWalls, ns = topo->numSectors;
+    int ok;
+
+    if(fp == NULL)
+    {
+        printf("Can't write topology cache %s\n", path);
+        return;
+    }
+
+    ok = fwrite(header, sizeof(*header), 1, fp) == 1
+         && fwrite(topo->nx, sizeof(float), nw, fp) == nw
+         && fwrite(topo->ny, sizeof(float), nw, fp) == nw
+         && fwrite(topo->length, sizeof(float), nw, fp) == nw
+         && fwrite(topo->flags, sizeof(uint8_t), ns, fp) == ns;
+    if(fclose(fp) != 0 || !ok)
+    {
+        printf("Can't write topology cache %s\n", path);
+        remove(path);
+    }
+}
+
+/**
+ * Warn about sectors that break the rules of the level format
+ */
+static void topo_report(const world_t *world)
+{
+    const world_topo_t *topo = &world->topo;
+
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        if(!(topo->flags[s] & SECTOR_CLOSED))
+        {
+            printf("Warning: walls of sector %u don't form a closed outline\n", s);
+        }
+        else if(!(topo->flags[s] & SECTOR_CCW))
+        {
+            printf("Warning: sector %u is wound clockwise\n", s);
+        }
+    }
+}
+
+static uint64_t topo_edge_key(int32_t v0, int32_t v1)
+{
+    return ((uint64_t)(uint32_t)v0 << 32) | (uint32_t)v1;
+}
+
+/**
+ * Find the slot of the edge table holding a key, or the empty slot
+ * it would go in
+ */
+static topo_slot_t *topo_probe(topo_slot_t *table, uint32_t mask, uint64_t key)
+{
+    uint64_t h = key;
+    uint32_t i;
+
+    // Mix the vertex IDs so neighboring edges spread out
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+
+    for(i = h & mask; table[i].key != EDGE_EMPTY && table[i].key != key; i = (i + 1) & mask);
+
+    return &table[i];
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * Derive the topology of the loaded world into world->topo. Does
+ * nothing for streamed worlds, whose walls aren't all in memory.
+ * @param[in,out] world The world, with its walls linked and bounds found
+ * @param[in] level File the world was loaded from, to load the topology
+ *            from its cache or write one. NULL to skip the cache.
+ * @return 0 on success
+ */
+int8_t topo_build(world_t *world, const char *level)
+{
+    world_topo_t *topo;
+    topo_header_t header;
+    char path[TOPO_PATH_LEN];
+    int32_t *starts, *ends;
+    uint16_t most = 1;
+
+    if(world == NULL) return -1;
+    topo = &world->topo;
+    topo_free(topo);
+    if(world->walls == NULL) return 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TOPO_MAGIC, 4);
+    header.version = TOPO_VERSION;
+    header.numSectors = world->numSectors;
+    header.numWalls = world->numWalls;
+
+    if(level != NULL)
+    {
+        if(snprintf(path, sizeof(path), "%s%s", level, TOPO_CACHE_EXT) >= (int)sizeof(path))
+        {
+            level = NULL;
+        }
+        else
+        {
+            header.hash = topo_hash(world);
+            if(topo_read_cache(topo, path, &header) == 0)
+            {
+                topo_report(world);
+                return 0;
+            }
+        }
+    }
+
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        most = MAX(most, world->sectors[s].num_walls);
+    }
+    starts = malloc(most * sizeof(int32_t));
+    ends = malloc(most * sizeof(int32_t));
+    if(starts == NULL || ends == NULL || topo_alloc(topo, world->numSectors, world->numWalls) != 0)
+    {
+        if(starts == NULL || ends == NULL) printf("Out of memory building level topology\n");
+        free(starts);
+        free(ends);
+        return -1;
+    }
+
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        topo_sector(world, s, starts, ends);
+    }
+
+    free(starts);
+    free(ends);
+
+    topo_report(world);
+    if(level != NULL) topo_write_cache(topo, path, &header);
+
+    return 0;
+}
+
+/**
+ * Free the topology
+ */
+void topo_free(world_topo_t *topo)
+{
+    if(topo == NULL) return;
+
+    free(topo->nx);
+    free(topo->ny);
+    free(topo->length);
+    free(topo->flags);
+    memset(topo, 0, sizeof(*topo));
+}
+
+/**
+ * Set the neighbor of every wall from the walls sharing its edge, in
+ * time linear in the number of walls. A wall whose reversed edge belongs
+ * to another sector is a portal into it, and any other wall is solid.
+ * Neighbors given in the level file that disagree are reported.
+ * @param[in,out] world The world, with its walls linked
+ * @return 0 on success
+ */
+int8_t topo_autolink(world_t *world)
+{
+    topo_slot_t *table, *slot;
+    uint32_t cap = 16, mask, mismatched = 0, duplicates = 0, opened = 0;
+
+    if(world == NULL) return -1;
+    if(world->walls == NULL)
+    {
+        printf("Portals of streamed levels can't be linked automatically\n");
+        return -1;
+    }
+
+    while(cap < 2 * world->numWalls) cap *= 2;
+    mask = cap - 1;
+    table = malloc(cap * sizeof(topo_slot_t));
+    if(table == NULL)
+    {
+        printf("Out of memory linking portals\n");
+        return -1;
+    }
+    for(uint32_t i = 0; i < cap; ++i) table[i].key = EDGE_EMPTY;
+
+    // Every wall goes in under its own edge
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        sector_t *sect = &world->sectors[s];
+        for(uint16_t i = 0; i < sect->num_walls; ++i)
+        {
+            wall_t *wall = &sect->walls[i];
+            uint64_t key = topo_edge_key(wall->v0, wall->v1);
+
+            slot = topo_probe(table, mask, key);
+            if(slot->key == key)
+            {
+                if(++duplicates <= TOPO_MAX_REPORTS)
+                {
+                    printf("Sector %u wall %u repeats edge %i-%i of sector %u\n",
+                           s, i, wall->v0, wall->v1, slot->sector);
+                }
+                continue;
+            }
+            slot->key = key;
+            slot->wall = (sect->walls - world->walls) + i;
+            slot->sector = s;
+        }
+    }
+
+    // Then looks for the same edge the other way around
+    for(uint32_t s = 0; s < world->numSectors; ++s)
+    {
+        sector_t *sect = &world->sectors[s];
+        for(uint16_t i = 0; i < sect->num_walls; ++i)
+        {
+            wall_t *wall = &sect->walls[i];
+            int32_t neighbor = -1;
+
+            slot = topo_probe(table, mask, topo_edge_key(wall->v1, wall->v0));
+            if(slot->key != EDGE_EMPTY && slot->sector != s) neighbor = slot->sector;
+
+            if(wall->neighbor >= 0 && wall->neighbor != neighbor && ++mismatched <= TOPO_MAX_REPORTS)
+            {
+                if(neighbor < 0)
+                {
+                    printf("Sector %u wall %u links to sector %i, but shares no edge with it\n",
+                           s, i, wall->neighbor);
+                }
+                else
+                {
+                    printf("Sector %u wall %u links to sector %i, but its edge is shared with sector %i\n",
+                           s, i, wall->neighbor, neighbor);
+                }
+            }
+            if(wall->neighbor < 0 && neighbor >= 0) ++opened;
+            wall->neighbor = neighbor;
+        }
+    }
+
+    if(duplicates > TOPO_MAX_REPORTS)
+    {
+        printf("%u walls repeated an edge in all\n", duplicates);
+    }
+    if(mismatched > TOPO_MAX_REPORTS)
+    {
+        printf("%u walls disagreed with the level file in all\n", mismatched);
+    }
+    if(opened > 0)
+    {
+        printf("Linked %u walls the level file left solid\n", opened);
+    }
+
+    free(table);
+
+    return 0;
+}
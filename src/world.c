@@ -11,214 +11,971 @@
 // Global Headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 // Project headers
 #include "common.h"
+#include "pel.h"
+#include "stream.h"
+#include "spatial.h"
+#include "collide.h"
+#include "edge.h"
+#include "topo.h"
+#include "mobs.h"
 #include "render.h"
 #include "util.h"
 #include "input.h"
 #include "player.h"
+#include "job.h"
 
 /* ***********************************
  * Private Definitions
  * ***********************************/
-#define BUFLEN 256
+
+/** Starting capacity of the vertex/sector/wall arrays while loading */
+#define INITIAL_CAPACITY (64)
+
+/** Files smaller than this are always parsed on one thread */
+#define PARALLEL_MIN_BYTES (1024 * 1024)
+
+/** Chunks a file is split into per thread when parsed in parallel */
+#define CHUNKS_PER_THREAD (4)
 
 /* ***********************************
  * Private Typedefs
  * ***********************************/
 
+/** Capacity of each array that grows while loading */
+typedef struct load_caps_struct
+{
+    uint32_t vertices, sectors, walls, bounds, mobs;
+} load_caps_t;
+
+/** A mob record, kept until it can be spawned in file order */
+typedef struct load_mob_struct
+{
+    int32_t type, sector;
+    double x, y;
+} load_mob_t;
+
+/**
+ * A run of whole lines of the level file, parsed on its own by
+ * world_parse_parallel()
+ */
+typedef struct load_chunk_struct
+{
+    const char *buf;
+    size_t len;
+    xy_t *vertices;
+    sector_t *sectors;
+    wall_t *walls;
+    load_mob_t *mobs;
+    uint32_t numVertices, numSectors, numWalls, numMobs;
+    load_caps_t caps;
+    // Last player record in the chunk, if any
+    int hasPlayer;
+    xy_t player;
+    int32_t psector;
+    int8_t rc;
+} load_chunk_t;
+
 /* ***********************************
  * Private variables
  * ***********************************/
 
 static world_t _world;
 
+/** Flags the current world was loaded with */
+static uint32_t _load_flags = 0;
+
 /* ***********************************
  * Static function prototypes
  * ***********************************/
 
-void world_delete_sector(sector_t *sector);
+static int8_t world_grow(void **arr, uint32_t *cap, uint32_t need, size_t size);
+static int8_t world_parse_sector(pel_reader_t *r, load_caps_t *caps);
+static int8_t world_link_walls(void);
+static int8_t world_pack(void);
+static void world_unpack(void);
+static void world_sector_bounds(const wall_t *walls, uint16_t num_walls, box_t *box);
+static int world_read_vertex(pel_reader_t *r, xy_t *vert);
+static int world_read_player(pel_reader_t *r, xy_t *pos, int32_t *sector);
+static int world_read_mob(pel_reader_t *r, load_mob_t *mob);
+static int8_t world_parse_mob(pel_reader_t *r);
+static int8_t world_place_mobs(uint32_t flags);
+static void world_reset(void);
+static int8_t world_parse_serial(FILE *fp, int32_t *psector);
+static void world_parse_chunk(load_chunk_t *chunk);
+static void world_parse_chunks(void *arg, uint32_t begin, uint32_t end);
+static int8_t world_merge_chunks(load_chunk_t *chunks, uint32_t count, int32_t *psector);
+static int8_t world_parse_parallel(FILE *fp, long size, int32_t *psector);
 
 /* ***********************************
  * Static function implementation
  * ***********************************/
 
 /**
- * Free all data allocated for a sector
- * @note DOES NOT free the sector_t itself!
- * @param[in] sector The sector to free
+ * Make sure an array can hold at least /need elements, doubling its
+ * capacity as required so that loading stays linear in file size.
+ * @param[in,out] arr The array to grow
+ * @param[in,out] cap Current capacity, in elements
+ * @param[in] need Required number of elements
+ * @param[in] size Size of a single element
+ * @return 0 on success
  */
-void world_delete_sector(sector_t *sector)
+static int8_t world_grow(void **arr, uint32_t *cap, uint32_t need, size_t size)
 {
-    if(sector == NULL) { return; }
-    if(sector->walls != NULL) { free(sector->walls); }
-    return;
+    uint32_t ncap;
+    void *tmp;
+
+    if(need <= *cap) return 0;
+
+    ncap = (*cap) ? *cap : INITIAL_CAPACITY;
+    while(ncap < need) ncap *= 2;
+
+    tmp = realloc(*arr, (size_t)ncap * size);
+    if(tmp == NULL)
+    {
+        printf("Out of memory loading world\n");
+        return -1;
+    }
+    *arr = tmp;
+    *cap = ncap;
+
+    return 0;
 }
 
-/* ***********************************
- * Public function implementation
- * ***********************************/
+/**
+ * Parse the body of a sector record. Walls are appended to the
+ * shared wall array; the sector's wall pointer is set up once the
+ * whole file has been read. When streaming, the wall array is only
+ * scratch space and the walls are handed to the stream index.
+ * @return 0 on success
+ */
+static int8_t world_parse_sector(pel_reader_t *r, load_caps_t *caps)
+{
+    sector_t *sect;
+    uint32_t base;
+    long offset;
+
+    if(world_grow((void **)&_world.sectors, &caps->sectors, _world.numSectors + 1, sizeof(sector_t)) != 0)
+    {
+        return -1;
+    }
+    sect = &_world.sectors[_world.numSectors];
+
+    if(!pel_read_sector(r, sect))
+    {
+        printf("Malformed sector %u on line %u\n", _world.numSectors, r->line);
+        return -1;
+    }
+    offset = pel_tell(r);
+
+    base = (_load_flags & WORLD_LOAD_STREAM) ? 0 : _world.numWalls;
+    if(world_grow((void **)&_world.walls, &caps->walls, base + sect->num_walls, sizeof(wall_t)) != 0)
+    {
+        return -1;
+    }
+
+    // Read in all walls
+    for(uint16_t i = 0; i < sect->num_walls; ++i)
+    {
+        if(!pel_read_wall(r, &_world.walls[base + i]))
+        {
+            printf("Malformed wall %u of sector %u on line %u\n", i, _world.numSectors, r->line);
+            return -1;
+        }
+    }
+
+    if(_load_flags & WORLD_LOAD_STREAM)
+    {
+        if(stream_index_sector(_world.numSectors, offset, _world.walls, sect->num_walls) != 0
+           || world_grow((void **)&_world.bounds, &caps->bounds, _world.numSectors + 1, sizeof(box_t)) != 0)
+        {
+            return -1;
+        }
+        // Bounds have to be taken now, while the walls are at hand
+        world_sector_bounds(_world.walls, sect->num_walls, &_world.bounds[_world.numSectors]);
+    }
+    else
+    {
+        _world.numWalls += sect->num_walls;
+    }
+    ++_world.numSectors;
+
+    return 0;
+}
 
 /**
- * FORMAT OF INPUT FILE
- * 
- * VERTICES:
- * v [id] [x] [y]
- * 
- * SECTORS:
- * s [id] [floor] [ceiling] [brightness] [number of vectors] [list of vector ID] [list of sector ID portals]
- * 
- * PLAYER:
- * p [x] [y] [sector ID]
- *
+ * Get the bounding box of a list of walls
  */
+static void world_sector_bounds(const wall_t *walls, uint16_t num_walls, box_t *box)
+{
+    box->x0 = box->y0 =  INFINITY;
+    box->x1 = box->y1 = -INFINITY;
+    for(uint16_t i = 0; i < num_walls; ++i)
+    {
+        xy_t *v = &_world.vertices[walls[i].v0];
+        box->x0 = MIN(box->x0, v->x);  box->x1 = MAX(box->x1, v->x);
+        box->y0 = MIN(box->y0, v->y);  box->y1 = MAX(box->y1, v->y);
+    }
+}
 
 /**
- * Load specified input file
- * @param[in] filename The name of the world file to load
+ * Point every sector at its slice of the wall array, make sure all
+ * vertex and neighbor references are in range, and find sector bounds.
  * @return 0 on success
  */
-int8_t world_load(const char *filename)
+static int8_t world_link_walls(void)
 {
-    FILE *fp = fopen(filename, "rt");
-    char buf[BUFLEN * 4], word[BUFLEN], *ptr;
-    int n, i, rc, numVertices = 0;
-    xy_t *vert;
-    sector_t *sect;
+    uint32_t offset = 0;
 
-    if(fp == NULL)
+    _world.bounds = malloc(MAX(_world.numSectors, 1) * sizeof(box_t));
+    if(_world.bounds == NULL)
     {
-        printf("No file %s\n", filename);
+        printf("Out of memory loading world\n");
         return -1;
     }
 
+    for(uint32_t s = 0; s < _world.numSectors; ++s)
+    {
+        sector_t *sect = &_world.sectors[s];
+        sect->walls = &_world.walls[offset];
+        offset += sect->num_walls;
+
+        for(uint16_t i = 0; i < sect->num_walls; ++i)
+        {
+            wall_t *wall = &sect->walls[i];
+            if(wall->v0 < 0 || (uint32_t)wall->v0 >= _world.numVertices
+               || wall->v1 < 0 || (uint32_t)wall->v1 >= _world.numVertices
+               || wall->neighbor >= (int32_t)_world.numSectors)
+            {
+                printf("Sector %u wall %u references a missing vertex or sector\n", s, i);
+                return -1;
+            }
+        }
+        world_sector_bounds(sect->walls, sect->num_walls, &_world.bounds[s]);
+    }
+
+    return 0;
+}
+
+/**
+ * Build the packed layout from the loaded arrays
+ * @return 0 on success
+ */
+static int8_t world_pack(void)
+{
+    world_packed_t *pk = &_world.packed;
+    uint32_t nv = MAX(_world.numVertices, 1), nw = MAX(_world.numWalls, 1), ns = MAX(_world.numSectors, 1);
+
+    world_unpack();
+
+    pk->vx = malloc(nv * sizeof(float));
+    pk->vy = malloc(nv * sizeof(float));
+    pk->walls = malloc(nw * sizeof(pwall_t));
+    pk->wall_looks = malloc(nw * sizeof(pwall_look_t));
+    pk->sectors = malloc(ns * sizeof(psector_t));
+    pk->sector_looks = malloc(ns * sizeof(psector_look_t));
+    if(!pk->vx || !pk->vy || !pk->walls || !pk->wall_looks || !pk->sectors || !pk->sector_looks)
+    {
+        printf("Out of memory packing world\n");
+        world_unpack();
+        return -1;
+    }
+
+    for(uint32_t v = 0; v < _world.numVertices; ++v)
+    {
+        pk->vx[v] = _world.vertices[v].x;
+        pk->vy[v] = _world.vertices[v].y;
+    }
+    for(uint32_t w = 0; w < _world.numWalls; ++w)
+    {
+        wall_t *wall = &_world.walls[w];
+        pk->walls[w] = (pwall_t){wall->v0, wall->v1, wall->neighbor};
+        pk->wall_looks[w] = (pwall_look_t){wall->texture_low, wall->texture_mid, wall->texture_high};
+    }
+    for(uint32_t s = 0; s < _world.numSectors; ++s)
+    {
+        sector_t *sect = &_world.sectors[s];
+        pk->sectors[s] = (psector_t){sect->floor, sect->ceil, sect->walls - _world.walls, sect->num_walls};
+        pk->sector_looks[s] = (psector_look_t){sect->texture_floor, sect->texture_ceil, sect->brightness};
+    }
+
+    pk->numVertices = _world.numVertices;
+    pk->numSectors = _world.numSectors;
+    pk->numWalls = _world.numWalls;
+
+    return 0;
+}
+
+/**
+ * Free the packed layout
+ */
+static void world_unpack(void)
+{
+    world_packed_t *pk = &_world.packed;
+
+    free(pk->vx);
+    free(pk->vy);
+    free(pk->walls);
+    free(pk->wall_looks);
+    free(pk->sectors);
+    free(pk->sector_looks);
+    memset(pk, 0, sizeof(*pk));
+}
+
+/**
+ * Read the body of a vertex record: ID X Y
+ * @return 1 on success, 0 if the record is malformed
+ */
+static int world_read_vertex(pel_reader_t *r, xy_t *vert)
+{
+    char word[PEL_TOKEN_LEN];
+
+    return pel_read_word(r, word, sizeof(word))
+           && pel_read_double(r, &vert->x) && pel_read_double(r, &vert->y);
+}
+
+/**
+ * Read the body of a player record: X Y Sector. A missing sector
+ * comes back as -1, to be found once the spatial index is built.
+ * @return 1 on success, 0 if the record is malformed
+ */
+static int world_read_player(pel_reader_t *r, xy_t *pos, int32_t *sector)
+{
+    if(!pel_read_double(r, &pos->x) || !pel_read_double(r, &pos->y)) return 0;
+    if(!pel_read_int(r, sector)) *sector = -1;
+
+    return 1;
+}
+
+/**
+ * Read the body of a mob record: Type X Y Sector. A missing sector
+ * comes back as -1, as for the player.
+ * @return 1 on success, 0 if the record is malformed
+ */
+static int world_read_mob(pel_reader_t *r, load_mob_t *mob)
+{
+    if(!pel_read_int(r, &mob->type) || !pel_read_double(r, &mob->x) || !pel_read_double(r, &mob->y)
+       || mob->type <= MOB_TYPE_PLAYER || mob->type >= MOB_TYPE_NUMBER)
+    {
+        return 0;
+    }
+    if(!pel_read_int(r, &mob->sector)) mob->sector = -1;
+
+    return 1;
+}
+
+/**
+ * Parse the body of a mob record and spawn it. Placement waits
+ * until the sectors are known, see world_place_mobs().
+ * @return 0 on success
+ */
+static int8_t world_parse_mob(pel_reader_t *r)
+{
+    load_mob_t mob;
+
+    if(!world_read_mob(r, &mob))
+    {
+        printf("Malformed mob on line %u\n", r->line);
+        return -1;
+    }
+
+    if(mobs_spawn((mob_type_t)mob.type, mob.x, mob.y,
+                  (mob.sector < 0) ? MOBS_NO_SECTOR : (uint32_t)mob.sector) == MOBS_HANDLE_NONE)
+    {
+        printf("Can't spawn mob on line %u\n", r->line);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Find the sector of every mob loaded without one, and stand all
+ * of them on the floor
+ * @param flags WORLD_LOAD_ flags the world was loaded with
+ * @return 0 on success
+ */
+static int8_t world_place_mobs(uint32_t flags)
+{
+    mobs_t *mobs = mobs_get();
+    int32_t sector;
+
+    for(uint32_t i = 0; i < mobs->count; ++i)
+    {
+        if(mobs->sector[i] == MOBS_NO_SECTOR && (flags & WORLD_LOAD_STREAM))
+        {
+            // Nothing is resident yet, so there's nothing to search
+            printf("Streamed levels need a mob sector, for the mob at (%.2f, %.2f)\n", mobs->x[i], mobs->y[i]);
+            return -1;
+        }
+        if(mobs->sector[i] == MOBS_NO_SECTOR)
+        {
+            sector = world_find_sector(&(xy_t){mobs->x[i], mobs->y[i]}, -1);
+            if(sector < 0)
+            {
+                printf("Mob at (%.2f, %.2f) is outside the world\n", mobs->x[i], mobs->y[i]);
+                return -1;
+            }
+            mobs->sector[i] = sector;
+        }
+        else if(mobs->sector[i] >= _world.numSectors)
+        {
+            printf("Mob starts in missing sector %u\n", mobs->sector[i]);
+            return -1;
+        }
+        mobs->z[i] = _world.sectors[mobs->sector[i]].floor;
+    }
+
+    return 0;
+}
+
+/**
+ * Start an empty world, with the player at the origin
+ */
+static void world_reset(void)
+{
+    ++_world.revision;
+    free(_world.vertices);
+    free(_world.sectors);
+    free(_world.walls);
+    free(_world.bounds);
+    _world.numVertices = 0;
     _world.numSectors = 0;
+    _world.numWalls = 0;
     _world.sectors = NULL;
     _world.vertices = NULL;
+    _world.walls = NULL;
+    _world.bounds = NULL;
 
+    mobs_clear();
+    mob_close(&_world.player);
     mob_init(&_world.player, MOB_TYPE_PLAYER);
 
     // Set default values for player
     _world.player.pos.x = 0;
     _world.player.pos.y = 0;
     _world.player.sector = 0;
+}
+
+/**
+ * Parse a level file one record at a time
+ * @param[out] psector The player's sector, -1 if it is to be found
+ * @return 0 on success
+ */
+static int8_t world_parse_serial(FILE *fp, int32_t *psector)
+{
+    pel_reader_t reader;
+    load_caps_t caps = {0, 0, 0, 0, 0};
+    int8_t rc = 0;
+    int type;
+    xy_t pos;
 
-    // Read the file
-    while(fgets(buf, sizeof(buf), fp))
+    if(pel_open_file(&reader, fp) != 0) return -1;
+
+    while(rc == 0 && (type = pel_next_record(&reader)) != PEL_EOF)
     {
-        rc = sscanf(buf, "%32s%n", word, &n);
-        ptr = buf + n;
-        switch((rc > 0) ? word[0] : '\0')
+        switch(type)
         {
             case 'v':   // Vertex
-                _world.vertices = realloc(_world.vertices, (++numVertices) * sizeof(xy_t));
-                vert = &(_world.vertices[numVertices - 1]);
-                // Read in: ID X Y
-                rc = sscanf(ptr, "%*i %lf %lf", &(vert->x), &(vert->y));
+                rc = world_grow((void **)&_world.vertices, &caps.vertices, _world.numVertices + 1, sizeof(xy_t));
+                if(rc != 0) break;
+                if(!world_read_vertex(&reader, &_world.vertices[_world.numVertices]))
+                {
+                    printf("Malformed vertex on line %u\n", reader.line);
+                    rc = -1;
+                    break;
+                }
+                ++_world.numVertices;
                 break;
             case 's':   // Sector
-                
-                _world.sectors = realloc(_world.sectors, (++(_world.numSectors)) * sizeof(sector_t));
-                sect = &(_world.sectors[_world.numSectors - 1]);
+                rc = world_parse_sector(&reader, &caps);
+                break;
+            case 'p':   // Player
+                if(!world_read_player(&reader, &pos, psector))
+                {
+                    printf("Malformed player on line %u\n", reader.line);
+                    rc = -1;
+                    break;
+                }
+                _world.player.pos.x = pos.x;
+                _world.player.pos.y = pos.y;
+                break;
+            case 'm':   // Mob
+                rc = world_parse_mob(&reader);
+                break;
+            default:
+                break;
+        }
+        pel_skip_line(&reader);
+    }
+
+    pel_close(&reader);
 
-                // Read in: ID Floor Ceiling NumVertices
-                rc = sscanf(ptr, "%*i %lf %lf %hi %hi %hhi %hu%n", &sect->floor, &sect->ceil,
-                                                            &sect->texture_floor, &sect->texture_ceil,
-                                                            &sect->brightness, &sect->num_walls, &n);
-                ptr += n;
+    return rc;
+}
 
-                // TODO load textures
-                //sect->texture_floor = TEXTURE_MOSS;
-                //sect->texture_ceil  = TEXTURE_SMOOTHSTONE;
+/**
+ * Parse one chunk of a level file into its own arrays. Errors aren't
+ * reported here, see world_parse_parallel().
+ */
+static void world_parse_chunk(load_chunk_t *chunk)
+{
+    pel_reader_t reader;
+    sector_t *sect;
+    int type;
 
-                sect->walls = (wall_t *)malloc(sect->num_walls * sizeof(wall_t));
+    pel_open_mem(&reader, chunk->buf, chunk->len);
 
-                // Read in all walls
-                for(i = 0; i < sect->num_walls; ++i)
+    while(chunk->rc == 0 && (type = pel_next_record(&reader)) != PEL_EOF)
+    {
+        switch(type)
+        {
+            case 'v':
+                chunk->rc = world_grow((void **)&chunk->vertices, &chunk->caps.vertices,
+                                       chunk->numVertices + 1, sizeof(xy_t));
+                if(chunk->rc != 0) break;
+                if(!world_read_vertex(&reader, &chunk->vertices[chunk->numVertices])) chunk->rc = -1;
+                else ++chunk->numVertices;
+                break;
+            case 's':
+                chunk->rc = world_grow((void **)&chunk->sectors, &chunk->caps.sectors,
+                                       chunk->numSectors + 1, sizeof(sector_t));
+                if(chunk->rc != 0) break;
+                sect = &chunk->sectors[chunk->numSectors];
+                if(!pel_read_sector(&reader, sect)
+                   || world_grow((void **)&chunk->walls, &chunk->caps.walls,
+                                 chunk->numWalls + sect->num_walls, sizeof(wall_t)) != 0)
+                {
+                    chunk->rc = -1;
+                    break;
+                }
+                for(uint16_t i = 0; i < sect->num_walls && chunk->rc == 0; ++i)
                 {
-                    // Get vertices
-                    rc = sscanf(ptr, "%i %i%n", &sect->walls[i].v0, &sect->walls[i].v1, &n);
-                    ptr += n;
-                    // Get neighbor
-                    rc = sscanf(ptr, "%32s%n", word, &n);
-                    ptr += n;
-                    // Value of 'x' means no neighbor
-                    if(word[0] == 'x')
-                    {
-                        sect->walls[i].neighbor = -1;
-                    }
-                    else
-                    {
-                        sscanf(word, "%i", &(sect->walls[i].neighbor));
-                    }
-                    // Get textures
-                    rc = sscanf(ptr, "%hi %hi %hi%n", &sect->walls[i].texture_low,
-                                                   &sect->walls[i].texture_mid, 
-                                                   &sect->walls[i].texture_high,
-                                                   &n);
-                    ptr += n;
-                    //sect->walls[i].texture_low  = TEXTURE_SMOOTHSTONE;
-                    //sect->walls[i].texture_mid  = TEXTURE_RUSTYSHEET;
-                    //sect->walls[i].texture_high = TEXTURE_BRICK;
+                    if(!pel_read_wall(&reader, &chunk->walls[chunk->numWalls + i])) chunk->rc = -1;
                 }
+                chunk->numWalls += sect->num_walls;
+                ++chunk->numSectors;
                 break;
-            case 'p':   // Player
-                // Read in: x y sector
-                sscanf(ptr, "%lf %lf %i", &_world.player.pos.x, &_world.player.pos.y, &_world.player.sector);
+            case 'p':
+                if(!world_read_player(&reader, &chunk->player, &chunk->psector)) chunk->rc = -1;
+                else chunk->hasPlayer = 1;
+                break;
+            case 'm':
+                chunk->rc = world_grow((void **)&chunk->mobs, &chunk->caps.mobs,
+                                       chunk->numMobs + 1, sizeof(load_mob_t));
+                if(chunk->rc != 0) break;
+                if(!world_read_mob(&reader, &chunk->mobs[chunk->numMobs])) chunk->rc = -1;
+                else ++chunk->numMobs;
                 break;
             default:
                 break;
         }
+        pel_skip_line(&reader);
     }
 
-    // Set player height
-    _world.player.pos.z = _world.sectors[_world.player.sector].floor;
+    pel_close(&reader);
+}
 
-    fclose(fp);
+/**
+ * Job to parse chunks [begin, end)
+ */
+static void world_parse_chunks(void *arg, uint32_t begin, uint32_t end)
+{
+    load_chunk_t *chunks = arg;
+
+    for(uint32_t c = begin; c < end; ++c) world_parse_chunk(&chunks[c]);
+}
+
+/**
+ * Append the parsed chunks to the world in file order, so IDs are the
+ * same as when parsing on one thread
+ * @return 0 on success
+ */
+static int8_t world_merge_chunks(load_chunk_t *chunks, uint32_t count, int32_t *psector)
+{
+    uint32_t nv = 0, ns = 0, nw = 0;
+
+    for(uint32_t c = 0; c < count; ++c)
+    {
+        if(chunks[c].rc != 0) return -1;
+        nv += chunks[c].numVertices;
+        ns += chunks[c].numSectors;
+        nw += chunks[c].numWalls;
+    }
+
+    _world.vertices = malloc(MAX(nv, 1) * sizeof(xy_t));
+    _world.sectors = malloc(MAX(ns, 1) * sizeof(sector_t));
+    _world.walls = malloc(MAX(nw, 1) * sizeof(wall_t));
+    if(_world.vertices == NULL || _world.sectors == NULL || _world.walls == NULL)
+    {
+        printf("Out of memory loading world\n");
+        return -1;
+    }
+
+    for(uint32_t c = 0; c < count; ++c)
+    {
+        load_chunk_t *chunk = &chunks[c];
+
+        memcpy(&_world.vertices[_world.numVertices], chunk->vertices, chunk->numVertices * sizeof(xy_t));
+        memcpy(&_world.sectors[_world.numSectors], chunk->sectors, chunk->numSectors * sizeof(sector_t));
+        memcpy(&_world.walls[_world.numWalls], chunk->walls, chunk->numWalls * sizeof(wall_t));
+        _world.numVertices += chunk->numVertices;
+        _world.numSectors += chunk->numSectors;
+        _world.numWalls += chunk->numWalls;
+
+        if(chunk->hasPlayer)
+        {
+            _world.player.pos.x = chunk->player.x;
+            _world.player.pos.y = chunk->player.y;
+            *psector = chunk->psector;
+        }
+        for(uint32_t m = 0; m < chunk->numMobs; ++m)
+        {
+            load_mob_t *mob = &chunk->mobs[m];
+            if(mobs_spawn((mob_type_t)mob->type, mob->x, mob->y,
+                          (mob->sector < 0) ? MOBS_NO_SECTOR : (uint32_t)mob->sector) == MOBS_HANDLE_NONE)
+            {
+                return -1;
+            }
+        }
+    }
 
     return 0;
 }
 
 /**
- * Free all memory related to the world
+ * Parse a level file on every job thread. The file is read in whole and
+ * split into chunks of whole lines, since every record is a single line.
+ * @param[out] psector The player's sector, -1 if it is to be found
+ * @return 0 on success. The file isn't checked for errors beyond failing,
+ *         so the caller parses it again with world_parse_serial() to
+ *         report them.
  */
-void world_close(void)
+static int8_t world_parse_parallel(FILE *fp, long size, int32_t *psector)
 {
-    // Free vertex array
-    if(_world.vertices) free(_world.vertices);
-    if(_world.sectors)
+    uint32_t count = job_threads() * CHUNKS_PER_THREAD;
+    load_chunk_t *chunks;
+    size_t start = 0;
+    char *text;
+    int8_t rc;
+
+    text = malloc(size);
+    chunks = calloc(count, sizeof(load_chunk_t));
+    // Text mode may hand back fewer bytes than the file holds
+    if(text == NULL || chunks == NULL || (size = fread(text, 1, size, fp)) == 0)
+    {
+        free(text);
+        free(chunks);
+        return -1;
+    }
+
+    // Each chunk ends at the first newline past its share of the file
+    for(uint32_t c = 0; c < count; ++c)
+    {
+        size_t end = MAX(start, ((size_t)size * (c + 1)) / count);
+        const char *nl = (end < (size_t)size) ? memchr(text + end, '\n', size - end) : NULL;
+
+        end = (nl) ? (size_t)(nl - text) + 1 : (size_t)size;
+        chunks[c].buf = text + start;
+        chunks[c].len = end - start;
+        start = end;
+    }
+
+    job_parallel_for(count, 1, world_parse_chunks, chunks);
+    rc = world_merge_chunks(chunks, count, psector);
+
+    for(uint32_t c = 0; c < count; ++c)
+    {
+        free(chunks[c].vertices);
+        free(chunks[c].sectors);
+        free(chunks[c].walls);
+        free(chunks[c].mobs);
+    }
+    free(chunks);
+    free(text);
+
+    return rc;
+}
+
+/* ***********************************
+ * Public function implementation
+ * ***********************************/
+
+/**
+ * FORMAT OF INPUT FILE
+ * 
+ * VERTICES:
+ * v [id] [x] [y]
+ * 
+ * SECTORS:
+ * s [id] [floor] [ceiling] [floor texture] [ceiling texture] [brightness] [number of walls] {list of walls}
+ * 
+ * WALLS:
+ * [vertex0] [vertex1] [neighbor or x] [texture low] [texture mid] [texture high]
+ *
+ * PLAYER:
+ * p [x] [y] [sector ID]
+ * The sector ID may be left out, in which case it is looked up.
+ *
+ * MOBS:
+ * m [type] [x] [y] [sector ID]
+ * The sector ID may be left out as for the player.
+ *
+ * Records are read as a stream of tokens, so lines may be any length.
+ */
+
+/**
+ * Load specified input file
+ * @param[in] filename The name of the world file to load
+ * @return 0 on success
+ */
+int8_t world_load(const char *filename)
+{
+    return world_load_ex(filename, 0);
+}
+
+/**
+ * Load specified input file
+ * @param[in] filename The name of the world file to load
+ * @param[in] flags WORLD_LOAD_* flags
+ * @return 0 on success
+ */
+int8_t world_load_ex(const char *filename, uint32_t flags)
+{
+    FILE *fp = fopen(filename, "rt");
+    int32_t psector = 0;
+    int8_t rc = -1;
+    long size = 0;
+
+    if(fp == NULL)
+    {
+        printf("No file %s\n", filename);
+        return -1;
+    }
+    if(fseek(fp, 0, SEEK_END) == 0) size = ftell(fp);
+    rewind(fp);
+
+    _load_flags = flags;
+    if(flags & WORLD_LOAD_STREAM) stream_begin();
+
+    world_reset();
+
+    // Large levels are split across the job threads. Streaming needs
+    // file offsets of each sector, so is always done in one pass.
+    if(!(flags & WORLD_LOAD_STREAM) && job_threads() > 1 && size >= PARALLEL_MIN_BYTES)
     {
-        // Iterate through each sector and free its data
-        for(int i = 0; i < _world.numSectors; ++i)
+        rc = world_parse_parallel(fp, size, &psector);
+        if(rc != 0)
         {
-            world_delete_sector(&_world.sectors[i]);
+            // Go through it again on one thread to find the problem
+            world_reset();
+            psector = 0;
+            rewind(fp);
         }
-        free(_world.sectors);
     }
+    if(rc != 0)
+    {
+        rc = world_parse_serial(fp, &psector);
+    }
+
+    fclose(fp);
+
+    if(rc == 0 && (flags & WORLD_LOAD_STREAM) && (flags & WORLD_LOAD_AUTOLINK))
+    {
+        // The stream index keeps the neighbors from the file
+        printf("Portals of streamed levels can't be linked automatically\n");
+        rc = -1;
+    }
+    if(rc == 0 && (flags & WORLD_LOAD_STREAM) && psector < 0)
+    {
+        // Nothing is resident yet, so there's nothing to search
+        printf("Streamed levels need a player sector\n");
+        rc = -1;
+    }
+    if(rc == 0 && (flags & WORLD_LOAD_STREAM))
+    {
+        // Scratch walls are no longer needed
+        free(_world.walls);
+        _world.walls = NULL;
+    }
+    else if(rc == 0)
+    {
+        rc = world_link_walls();
+        if(rc == 0 && (flags & WORLD_LOAD_AUTOLINK)) rc = topo_autolink(&_world);
+        if(rc == 0) rc = world_pack();
+        if(rc == 0) rc = topo_build(&_world, (flags & WORLD_LOAD_TOPO_CACHE) ? filename : NULL);
+    }
+    if(rc == 0)
+    {
+        rc = spatial_build(_world.bounds, _world.numSectors);
+    }
+    if(rc == 0)
+    {
+        rc = collide_build(&_world);
+    }
+    if(rc == 0)
+    {
+        rc = edge_build(&_world);
+    }
+    if(rc == 0)
+    {
+        _world.player.sector = (psector < 0) ? world_find_sector(&(xy_t){_world.player.pos.x, _world.player.pos.y}, -1)
+                                             : psector;
+        if(_world.player.sector >= _world.numSectors)
+        {
+            printf("Player starts in missing sector %i\n", (int32_t)_world.player.sector);
+            rc = -1;
+        }
+    }
+    if(rc == 0)
+    {
+        rc = world_place_mobs(flags);
+    }
+    if(rc == 0 && (flags & WORLD_LOAD_STREAM))
+    {
+        // Load around the player
+        rc = stream_start(filename);
+        if(rc == 0) rc = stream_update(_world.player.sector, 1);
+    }
+    if(rc != 0)
+    {
+        world_close();
+        return rc;
+    }
+
+    // Set player height
+    _world.player.pos.z = _world.sectors[_world.player.sector].floor;
+
+    return 0;
+}
+
+/**
+ * Free all memory related to the world
+ */
+void world_close(void)
+{
+    stream_close();
+    spatial_close();
+    collide_close();
+    edge_close();
+    world_unpack();
+    topo_free(&_world.topo);
+    mobs_clear();
+    mob_close(&_world.player);
+
+    // Free vertex, wall and sector arrays
+    if(_world.vertices) free(_world.vertices);
+    if(_world.walls) free(_world.walls);
+    if(_world.sectors) free(_world.sectors);
+    if(_world.bounds) free(_world.bounds);
+
+    _world.vertices = NULL;
+    _world.walls = NULL;
+    _world.sectors = NULL;
+    _world.bounds = NULL;
+    _world.numVertices = 0;
+    _world.numWalls = 0;
+    _world.numSectors = 0;
+    ++_world.revision;
 
     return;
 }
 
-void world_tick(keys_t *keys)
+void world_tick(input_frame_t *input)
 {
+    // Bring in regions around the player
+    if(stream_active()) stream_update(_world.player.sector, 0);
+
     // Check user keys
-    player_handle_input(&_world.player, keys);
+    player_handle_input(&_world.player, input);
 
     // Update player position
     mob_pos_update(&_world.player);
+    world_player_update_sector();
+
+    // Everything else
+    mobs_tick();
 }
 
 /**
  * Updates the sector that the player is currently in
  */
-void world_player_update_sector()
+void world_player_update_sector(void)
+{
+    world_mob_relocate(&_world.player);
+}
+
+/**
+ * Make sure a mob's sector actually contains it, and move it to the
+ * one that does if not. Used after teleports and to recover when
+ * movement tracking has lost the mob.
+ * @return 0 if the mob is inside a sector, -1 if it's in the void
+ */
+int8_t world_mob_relocate(mob_t *mob)
+{
+    xy_t p;
+    int32_t sector;
+
+    if(mob == NULL) return -1;
+
+    p.x = mob->pos.x;
+    p.y = mob->pos.y;
+    sector = world_find_sector(&p, mob->sector);
+    if(sector < 0) return -1;
+
+    mob->sector = sector;
+
+    return 0;
+}
+
+/**
+ * Find the sector containing a point
+ * @param[in] p The point
+ * @param[in] hint A sector the point is likely in or next to, or -1
+ * @return The sector ID, or -1 if the point isn't inside any
+ *         resident sector
+ */
+int32_t world_find_sector(xy_t *p, int32_t hint)
 {
-    float px = _world.player.pos.x, py = _world.player.pos.y;
-    sector_t *sect = &_world.sectors[_world.player.sector];
-    // First, check if player is still in their current sector
-    
+    const uint32_t *ids;
+    uint32_t count;
+    sector_t *sect;
+
+    // Most lookups are for a point that is still in its old
+    // sector, or has just stepped into a neighbor
+    if(hint >= 0 && (uint32_t)hint < _world.numSectors)
+    {
+        sect = &_world.sectors[hint];
+        if(world_inside_sector(p, sect)) return hint;
+
+        for(uint16_t i = 0; SECTOR_RESIDENT(sect) && i < sect->num_walls; ++i)
+        {
+            int32_t n = sect->walls[i].neighbor;
+            if(n >= 0 && BoxContains(&_world.bounds[n], p->x, p->y)
+               && world_inside_sector(p, &_world.sectors[n]))
+            {
+                return n;
+            }
+        }
+    }
+
+    // Fall back on the grid
+    count = spatial_candidates(p->x, p->y, &ids);
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if((int32_t)ids[i] == hint) continue;
+        if(BoxContains(&_world.bounds[ids[i]], p->x, p->y)
+           && world_inside_sector(p, &_world.sectors[ids[i]]))
+        {
+            return ids[i];
+        }
+    }
+
+    return -1;
 }
 
 /**
@@ -237,6 +994,13 @@ int world_inside_sector(xy_t *p, sector_t *sect)
 {
     float dx, x;
     uint16_t count = 0;
+    // Walls of streamed out sectors aren't available
+    if(sect->walls == NULL) return 0;
+    // Test every wall at once when the world is all in memory
+    if(edge_ready())
+    {
+        return edge_crossings(sect->walls - _world.walls, sect->num_walls, p->x, p->y) & 0x1;
+    }
     for(int i = 0; i < sect->num_walls; ++i)
     {
         // Get the vertices for this edge
@@ -271,6 +1035,7 @@ sector_t *world_get_sector(uint32_t id)
     {
         return &_world.sectors[id];
     }
+    return NULL;
 }
 
 /**
@@ -0,0 +1,289 @@
+/**
+ * Frame ring reader. Attaches to the frame ring of a running game
+ * (see framering.h) and writes the frames it publishes to a Y4M
+ * video, 4:2:0 with full range BT.601 color.
+ *
+ * Usage: ring2y4m NAME [OUT] [--fps N] [--frames N]
+ *
+ * OUT defaults to standard output, so frames can be piped straight
+ * into an encoder. Stops when the game closes the ring, or after
+ * --frames frames. Frames the game draws faster than they can be
+ * written are dropped, and counted at the end.
+ */
+
+// shm_open(), mmap() and nanosleep()
+#define _POSIX_C_SOURCE 200809L
+
+/* ***********************************
+ * Includes
+ * ***********************************/
+
+// Global Headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project headers
+#include "common.h"
+#include "framering.h"
+
+/* ***********************************
+ * Private Definitions
+ * ***********************************/
+
+/** Frame rate written to the video when none is given */
+#define Y4M_FPS (60)
+
+/** How long to wait for the game to open the ring, and how
+ * often to look for it and for new frames, in ms */
+#define RING_WAIT_MS (10000)
+#define RING_POLL_MS (1)
+
+/* ***********************************
+ * Static function prototypes
+ * ***********************************/
+
+static int8_t ring_parse_count(const char *option, const char *arg, uint32_t *val);
+static void ring_sleep(uint32_t ms);
+static framering_header_t *ring_attach(const char *name, size_t *size);
+static void ring_convert(framering_header_t *ring, uint32_t slot, uint8_t *yuv);
+
+/* ***********************************
+ * Static function implementation
+ * ***********************************/
+
+/**
+ * Read the whole number given to a command line option, which must
+ * be at least 1
+ * @param[out] val The number, left alone if it isn't valid
+ * @return 0 on success, -1 after saying why the value was rejected
+ */
+static int8_t ring_parse_count(const char *option, const char *arg, uint32_t *val)
+{
+    char *end;
+    unsigned long n = strtoul(arg, &end, 10);
+
+    if(end == arg || *end != '\0' || arg[0] == '-' || n < 1 || n > UINT32_MAX)
+    {
+        fprintf(stderr, "%s takes a whole number from 1 to %u, not %s\n", option, UINT32_MAX, arg);
+        return -1;
+    }
+    *val = (uint32_t)n;
+
+    return 0;
+}
+
+static void ring_sleep(uint32_t ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Map a ring, waiting for the game to make it
+ * @param[out] size Bytes mapped
+ * @return The ring, or NULL if it didn't show up
+ */
+static framering_header_t *ring_attach(const char *name, size_t *size)
+{
+    framering_header_t *ring;
+    struct stat st;
+    int fd = -1;
+
+    for(uint32_t waited = 0; fd < 0 && waited < RING_WAIT_MS; waited += 10)
+    {
+        fd = shm_open(name, O_RDONLY, 0);
+        if(fd < 0) ring_sleep(10);
+    }
+    if(fd < 0)
+    {
+        fprintf(stderr, "No frame ring %s\n", name);
+        return NULL;
+    }
+
+    // The game sizes the ring before filling in the header
+    for(uint32_t waited = 0; waited < RING_WAIT_MS; waited += 10)
+    {
+        if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(framering_header_t)) break;
+        ring_sleep(10);
+    }
+    *size = st.st_size;
+    ring = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+    {
+        fprintf(stderr, "Can't map frame ring %s\n", name);
+        return NULL;
+    }
+
+    for(uint32_t waited = 0; memcmp(ring->magic, FRAMERING_MAGIC, 4) != 0; waited += 10)
+    {
+        if(waited >= RING_WAIT_MS) break;
+        ring_sleep(10);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if(memcmp(ring->magic, FRAMERING_MAGIC, 4) != 0 || ring->version != FRAMERING_VERSION
+       || ring->slots == 0 || framering_size(ring->slots, ring->pitch, ring->format.height) > *size)
+    {
+        fprintf(stderr, "%s isn't a frame ring this reader understands\n", name);
+        munmap(ring, *size);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * Convert the frame in a slot to planar 4:2:0 YUV, reading it where
+ * it lies in the ring. Chroma is averaged over each 2x2 block.
+ */
+static void ring_convert(framering_header_t *ring, uint32_t slot, uint8_t *yuv)
+{
+    const framering_format_t *f = &ring->format;
+    const uint32_t *pix = framering_pixels(ring, slot);
+    uint32_t stride = ring->pitch / sizeof(uint32_t);
+    uint32_t cw = (f->width + 1) / 2, ch = (f->height + 1) / 2;
+    uint8_t *py = yuv, *pu = yuv + (f->width * f->height), *pv = pu + (cw * ch);
+
+    for(uint32_t cy = 0; cy < ch; ++cy)
+    {
+        for(uint32_t cx = 0; cx < cw; ++cx)
+        {
+            int32_t r = 0, g = 0, b = 0, n = 0;
+
+            for(uint32_t y = cy * 2; y < MIN(cy * 2 + 2, f->height); ++y)
+            {
+                for(uint32_t x = cx * 2; x < MIN(cx * 2 + 2, f->width); ++x)
+                {
+                    uint32_t p = pix[(y * stride) + x];
+                    int32_t pr = (p >> f->rshift) & 0xFF, pg = (p >> f->gshift) & 0xFF, pb = (p >> f->bshift) & 0xFF;
+
+                    py[(y * f->width) + x] = (uint8_t)(((77 * pr) + (150 * pg) + (29 * pb) + 128) >> 8);
+                    r += pr;  g += pg;  b += pb;  ++n;
+                }
+            }
+            r /= n;  g /= n;  b /= n;
+            pu[(cy * cw) + cx] = (uint8_t)((((-43 * r) - (85 * g) + (128 * b) + 128) >> 8) + 128);
+            pv[(cy * cw) + cx] = (uint8_t)((((128 * r) - (107 * g) - (21 * b) + 128) >> 8) + 128);
+        }
+    }
+}
+
+/* ***********************************
+ * Main function
+ * ***********************************/
+int main(int argc, char *argv[])
+{
+    const char *name = NULL, *outName = "-";
+    uint32_t fps = Y4M_FPS, limit = 0, written = 0;
+    uint64_t last = 0, dropped = 0;
+    framering_header_t *ring;
+    size_t size, frameBytes;
+    uint8_t *yuv;
+    FILE *out;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            if(ring_parse_count(argv[i], argv[i + 1], &fps) != 0) return -1;
+            ++i;
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            if(ring_parse_count(argv[i], argv[i + 1], &limit) != 0) return -1;
+            ++i;
+        }
+        else if(name == NULL) name = argv[i];
+        else outName = argv[i];
+    }
+    if(name == NULL)
+    {
+        fprintf(stderr, "Usage: %s NAME [OUT] [--fps N] [--frames N]\n", argv[0]);
+        return -1;
+    }
+
+    ring = ring_attach(name, &size);
+    if(ring == NULL) return -1;
+
+    frameBytes = (ring->format.width * ring->format.height)
+               + (2 * ((ring->format.width + 1) / 2) * ((ring->format.height + 1) / 2));
+    yuv = malloc(frameBytes);
+    out = (strcmp(outName, "-") == 0) ? stdout : fopen(outName, "wb");
+    if(yuv == NULL || out == NULL)
+    {
+        fprintf(stderr, "Can't write %s\n", outName);
+        free(yuv);
+        munmap(ring, size);
+        return -1;
+    }
+
+    fprintf(out, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", ring->format.width, ring->format.height, fps);
+    // Start from the next frame published
+    last = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while(limit == 0 || written < limit)
+    {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t next = last + 1;
+
+        if(head < last)
+        {
+            fprintf(stderr, "Frame ring %s was restarted\n", name);
+            break;
+        }
+        if(head == last)
+        {
+            if(atomic_load(&ring->closed)) break;
+            ring_sleep(RING_POLL_MS);
+            continue;
+        }
+
+        // Frames overwritten already are lost
+        if(head - next >= ring->slots - 1)
+        {
+            dropped += (head - ring->slots + 2) - next;
+            next = head - ring->slots + 2;
+        }
+
+        for(; next <= head && (limit == 0 || written < limit); ++next)
+        {
+            framering_slot_t *slot = framering_slot(ring, next % ring->slots);
+            uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+            if(seq != (next << 1))
+            {
+                ++dropped;
+                continue;
+            }
+            ring_convert(ring, next % ring->slots, yuv);
+            // The game may have started on the slot again meanwhile
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+            {
+                ++dropped;
+                continue;
+            }
+
+            fputs("FRAME\n", out);
+            fwrite(yuv, 1, frameBytes, out);
+            ++written;
+        }
+        last = head;
+    }
+
+    fprintf(stderr, "Wrote %u frames, dropped %llu\n", written, (unsigned long long)dropped);
+
+    if(out != stdout) fclose(out);
+    free(yuv);
+    munmap(ring, size);
+
+    return 0;
+}